@@ -36,18 +36,42 @@ extern const double EPSILON;
 extern const int MAX_WIDTH;
 extern const int MAX_HEIGHT;
 
-// number of top matches that are tested for geometric validation
+// number of top matches returned for a query
 extern const int NUM_TOP_MATCHES;
 
+// vocabulary tree training sample, records are streamed so the corpus does not have to fit in memory
+extern const int VOCAB_SAMPLE_SIZE;		// descriptors clustered to build the tree (0 clusters all descriptors in memory)
+extern const int VOCAB_SAMPLES_PER_IMAGE;	// descriptors offered to the sample from each image (0 offers all)
+
+// geometric re-ranking of the best bag of words matches
+extern const int NUM_VERIFY_CANDIDATES;	// candidates verified against the query
+extern const int MIN_VERIFY_INLIERS;	// inliers for a candidate to count as verified
+extern const int CONFIDENT_INLIERS;		// inliers after which no further candidates are verified
+extern const int VERIFY_TIME_MS;		// time budget of the verification of a query (no new candidates are started after it)
+extern const int MAX_VERIFY_POINTS;		// strongest correspondences of a candidate given to the homography estimation (bounds a started verification)
+extern const bool VERIFY_BY_WORDS;		// pair keypoints by visual word instead of matching descriptors with FLANN
+
+// keypoint budget of new databases, saved with the database and applied to its queries alike
+extern const int MAX_KEYPOINTS;			// strongest keypoints kept of every image (0 keeps all)
+extern const bool ADAPTIVE_THRESHOLD;	// lower the detector threshold for images with fewer keypoints than the budget
+
 extern const std::string TEMP_FOLDER;	// name of temp sub folder
 extern const std::string IMAGE_FOLDER;	// sub folder for storing images
 extern const std::string DESCR_FOLDER;	// sub folder for storing descriptors
 extern const std::string HASH_FOLDER;	// sub folder for storing hash maps
 
 extern const std::string FILE_FORMAT;	// format of data files (.xml or .yaml)
+extern const std::string BINARY_FORMAT;	// extension of binary (memory mapped) data files
 extern const std::string MAIN_FILE;		// DB file postfix for main file
 extern const std::string VOCAB_FILE;	// DB file postfix for vocab file
 extern const std::string HASH_FILE;		// DB file postfix for hash file
+extern const std::string WORD_FILE;		// DB file postfix for the visual word of every keypoint
+extern const std::string RECORD_FORMAT;	// format of saved descriptor records (BINARY_FORMAT or FILE_FORMAT)
+extern const bool QUANTIZE_RECORDS;		// store descriptors of binary records as 8-bit levels
+extern const std::string RECORD_FILE;	// DB file postfix for the packed record store
+extern const bool PACK_RECORDS;			// new databases keep image records in a packed store instead of separate files
+extern const int RECORD_CACHE_MB;		// default memory budget of lazily loaded image records
+extern const int MATCHER_CACHE_MB;		// default memory budget of matcher indices kept for verification
 
 void LogData( const char *szFormat, ... ); // function to log data (verbose in DEBUG mode)
 
@@ -0,0 +1,124 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "ImageDB.h"
+
+// sequential source of descriptor rows, each tagged with the index of its image
+// (rows of an image are consecutive and image indices never decrease)
+class CDescriptorSource
+{
+public:
+	virtual ~CDescriptorSource();
+
+	virtual int Rewind() = 0;							// restart reading from the first descriptor
+	virtual int ReadChunk( cv::Mat &matDescriptors,
+		std::vector<int> &vecDescImgIdx ) = 0;			// read next chunk, returns number of rows (0 at end, -1 on error)
+	virtual int GetNumImages() const = 0;				// number of images in the source
+};
+
+// descriptors of image records held in memory
+class CImageListSource : public CDescriptorSource
+{
+protected:
+	const std::vector<CImageData*>	&m_vecImageData;	// image records
+	int								m_nNextIdx;			// index of next image
+	int								m_nChunkRows;		// preferred rows per chunk
+
+public:
+	CImageListSource( const std::vector<CImageData*> &vecImageData,
+		const int nChunkRows = 65536 );					// constructor
+
+	int Rewind();
+	int ReadChunk( cv::Mat &matDescriptors, std::vector<int> &vecDescImgIdx );
+	int GetNumImages() const;
+};
+
+// descriptor records read from the DB descriptor folder, one image at a time
+class CDescrFolderSource : public CDescriptorSource
+{
+protected:
+	const std::string				&m_strDBPath;		// reference to DB path
+	std::vector<std::string>		m_vecImageNames;	// names of image records
+	CRecordStore*					m_pRecordStore;		// packed store of the records (NULL for separate files)
+	int								m_nNextIdx;			// index of next image
+	int								m_nChunkRows;		// preferred rows per chunk
+
+public:
+	CDescrFolderSource( const std::string &strDBPath,
+		const std::vector<std::string> &vecImageNames,
+		CRecordStore *pRecordStore = NULL,
+		const int nChunkRows = 65536 );					// constructor
+
+	int Rewind();
+	int ReadChunk( cv::Mat &matDescriptors, std::vector<int> &vecDescImgIdx );
+	int GetNumImages() const;
+};
+
+// writer of binary partition files (image index and descriptor per row)
+class CPartitionFileWriter
+{
+protected:
+	FILE*							m_pFile;			// open partition file
+	int								m_nDims;			// descriptor dimensions
+	int64							m_nNumRows;			// rows written so far
+
+public:
+	CPartitionFileWriter();								// constructor
+	~CPartitionFileWriter();							// destructor
+
+	int Open( const std::string &strFileName,
+		const int nDims );								// create partition file
+	int Append( const float *pDescriptor,
+		const int nImgIdx );							// append one row
+	int Close();										// finalize header and close file
+	int64 GetNumRows() const;							// rows written so far
+};
+
+// descriptors spilled to a partition file while splitting a tree node
+class CPartitionFileSource : public CDescriptorSource
+{
+protected:
+	std::string						m_strFileName;		// partition file name
+	FILE*							m_pFile;			// open partition file
+	int								m_nDims;			// descriptor dimensions
+	int64							m_nNumRows;			// rows in the file
+	int64							m_nRowsRead;		// rows read so far
+	int								m_nNumImages;		// number of images of the whole corpus
+	int								m_nChunkRows;		// rows per chunk
+
+public:
+	CPartitionFileSource( const std::string &strFileName,
+		const int nNumImages,
+		const int nChunkRows = 65536 );					// constructor
+	~CPartitionFileSource();							// destructor
+
+	int Rewind();
+	int ReadChunk( cv::Mat &matDescriptors, std::vector<int> &vecDescImgIdx );
+	int GetNumImages() const;
+};
@@ -0,0 +1,36 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+// squared L2 distance kernels (SSE2/AVX2 with scalar fallback, selected at runtime)
+
+const char* GetDistanceKernelName();						// name of the kernel selected for this CPU
+
+void ComputeSquaredL2( const float *pQuery,
+	const float *pCenters, const int nNumCenters,
+	const int nDims, float *pDistances );					// distances of query to each of the contiguous centers
+
+int FindClosestCenter( const float *pQuery,
+	const float *pCenters, const int nNumCenters,
+	const int nDims, float *pBestDistance = 0 );			// index of the closest of the contiguous centers
@@ -0,0 +1,70 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "MappedFile.h"
+#include "ImageHash.h"
+
+// word histograms of all images in one compressed sparse row table, rows are read through CImageHash views
+class CHashTable
+{
+protected:
+	int							m_nNumImages;			// number of rows
+	const int64*				m_pRowOffsets;			// bins of row i are [offset[i], offset[i+1])
+	const unsigned int*			m_pLeafIdx;				// leaf indices of all bins, increasing within a row
+	const float*				m_pWeights;				// TF-IDF scores of all bins
+	const float*				m_pInvNorms;			// inverse magnitude of each row (0 for empty histograms)
+
+	std::vector<int64>			m_vecRowOffsets;		// owned row offsets (built or XML loaded table)
+	std::vector<unsigned int>	m_vecLeafIdx;			// owned leaf indices
+	std::vector<float>			m_vecWeights;			// owned TF-IDF scores
+	std::vector<float>			m_vecInvNorms;			// owned inverse magnitudes
+	CMappedFile					m_cMappedFile;			// mapped binary table file (binary loaded table)
+
+	void BindArrays();									// point the table at the owned arrays
+	void Thaw();										// copy a mapped table to owned arrays before appending
+
+public:
+	CHashTable();										// constructor
+	~CHashTable();										// destructor
+
+	void Clear();										// remove all rows
+	int AddImageHash( const CImageHash &cImageHash );	// append histogram of the next image
+	void Compact();										// release unused capacity after bulk adding
+
+	int GetNumImages() const;							// number of rows
+	int64 GetNumBins() const;							// total number of bins
+	void GetImageHash( const int nImageIdx,
+		CImageHash &cImageHash ) const;					// view of the histogram of an image, valid while the table is unchanged
+	size_t GetMemoryUsage() const;						// bytes used by the owned arrays
+
+	int SaveTable( const std::string &strFileName ) const;			// save hash table to XML/YAML file
+	int LoadTable( const std::string &strFileName );				// load hash table from XML/YAML file
+	int SaveTableBinary( const std::string &strFileName ) const;	// save hash table to binary file
+	int LoadTableBinary( const std::string &strFileName,
+		const bool fVerifyChecksum = true );						// map binary hash table file and use it in place
+};
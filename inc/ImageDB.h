@@ -28,6 +28,7 @@
 #include <vector>
 #include <opencv2/opencv.hpp>
 #include <opencv2/nonfree/nonfree.hpp>
+#include "RecordStore.h"
 
 // keypoint feature descriptor computation class
 extern cv::SURF g_SURFDetector;
@@ -45,6 +46,19 @@ protected:
 	cv::Mat						m_matImageFrame;		// image frame
 	std::vector<cv::KeyPoint>	m_vecKeypoints;			// keypoints
 	cv::Mat						m_matDescriptors;		// keypoint descriptors
+	std::vector<int>			m_vecWordIds;			// visual word of each keypoint (empty if not assigned)
+	CRecordStore*				m_pRecordStore;			// packed store holding the record (NULL for separate files)
+	int							m_nRecordIdx;			// index of the record in the packed store
+
+	int EncodeBinaryRecord( std::vector<unsigned char> &vecRecord,
+		const bool fQuantize ) const;					// serialize keypoints and descriptors to a binary record
+	int DecodeBinaryRecord( const unsigned char *pData,
+		const size_t nSize );							// restore keypoints and descriptors from a binary record
+	int SaveXMLRecord( const std::string &strFileName ) const;	// save keypoints and descriptors to XML/YAML file
+	int LoadXMLRecord( const std::string &strFileName );		// load keypoints and descriptors from XML/YAML file
+	int SaveBinaryRecord( const std::string &strFileName,
+		const bool fQuantize ) const;					// save keypoints and descriptors to binary file (descriptors optionally as 8-bit levels)
+	int LoadBinaryRecord( const std::string &strFileName );	// load keypoints and descriptors from binary file
 
 public:
 	CImageData( const std::string &strDBPath,
@@ -52,15 +66,36 @@ public:
 	~CImageData();										// destructor
 
 	void SetImageFrame( const cv::Mat &matImageFrame ); // set image frame data
+	void ReleaseImageFrame();							// drop image frame data (keypoints and descriptors are kept)
 	bool IsImageValid() const;							// checks if the image read was success
-	int ComputeDescriptors();							// computes keypoints and descriptors
+	int ComputeDescriptors( const int nMaxKeypoints = 0,
+		const bool fAdaptiveThreshold = false );		// computes keypoints and descriptors, keeps the strongest nMaxKeypoints (0 keeps all)
+	int ComputeDescriptors( const cv::SURF &cDetector,
+		const int nMaxKeypoints = 0,
+		const bool fAdaptiveThreshold = false );		// computes keypoints and descriptors with a given detector (one per thread)
 	int SaveImageRecord();								// saves image to jpg file and descriptors to xml file
+	void DeleteSavedRecord();							// remove a saved record from disk (record files or packed store entry)
 	int LoadImageRecord();								// loads image and descriptors
+	int LoadDescriptorRecord();							// loads keypoints and descriptors only
+	int LoadImageFrame();								// loads image frame only
+	void ReleaseRecord();								// drop frame, keypoints and descriptors of a saved record
+	bool IsRecordLoaded() const;						// whether keypoints or descriptors are in memory
+	size_t GetMemoryUsage() const;						// bytes held by frame, keypoints and descriptors
+	int MigrateRecord( const bool fQuantize );			// convert the XML descriptor record to the binary format
+	void SetRecordStore( CRecordStore *pRecordStore,
+		const int nRecordIdx );							// keep the record in a packed store instead of separate files
+	int PackRecord( CRecordStore *pRecordStore,
+		const int nRecordIdx );							// load the record from its separate files and append it to a packed store
 
 	const std::string& GetImageName() const;			// get image name
 	const cv::Mat& GetImageFrame() const;				// get image frame data
 	const std::vector<cv::KeyPoint>& GetKeypoints() const; // get image keypoints
 	const cv::Mat& GetDescriptors() const;				// get keypoint descriptors
+	void SetWordIds( const std::vector<int> &vecWordIds ); // set visual word of each keypoint
+	const std::vector<int>& GetWordIds() const;			// get visual word of each keypoint (empty if not assigned)
 
-	int ValidateGeometry( const CImageData &cQueryImage ) const; // validate spatial consistency
+	int ValidateGeometry( const CImageData &cQueryImage,
+		cv::flann::Index *pMatcherIndex = NULL ) const;	// validate spatial consistency (with a prebuilt index of the descriptors), returns the number of homography inliers
+	int ValidateGeometryByWords( const CImageData &cQueryImage,
+		const int *pImageWords, const int nNumImageWords ) const;	// validate spatial consistency of keypoints sharing visual words (no descriptor matching)
 };
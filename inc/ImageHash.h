@@ -25,28 +25,50 @@
 
 #include <string>
 #include <vector>
-#include <map>
 #include <opencv2/opencv.hpp>
 #include "VocabTree.h"
 
+// sparse histogram of visual words, either with own arrays or as a view of a hash table row
 class CImageHash
 {
 protected:
-	double					m_dMagnitude;						// magnitude of vocab vector
-	std::map<int, double>	m_mapWordHist;						// sparse histogram of visual words ( key = binIndex, data = TF-IDF score )
+	double					m_dInvMagnitude;					// inverse magnitude of vocab vector (0 for an empty histogram)
+	int						m_nNumBins;							// number of non-empty bins
+	const unsigned int		*m_pLeafIdx;						// leaf indices of the bins in increasing order
+	const float				*m_pWeights;						// TF-IDF scores of the bins
+	std::vector<unsigned int>	m_vecLeafIdx;					// own leaf indices of a computed or loaded hash
+	std::vector<float>		m_vecWeights;						// own TF-IDF scores of a computed or loaded hash
+
+	void ComputeFromNodes( std::vector<int> &vecLeafNodes,
+		const CVocabTree &cVocabTree );							// compute word histogram from the leaf node of each descriptor (sorted in place)
 
 public:
 	CImageHash();												// constructor
+	CImageHash( const CImageHash &cImageHash );					// copy constructor
+	CImageHash& operator=( const CImageHash &cImageHash );		// assignment, own arrays are copied and views keep pointing at the hash table
 	~CImageHash();												// destructor
 
 	void Compute( const cv::Mat &matQueryDescriptors,
-		const CVocabTree &cVocabTree );							// compute word histogram from set of image descriptors
+		const CVocabTree &cVocabTree,
+		std::vector<int> *pWordIds = NULL );					// compute word histogram from set of image descriptors (and the word of each descriptor)
+	int ComputeFromWords( const int *pWordIds,
+		const int nNumWords,
+		const CVocabTree &cVocabTree );							// compute word histogram from the stored words of image keypoints
 	//void AddEntry( int nBinIdx, double dWordFrequency );		// add entries to the word histogram
 	//void ComputeMagnitude();									// compute hash magnitude for normalization
+	void SetView( const int nNumBins, const unsigned int *pLeafIdx,
+		const float *pWeights, const double dInvMagnitude );	// point the hash at a row of a hash table, the arrays must outlive the view
 	void Clear();												// clear histogram
 
 	int SaveImageHash( cv::FileStorage &fs ) const;				// save hash map to XML/YAML file
 	int LoadImageHash( cv::FileNode &fn );						// load hash map from XML/YAML file
 
 	double Compare( const CImageHash &cQueryHistogram ) const;	// compare hash with query
+
+	double GetMagnitude() const;								// get magnitude of vocab vector
+	double GetInvMagnitude() const;								// inverse magnitude of vocab vector (0 for an empty histogram)
+	bool IsView() const;										// whether the hash points at a hash table row instead of own arrays
+	int GetNumBins() const;										// number of non-empty bins
+	const unsigned int* GetLeafIndices() const;					// leaf indices of the bins in increasing order
+	const float* GetWeights() const;							// TF-IDF scores of the bins
 };
@@ -0,0 +1,123 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <pthread.h>
+#include "ImageDB.h"
+
+// image passed between the stages of the ingestion pipeline
+struct SIngestItem
+{
+	int							nIndex;					// position of the image file in the input list
+	cv::Mat						matFrame;				// decoded image frame (reader to extractor only)
+};
+
+// blocking queue with a fixed capacity between two stages, producers wait while it is full
+class CIngestQueue
+{
+protected:
+	int							m_nCapacity;			// maximum number of queued items
+	bool						m_fClosed;				// no more items will be pushed
+	std::deque<SIngestItem>		m_dqItems;				// queued items
+	pthread_mutex_t				m_mutex;				// guards the queue
+	pthread_cond_t				m_condNotFull;			// signalled when an item is popped or the queue is closed
+	pthread_cond_t				m_condNotEmpty;			// signalled when an item is pushed or the queue is closed
+
+	int							m_nNumPushed;			// number of pushed items
+	int							m_nMaxSize;				// largest number of queued items
+	double						m_dSizeSum;				// sum of the queue sizes seen by the pushed items
+	int							m_nNumFullWaits;		// pushes that waited on a full queue (backpressure)
+	int							m_nNumEmptyWaits;		// pops that waited on an empty queue (starvation)
+
+public:
+	CIngestQueue();										// constructor
+	~CIngestQueue();									// destructor
+
+	void Reset( const int nCapacity );					// empty the queue, reset its counters and set its capacity
+	void Push( const SIngestItem &sItem );				// queue an item, waits while the queue is full
+	bool Pop( SIngestItem &sItem );						// dequeue an item, waits while empty, false once closed and empty
+	void Close();										// wake up waiting consumers, pops fail once the queue is drained
+	int GetCapacity() const;							// maximum number of queued items
+
+	void LogStats( const char *szName ) const;			// log capacity and occupancy counters
+};
+
+// counters of a pipeline stage
+struct SIngestStageStats
+{
+	int							nNumThreads;			// concurrency of the stage
+	int							nNumItems;				// images handled
+	int							nNumFailed;				// images that failed in the stage
+	double						dBusyTime;				// seconds spent on images summed over the threads
+};
+
+// staged ingestion of image files: a reader stage decodes the files, an extractor stage resizes the
+// frames and computes descriptors, a writer stage saves the records and drops their frames, bounded
+// queues between the stages keep the number of frames in memory bounded
+class CIngestPipeline
+{
+protected:
+	enum { READER_STAGE, EXTRACTOR_STAGE, WRITER_STAGE, NUM_STAGES };
+
+	const std::vector<std::string>* m_pInputFilePaths;	// paths of the image files
+	CImageData* const*			m_pImageData;			// record of each image file
+	int*						m_pErrors;				// error of each image file (0 on success)
+	int							m_nNumFiles;			// number of image files
+	int							m_nMaxKeypoints;		// strongest keypoints kept of every image (0 keeps all)
+	bool						m_fAdaptiveThreshold;	// lower the detector threshold for images with fewer keypoints
+	int							m_nNextFile;			// next image file for the reader stage
+	int							m_nFirstFailed;			// first image file that failed (m_nNumFiles if none), later files are not ingested
+	std::vector<unsigned char>	m_vecSaved;				// whether the record of each image file was saved
+	int							m_anNumActive[NUM_STAGES];	// running threads of each stage
+	SIngestStageStats			m_asStageStats[NUM_STAGES];	// counters of each stage
+	CIngestQueue				m_cDecodedQueue;		// decoded frames waiting for extraction
+	CIngestQueue				m_cExtractedQueue;		// records waiting for the writer
+	double						m_dWallTime;			// seconds taken by the last run
+	pthread_mutex_t				m_mutex;				// guards the file counter and stage counters
+
+	static void* ReaderMain( void *pArg );				// reader thread entry point
+	static void* ExtractorMain( void *pArg );			// extractor thread entry point
+	static void* WriterMain( void *pArg );				// writer thread entry point
+	void FinishThread( const int nStage, const int nNumItems,
+		const int nNumFailed, const double dBusyTime );	// add thread counters, the last thread of a stage closes its output queue
+	void SetFailed( const int nIndex, const int error );	// record the error of an image file, later files are dropped
+	bool IsDropped( const int nIndex );					// whether an earlier image file failed
+
+public:
+	CIngestPipeline( const int nNumReaders,
+		const int nNumExtractors,
+		const int nNumWriters,
+		const int nQueueCapacity,
+		const int nMaxKeypoints = 0,
+		const bool fAdaptiveThreshold = false );		// constructor
+	~CIngestPipeline();									// destructor
+
+	int Run( const std::vector<std::string> &vecInputFilePaths,
+		const std::vector<CImageData*> &vecImageData,
+		std::vector<int> &vecErrors );					// ingest image files onto their records up to the first failure, returns -1 if any file failed
+	void LogStats() const;								// log throughput of the stages and occupancy of the queues
+};
@@ -0,0 +1,77 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <vector>
+#include <pthread.h>
+#include "ImageHash.h"
+#include "PostingList.h"
+
+struct SQueryTerm;
+struct SSearchShard;
+
+// inverted file over the leaf nodes of the vocabulary tree
+class CInvertedIndex
+{
+	friend class CSearchShardTask;
+
+protected:
+	int						m_nNumImages;						// number of indexed images
+	int64					m_nNumPostings;						// total number of postings
+	std::vector<CPostingList>	m_vecPostingLists;				// compressed posting list of each leaf index, a posting holds the image index
+																// and the TF-IDF weight of the word normalized by the image hash magnitude
+
+	mutable std::vector< std::vector<float>* > m_vecFreeAccumulators;	// zeroed dense score accumulators (one entry per image) not used by a query
+	mutable pthread_mutex_t		m_mutex;						// guards the free accumulators
+
+	std::vector<float>* AcquireAccumulator() const;				// zeroed accumulator of a query, taken from the free ones or allocated
+	void ReleaseAccumulator( std::vector<float> *pAccumulator ) const;	// return a zeroed accumulator to the free ones
+	void ScorePostingList( const SQueryTerm &sTerm,
+		SSearchShard &sShard ) const;							// add the contributions of a whole posting list to the accumulator entries of a shard
+	void SearchShard( const std::vector<SQueryTerm> &vecTerms,
+		const int nNumTop, SSearchShard &sShard ) const;		// MaxScore pruned scoring of the images of a shard
+
+public:
+	CInvertedIndex();											// constructor
+	~CInvertedIndex();											// destructor
+
+	void Clear();												// clear index (not while searching)
+	int AddImage( const int nImageIdx,
+		const CImageHash &cImageHash );							// append postings of an image (image indices must increase)
+	void Compact();												// release unused capacity after bulk adding
+
+	int GetNumImages() const;									// number of indexed images
+	int64 GetNumPostings() const;								// total number of postings
+	size_t GetMemoryUsage() const;								// bytes used by the posting lists
+
+	int Search( const CImageHash &cQueryHash, const int nNumTop,
+		std::vector< std::pair<double, int> > &vecTopMatches ) const;	// term-at-a-time scoring, returns best (score, image index) first
+	int SearchPruned( const CImageHash &cQueryHash, const int nNumTop,
+		std::vector< std::pair<double, int> > &vecTopMatches,
+		int64 &nNumSkipped ) const;								// MaxScore pruned scoring, same matches as Search, counts postings not decoded
+
+private:
+	CInvertedIndex( const CInvertedIndex& );					// indices are not copied
+	CInvertedIndex& operator=( const CInvertedIndex& );
+};
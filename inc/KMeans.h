@@ -0,0 +1,63 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// work counters of a k-means run
+struct SKMeansStats
+{
+	int64					nDistanceEvals;			// point to center distances computed
+	int64					nNaiveEvals;			// distances a plain Lloyd iteration would have computed
+	int						nIterations;			// Lloyd iterations over all attempts
+};
+
+// k-means clustering with Hamerly's triangle inequality bounds, or mini-batch updates for large sets
+class CKMeans
+{
+protected:
+	int						m_nMaxIter;				// maximum number of iterations per attempt
+	int						m_nAttempts;			// number of attempts, the most compact result is kept
+	int						m_nFlags;				// center seeding (cv::KMEANS_PP_CENTERS or cv::KMEANS_RANDOM_CENTERS)
+	int						m_nBatchSize;			// points per mini-batch iteration (0 = full batch)
+
+	void SeedCenters( const cv::Mat &matData, const int nNumClusters,
+		cv::RNG &rng, cv::Mat &matCenters, SKMeansStats &sStats ) const;	// pick initial centers
+	double RunAttempt( const cv::Mat &matData, const int nNumClusters,
+		cv::RNG &rng, std::vector<int> &vecLabels, cv::Mat &matCenters,
+		SKMeansStats &sStats ) const;										// single clustering attempt, returns compactness
+	double RunMiniBatch( const cv::Mat &matData, const int nNumClusters,
+		cv::RNG &rng, std::vector<int> &vecLabels, cv::Mat &matCenters,
+		SKMeansStats &sStats ) const;										// single mini-batch attempt, returns compactness
+
+public:
+	CKMeans( const int nMaxIter = 100, const int nAttempts = 5,
+		const int nFlags = cv::KMEANS_PP_CENTERS,
+		const int nBatchSize = 0 );											// constructor
+
+	double Cluster( const cv::Mat &matData, const int nNumClusters,
+		cv::Mat &matLabels, cv::Mat &matCenters, cv::RNG &rng,
+		SKMeansStats *pStats = NULL ) const;								// cluster rows of CV_32F data, returns compactness
+};
@@ -0,0 +1,92 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// read-only memory mapping of a whole file
+class CMappedFile
+{
+protected:
+	void*						m_pData;				// start of the mapping
+	size_t						m_nSize;				// size of the mapping in bytes
+
+public:
+	CMappedFile();										// constructor
+	~CMappedFile();										// destructor
+
+	int Open( const std::string &strFileName );			// map file into memory
+	void Close();										// unmap file
+	bool IsOpen() const;								// whether a file is mapped
+	const unsigned char* GetData() const;				// start of the mapped file
+	size_t GetSize() const;								// size of the mapped file in bytes
+
+private:
+	CMappedFile( const CMappedFile& );					// mappings are not copied
+	CMappedFile& operator=( const CMappedFile& );
+};
+
+// array of a binary table file, arrays follow the header in order, each aligned to its element size
+struct STableArray
+{
+	const void*					pData;					// elements to save, start of the elements in the mapping after loading
+	size_t						nElemSize;				// bytes per element
+	int64						nNumElems;				// number of elements
+	int64*					pPos;					// file offset field of the array in the header
+};
+
+// 64-bit FNV-1a checksum of a byte range, chained through nChecksum
+uint64 ComputeChecksum( const void *pData, size_t nSize,
+	uint64 nChecksum = 14695981039346656037ULL );
+
+// write a block at the current file position and extend the checksum
+int WriteBlock( FILE *pFile, const void *pData, const size_t nSize, int64 &nPos, uint64 &nChecksum );
+
+// pad with zeros up to the given file position
+int WritePadding( FILE *pFile, const int64 nEndPos, int64 &nPos, uint64 &nChecksum );
+
+// open a temporary file next to the destination, mappings of the destination stay valid while it is written
+FILE* CreateReplacementFile( const std::string &strFileName );
+
+// close the temporary file and move it over the destination (the temporary file is removed on error)
+int CommitReplacementFile( FILE *pFile, const std::string &strFileName, int error );
+
+// save a header followed by the arrays of a table, sets the array positions, file size and checksum fields of the header
+int SaveTableFile( const std::string &strFileName, void *pHeader, const size_t nHeaderSize,
+	std::vector<STableArray> &vecArrays, int64 &nFileSize, uint64 &nChecksum );
+
+// map a table file and copy its header, headers start with an 8 byte magic followed by an int version
+int MapTableFile( CMappedFile &cMappedFile, const std::string &strFileName, void *pHeader, const size_t nHeaderSize,
+	const char *pMagic, const int nVersion );
+
+// check the array positions against the file size, verify the checksum and point the arrays into the mapping
+int BindTableArrays( const CMappedFile &cMappedFile, const size_t nHeaderSize, const int64 nFileSize,
+	const uint64 nChecksum, std::vector<STableArray> &vecArrays, const bool fVerifyChecksum );
+
+// check that compressed sparse row offsets start at 0, do not decrease and end at the number of entries
+int CheckRowOffsets( const int64 *pRowOffsets, const int64 nNumRows, const int64 nNumEntries );
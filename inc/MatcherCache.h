@@ -0,0 +1,67 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <pthread.h>
+#include <opencv2/opencv.hpp>
+
+// matcher index over the descriptors of a database image
+struct SMatcherIndex
+{
+	cv::Mat						matDescriptors;			// indexed descriptors (the index refers to them)
+	cv::flann::Index			cIndex;					// kd-tree index of the descriptors
+	size_t						nBytes;					// estimated memory of descriptors and index
+};
+
+// prebuilt matcher indices of database images shared across queries, the least recently used ones are
+// dropped once the cached indices exceed the budget, users keep an index alive through their reference
+class CMatcherCache
+{
+protected:
+	typedef std::list< std::pair< int, cv::Ptr<SMatcherIndex> > > CEntryList;
+
+	CEntryList					m_lstEntries;			// cached indices by image, most recently used first
+	std::map<int, CEntryList::iterator> m_mapEntries;	// position of each cached image
+	int64						m_nBudget;				// bytes of cached indices before eviction
+	int64						m_nResident;			// bytes held by cached indices
+	int64						m_nNumHits;				// lookups served by a cached index
+	int64						m_nNumMisses;			// lookups that built an index
+	int64						m_nNumEvictions;		// indices dropped to stay within the budget
+	mutable pthread_mutex_t		m_mutex;				// guards the entries and counters
+
+	void Evict();										// drop least recently used indices over the budget (requires lock)
+
+public:
+	CMatcherCache( const int64 nBudget = 0 );			// constructor
+	~CMatcherCache();									// destructor
+
+	void SetBudget( const int64 nBudget );			// set bytes of cached indices before eviction (0 disables caching)
+	cv::Ptr<SMatcherIndex> Acquire( const int nImageIdx,
+		const cv::Mat &matDescriptors );				// cached index of an image, built from its descriptors on a miss (empty without descriptors)
+	void Clear();										// drop all cached indices
+
+	void LogStats() const;								// log hit, miss and eviction counters
+};
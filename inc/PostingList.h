@@ -0,0 +1,71 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+// number of postings per compressed block
+extern const int POSTING_BLOCK_SIZE;
+
+// skip header of a compressed posting block
+struct SPostingBlock
+{
+	int						nFirstImageIdx;						// first image index in the block
+	int						nLastImageIdx;						// last image index in the block
+	unsigned int			nDataOffset;						// byte offset of the quantized weights, followed by the gap width and packed gaps
+	float					fMaxWeight;							// largest weight in the block (quantization scale)
+};
+
+// posting list of a visual word, image index gaps are bit packed and weights quantized
+// to 8 bits in blocks of POSTING_BLOCK_SIZE postings, the last partial block is kept raw until compacted
+class CPostingList
+{
+protected:
+	int								m_nNumPostings;				// total number of postings
+	float							m_fMaxWeight;				// largest weight in the list
+	std::vector<SPostingBlock>		m_vecBlocks;				// headers of full blocks
+	std::vector<unsigned char>		m_vecData;					// encoded blocks
+	std::vector<int>				m_vecTailImageIdx;			// image indices of the partial block
+	std::vector<float>				m_vecTailWeights;			// weights of the partial block
+
+	void CompressTail();										// encode the partial block
+	int GetBlockSize( const int nBlock ) const;					// number of postings in a block
+
+public:
+	CPostingList();												// constructor
+
+	void Clear();												// remove all postings
+	int Append( const int nImageIdx, const float fWeight );		// append posting (image indices must increase, weight positive)
+	void Compact();												// encode the partial block and release unused capacity after bulk appending
+
+	int GetNumPostings() const;									// total number of postings
+	int GetNumBlocks() const;									// number of blocks including the raw partial block
+	float GetMaxWeight() const;									// largest weight in the list
+	int GetBlockLastImageIdx( const int nBlock ) const;			// last image index of a block
+	float GetBlockMaxWeight( const int nBlock ) const;			// largest weight of a block
+	int DecodeBlock( const int nBlock, int *pImageIdx,
+		float *pWeight ) const;									// decode a block into POSTING_BLOCK_SIZE sized buffers, returns number of postings
+	size_t GetMemoryUsage() const;								// bytes used by the encoded list
+};
@@ -0,0 +1,71 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <pthread.h>
+#include "ImageDB.h"
+
+// records of lazily loaded images, keypoints and descriptors (and optionally the frame) are loaded on
+// first access and dropped in least recently used order once the resident records exceed the budget
+class CRecordCache
+{
+protected:
+	// resident record
+	struct SCacheEntry
+	{
+		CImageData*				pImageData;				// cached record
+		size_t					nBytes;					// memory held by the record
+		int						nNumPins;				// users currently reading the record (not evicted while > 0)
+		bool					fFrame;					// whether the image frame is loaded too
+		bool					fLoading;				// record is being loaded by a thread
+	};
+	typedef std::list<SCacheEntry> CEntryList;
+
+	CEntryList					m_lstEntries;			// resident records, most recently used first
+	std::map<const CImageData*, CEntryList::iterator> m_mapEntries;	// position of each resident record
+	int64						m_nBudget;				// bytes of resident records before eviction
+	int64						m_nResident;			// bytes held by resident records
+	int64						m_nNumHits;				// accesses to resident records
+	int64						m_nNumMisses;			// accesses that loaded a record
+	int64						m_nNumEvictions;		// records dropped to stay within the budget
+	pthread_mutex_t				m_mutex;				// guards the entries and counters
+	pthread_cond_t				m_condLoaded;			// signalled when a record finished loading
+
+	void Evict();										// drop least recently used unpinned records over the budget (requires lock)
+
+public:
+	CRecordCache( const int64 nBudget = 0 );			// constructor
+	~CRecordCache();									// destructor
+
+	void SetBudget( const int64 nBudget );			// set bytes of resident records before eviction
+	int Acquire( CImageData *pImageData,
+		const bool fLoadFrame );						// load the record on first access and pin it until released
+	void Release( CImageData *pImageData );				// unpin a record acquired before
+	void Clear();										// drop all resident records (none may be pinned)
+
+	int64 GetResidentBytes() const;					// bytes held by resident records
+	void LogStats() const;								// log hit, miss and eviction counters
+};
@@ -0,0 +1,87 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "MappedFile.h"
+
+// location of an image record in the segment files
+struct SRecordIndexEntry
+{
+	int							nSegment;				// segment file of the record (-1 if the record is missing)
+	int							nReserved;				// zero
+	int64						nRecordPos;				// offset of the descriptor record in the segment
+	int64						nRecordSize;			// size of the descriptor record
+	int64						nImagePos;				// offset of the encoded image frame in the segment
+	int64						nImageSize;				// size of the encoded image frame
+};
+
+// packed append-only store of image records: descriptor records and encoded image frames are appended
+// back to back to a few large segment files, an index file maps image indices to their locations,
+// segments are memory mapped for random access
+class CRecordStore
+{
+protected:
+	std::string					m_strFilePrefix;		// path and name prefix of the index and segment files
+	std::vector<SRecordIndexEntry> m_vecEntries;		// location of each record by image index
+	std::vector<CMappedFile*>	m_vecSegments;			// mapped segment files
+	std::vector<CMappedFile*>	m_vecRetiredSegments;	// earlier mappings of grown segments, kept for readers until the store is closed
+	FILE*						m_pAppendFile;			// last segment opened for appending
+	int							m_nAppendSegment;		// number of the last segment
+	int64						m_nAppendPos;			// size of the last segment
+	bool						m_fModified;			// records appended since the index was written
+	mutable pthread_mutex_t		m_mutex;				// guards the entries and the segments
+
+	std::string GetSegmentFileName( const int nSegment ) const;	// name of a segment file
+	int WriteIndex() const;								// write the index file
+	int MapSegments();									// map new and grown segment files (requires lock)
+
+public:
+	CRecordStore();										// constructor
+	~CRecordStore();									// destructor
+
+	int Create( const std::string &strFilePrefix );		// start an empty store, existing files are replaced
+	int Open( const std::string &strFilePrefix );		// load the index and map the segments, the last segment is opened for appending on the first append
+	void Close();										// write the index if modified and release the files
+	bool IsOpen() const;								// whether a store is open
+
+	int Append( const int nRecordIdx,
+		const unsigned char *pRecord, const size_t nRecordSize,
+		const unsigned char *pImage, const size_t nImageSize );	// append the record of an image (thread safe), replaces an earlier one
+	int Flush();										// write the index and map new or grown segments (thread safe)
+	void Remove( const int nRecordIdx );				// forget the record of an image (thread safe), its bytes stay unreferenced in the segments
+
+	int GetNumRecords() const;							// number of image indices in the index
+	bool HasRecord( const int nRecordIdx ) const;		// whether the record of an image is readable (thread safe)
+	int GetRecord( const int nRecordIdx,
+		const unsigned char *&pRecord, size_t &nRecordSize,
+		const unsigned char *&pImage, size_t &nImageSize ) const;	// mapped bytes of the record of an image (thread safe), valid until the store is closed
+
+private:
+	CRecordStore( const CRecordStore& );				// stores are not copied
+	CRecordStore& operator=( const CRecordStore& );
+};
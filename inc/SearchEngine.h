@@ -26,10 +26,29 @@
 #include "ImageDB.h"
 #include "VocabTree.h"
 #include "ImageHash.h"
+#include "HashTable.h"
+#include "WordTable.h"
+#include "InvertedIndex.h"
+#include "TopKCollector.h"
+#include "RecordCache.h"
+#include "MatcherCache.h"
 
-// alternative search algorithms (currently only HIST_SEARCH is implemented)
+// search algorithms: HIST_SEARCH compares the word histogram of every image with the query,
+// SCORE_SEARCH scores only images sharing words with the query through an inverted index of the histograms
 #define HIST_SEARCH 1
-//#define SCORE_SEARCH 1
+#define SCORE_SEARCH 1
+
+// GEOMETRIC_RERANK verifies the best matches with a homography between the query and candidate keypoints
+// and moves verified candidates ahead by their number of inliers
+#define GEOMETRIC_RERANK 1
+
+#if SCORE_SEARCH && !HIST_SEARCH
+#error SCORE_SEARCH requires HIST_SEARCH
+#endif
+
+#if GEOMETRIC_RERANK && !HIST_SEARCH
+#error GEOMETRIC_RERANK requires HIST_SEARCH
+#endif
 
 // core class for image search engine
 class CSearchEngine
@@ -37,17 +56,30 @@ class CSearchEngine
 protected:
 	std::string					m_strDBPath;			// path of image database folder
 	std::string					m_strDBName;			// name of image database file
-	std::list<CImageData*>		m_vecImageData;			// dynamic array of image data
+	std::vector<CImageData*>	m_vecImageData;			// dynamic array of image data
+	int							m_nMaxKeypoints;		// strongest keypoints kept of database and query images (saved with the database)
+	bool						m_fAdaptiveThreshold;	// lower the detector threshold for images with fewer keypoints than the budget
+	CRecordStore				m_cRecordStore;			// packed image records (when the database has a store)
+	mutable CRecordCache		m_cRecordCache;			// lazily loaded image records within a memory budget
+	mutable CMatcherCache		m_cMatcherCache;		// matcher indices of verified candidates within a memory budget
 	CVocabTree					m_cVocabTree;			// vocabulary tree (bag of features)
 #if HIST_SEARCH
-	std::list<CImageHash*>		m_vecHashMap;			// dynamic array of word histograms as image hash
+	CHashTable					m_cHashTable;			// word histograms of all images as image hash
+	CWordTable					m_cWordTable;			// visual word of every keypoint of all images (built with the hash table)
+#endif
+#if SCORE_SEARCH
+	CInvertedIndex				m_cInvertedIndex;		// posting lists of visual words over the image hashes
 #endif
 
 	void ClearImageDB();								// clear image database (from memory)
 	void ClearVocabTree();								// clear vocabulary tree
+	int GetRecordNames( std::vector<std::string> &vecImageNames );	// names of the saved image records (appended records are flushed)
 #if HIST_SEARCH
 	void ClearHashTable();								// clear hash table
 #endif
+#if SCORE_SEARCH
+	int BuildInvertedIndex();							// build posting lists from the hash table
+#endif
 
 public:
 	CSearchEngine();									// constructor
@@ -64,15 +96,28 @@ public:
 		const std::vector<std::string> &vecImageNames );// used for adding images in bulk during training phase
 														
 	int SaveImageDB();									// save image data records
-	int LoadImageDB( bool fLoadFullImageRecord = true );// load image data records
+	int LoadImageDB( bool fLoadFullImageRecord = true );// load image data records (records are loaded on demand otherwise)
+	void SetRecordCacheBudget( const int nBudgetMB );	// memory of lazily loaded records before least recently used ones are dropped
+	void SetMatcherCacheBudget( const int nBudgetMB );	// memory of cached matcher indices before least recently used ones are dropped
+	int SetKeypointBudget( const int nMaxKeypoints,
+		const bool fAdaptiveThreshold );				// strongest keypoints kept of database and query images (0 keeps all), only before images are added
+	const CImageData* AcquireImageRecord( const int nImageIdx,
+		const bool fLoadFrame = false ) const;			// load an image record on demand and keep it until released (NULL on failure)
+	void ReleaseImageRecord( const int nImageIdx ) const;	// release an image record acquired before
 
 	int BuildVocabTree( const int nNumClusters = 10,
-		const int nTreeLevels = 6 );					// build the vocabulary tree
+		const int nTreeLevels = 6,
+		const int nMaxSamples = 0,
+		const int nMaxPerImage = 0 );					// build the vocabulary tree (from a bounded sample of the saved records if nMaxSamples > 0)
+	int BuildVocabTreeStreamed( const int nMemoryBudgetMB,
+		const int nNumClusters = 10,
+		const int nTreeLevels = 6 );					// build the vocabulary tree from descriptor records on disk within a memory budget
 	int SaveVocabTree() const;							// save vocabulary tree
 	int LoadVocabTree();								// load vocabulary tree
 
 #if HIST_SEARCH
-	int BuildHashTable();								// build word histogram for each image in DB
+	int BuildHashTable();								// build word histogram for each image in DB (from stored words when they cover all images)
+	int ReweightVocabTree();							// recompute IDF weights from the stored words and rebuild the hash table
 	int SaveHashTable() const;							// save hash table
 	int LoadHashTable();								// load hash table
 #endif
@@ -0,0 +1,86 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <pthread.h>
+
+// unit of work executed by the task pool
+class CTask
+{
+public:
+	virtual ~CTask();
+	virtual void Run() = 0;								// execute the task
+};
+
+// set of tasks that are waited on together
+class CTaskGroup
+{
+	friend class CTaskPool;
+
+protected:
+	int							m_nPending;				// number of submitted tasks not yet completed
+
+public:
+	CTaskGroup();										// constructor
+};
+
+// work-stealing pool of worker threads
+class CTaskPool
+{
+protected:
+	struct SQueuedTask
+	{
+		CTask*					pTask;					// task to run
+		CTaskGroup*				pGroup;					// group notified on completion
+	};
+
+	int							m_nNumThreads;			// requested number of worker threads (0 = number of CPUs)
+	bool						m_fStop;				// signals workers to exit
+	std::vector<pthread_t>		m_vecThreads;			// worker threads
+	std::vector< std::deque<SQueuedTask> > m_vecQueues;	// per worker task deques, last one is for external threads
+	pthread_mutex_t				m_mutex;				// guards queues and group counters
+	pthread_cond_t				m_condition;			// signalled when work is queued or a task completes
+
+	static void* WorkerMain( void *pArg );				// worker thread entry point
+	void Start();										// spawn worker threads (requires lock)
+	void Stop();										// join worker threads
+	bool PopTask( int nQueue, SQueuedTask &sTask );		// pop own task or steal one (requires lock)
+	void RunTask( const SQueuedTask &sTask );			// run task and update its group (takes lock)
+
+public:
+	CTaskPool( const int nNumThreads = 0 );				// constructor
+	~CTaskPool();										// destructor
+
+	void SetNumThreads( const int nNumThreads );		// restart pool with given number of threads (0 = number of CPUs)
+	int GetNumThreads() const;							// number of worker threads
+
+	void Submit( CTask *pTask, CTaskGroup &cGroup );	// queue a task (caller keeps ownership)
+	void Wait( CTaskGroup &cGroup );					// run queued tasks until all tasks of the group completed
+	void Run( const std::vector<CTask*> &vecTasks );	// submit tasks and wait for all of them
+};
+
+// shared task pool
+extern CTaskPool g_TaskPool;
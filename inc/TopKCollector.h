@@ -0,0 +1,48 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <vector>
+#include <utility>
+
+// bounded selection of the best (score, image index) pairs, higher score first and smaller image index first
+// on equal scores, so the kept pairs and their order do not depend on the insertion order (ties at the k-th
+// place keep the smaller image indices)
+class CTopKCollector
+{
+protected:
+	int							m_nNumTop;				// number of pairs to keep
+	std::vector< std::pair<double, int> > m_vecHeap;	// kept pairs as a heap with the worst pair on top
+
+public:
+	CTopKCollector( const int nNumTop = 0 );			// constructor
+	~CTopKCollector();									// destructor
+
+	void Reset( const int nNumTop );					// drop kept pairs and set the number of pairs to keep
+	void Add( const double dScore, const int nImageIdx );	// offer a pair, kept if it is among the best so far
+	bool IsFull() const;								// whether the number of pairs to keep is reached
+	double GetMinScore() const;							// score of the worst kept pair (valid when full)
+	int GetNumKept() const;								// number of kept pairs
+	void GetSortedMatches( std::vector< std::pair<double, int> > &vecTopMatches );	// best pairs first, the collector is reset
+};
@@ -27,10 +27,16 @@
 #include <list>
 #include <opencv2/opencv.hpp>
 #include "ImageDB.h"
+#include "KMeans.h"
+#include "DescriptorSource.h"
+#include "MappedFile.h"
+#include "WordTable.h"
 
 // tree node class
 class CVocabTreeNode
 {
+	friend class CVocabTree;
+
 protected:
 	CVocabTreeNode*					m_pParentNode;		// pointer to root node
 	std::vector<CVocabTreeNode*>	m_vecChileNodes;	// pointers to children
@@ -39,8 +45,10 @@ protected:
 	cv::Mat							m_matNodeDescriptor;// node data: single feature descriptor
 	int								m_nLeafIndex;		// unique index for each leaf node
 	double							m_dNodeWeight;		// node weight
-	std::vector<int>				m_vecInvIdxList;	// inverted list of image index (only at leaf nodes)
-	std::vector<int>				m_vecTermFrequency;	// frequency of each image index
+	std::vector<int>				m_vecInvIdxList;	// inverted list of image index (unused, posting lists are kept by CInvertedIndex)
+	std::vector<int>				m_vecTermFrequency;	// frequency of each image index (unused)
+
+	int AssignLeafIndices( int nLeafCounter );			// number leaves depth first, returns next free leaf index
 
 public:
 	CVocabTreeNode();									// constructor
@@ -51,7 +59,14 @@ public:
 	int BuildSubTree( const cv::Mat &matDescriptors, 
 		const std::vector<int> &vecDescImgIdx,
 		const int nNumImages, const int nNumClusters,
-		const int nTreeLevels, const int nMAXITER );	// recursively build the subtree from this node
+		const int nTreeLevels, const CKMeans &cKMeans,
+		const uint64 nSeed );							// recursively build the subtree from this node (siblings in parallel)
+	int BuildSubTreeStreamed( CDescriptorSource &cSource,
+		const std::string &strPartitionPrefix,
+		const int64 nMemoryBudget, const int nNumImages,
+		const int nNumClusters, const int nTreeLevels,
+		const CKMeans &cSampleKMeans, const CKMeans &cKMeans,
+		const uint64 nSeed );							// build the subtree from a descriptor stream, spilling child partitions to disk
 	int SaveSubTree( cv::FileStorage &fs ) const;		// recursively save sub tree to XML/YAML file
 	int LoadSubTree( cv::FileNode &fn );				// recursively retrieve sub tree from XML/YAML file
 
@@ -73,18 +88,65 @@ protected:
 	int								m_nTreeLevels;		// number of levels
 	CVocabTreeNode*					m_pRootNode;		// pointer to root node
 
+	// frozen (read-only) breadth first layout of the tree used for searching,
+	// the arrays point either into the owned vectors below or into a mapped binary file
+	int								m_nNumNodes;		// number of nodes in the frozen tree
+	cv::Mat							m_matNodeCenters;	// cluster centers of all nodes (one row per node)
+	const int*						m_pChildOffset;		// children of node i are nodes [offset[i], offset[i+1])
+	const int*						m_pLeafIndex;		// leaf index of each node (-1 for non-leaf nodes)
+	const double*					m_pNodeWeight;		// IDF weight of each node
+
+	std::vector<int>				m_vecChildOffset;	// owned child offsets (built or XML loaded tree)
+	std::vector<int>				m_vecLeafIndex;		// owned leaf indices
+	std::vector<double>				m_vecNodeWeight;	// owned node weights
+	CMappedFile						m_cMappedFile;		// mapped binary tree file (binary loaded tree)
+	std::vector<int>				m_vecLeafNode;		// frozen node of each leaf index
+
+	void CollectNodes( std::vector<CVocabTreeNode*> &vecNodes ) const;	// list nodes in breadth first (frozen) order
+	void Freeze();													// compile pointer tree into the frozen layout
+	void IndexLeaves();												// map leaf indices to frozen nodes
+	void ComputeParents( std::vector<int> &vecParent ) const;		// parent of every frozen node (-1 for the root)
+	int SetNodeWeights( const std::vector<int> &vecFrequency,
+		const int nNumImages );										// IDF weights from the number of images reaching each node
+	int SaveFrozenSubTree( cv::FileStorage &fs, const int nNode,
+		const int nLevel ) const;									// recursively save frozen sub tree to XML/YAML file
+	int ComputeNodeWeights( CDescriptorSource &cSource );			// recompute IDF weights by quantizing all descriptors of a stream
+
 public:
 	CVocabTree();													// constructor
 	~CVocabTree();													// destructor
 
 	bool IsEmpty() const;											// check whether tree is emptry or not
-	int BuildTree( const std::list<CImageData*> &vecImageData,
+	int BuildTree( const std::vector<CImageData*> &vecImageData,
+		const int nNumClusters = 10, const int nTreeLevels = 6,
+		const int nMAXITER = 100, const int nAttempts = 5,
+		const int nSeeding = cv::KMEANS_PP_CENTERS );				// build vocabulary tree from array of image data
+	int BuildTreeSampled( CDescriptorSource &cSource,
+		const int nMaxSamples, const int nMaxPerImage,
+		const int nNumClusters = 10, const int nTreeLevels = 6,
+		const int nBatchSize = 1000, const int nMAXITER = 100,
+		const int nAttempts = 3 );									// build vocabulary tree from a bounded sample of a descriptor stream
+	int BuildTree( CDescriptorSource &cSource,
+		const std::string &strTempPath, const int64 nMemoryBudget,
 		const int nNumClusters = 10, const int nTreeLevels = 6,
-		const int nMAXITER = 100 );									// build vocabulary tree from linked list of image data
+		const int nBatchSize = 1000, const int nMAXITER = 100,
+		const int nAttempts = 3 );									// build vocabulary tree from a descriptor stream within a memory budget (bytes)
 	int SaveTree( const std::string &strFileName ) const;			// save vocab tree to file
 	int LoadTree( const std::string &strFileName );					// load vocab tree from file
+	int SaveTreeBinary( const std::string &strFileName ) const;		// save vocab tree to binary file
+	int LoadTreeBinary( const std::string &strFileName,
+		const bool fVerifyChecksum = true );						// map binary vocab tree file and search it in place
 	void Clear();													// clear vocabulary tree
 
 	int BuildLeafList( std::list<const CVocabTreeNode*> &lstLeafList ) const;	// build a list of leaf node pointers
-	const CVocabTreeNode* SearchTree( const cv::Mat &matQueryDescr ) const;		// returns the closest leaf node to the query descriptor
+	int SearchTree( const cv::Mat &matQueryDescr ) const;			// returns frozen node index of the closest leaf to the query descriptor
+	int QuantizeBatch( const cv::Mat &matDescriptors,
+		std::vector<int> &vecLeafIds ) const;						// frozen leaf node index for every descriptor row (level by level)
+	int QuantizeWords( const cv::Mat &matDescriptors,
+		std::vector<int> &vecWordIds ) const;						// visual word (leaf index) for every descriptor row
+	int GetNumLeaves() const;										// number of visual words
+	int GetLeafNode( const int nLeafIdx ) const;					// frozen node of a leaf index (-1 if out of range)
+	int ComputeNodeWeights( const CWordTable &cWordTable );			// recompute IDF weights from the stored words of all images
+	int GetLeafIndex( const int nNode ) const;						// get leaf index of frozen node (-1 for non-leaf nodes)
+	double GetNodeWeight( const int nNode ) const;					// get IDF weight of frozen node
 };
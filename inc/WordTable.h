@@ -0,0 +1,65 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "MappedFile.h"
+
+// visual word (leaf index) of every keypoint of every image in one compressed sparse row table, kept with the
+// hash table so that histograms, IDF weights and word based verification do not re-quantize descriptors
+class CWordTable
+{
+protected:
+	int							m_nNumImages;			// number of rows
+	int							m_nVocabSize;			// number of leaves of the vocabulary the words refer to
+	const int64*				m_pRowOffsets;			// words of row i are [offset[i], offset[i+1])
+	const int*					m_pWordIds;				// words of all keypoints in keypoint order
+
+	std::vector<int64>			m_vecRowOffsets;		// owned row offsets (built table)
+	std::vector<int>			m_vecWordIds;			// owned words
+	CMappedFile					m_cMappedFile;			// mapped binary table file (loaded table)
+
+	void BindArrays();									// point the table at the owned arrays
+	void Thaw();										// copy a mapped table to owned arrays before appending
+
+public:
+	CWordTable();										// constructor
+	~CWordTable();										// destructor
+
+	void Clear( const int nVocabSize = 0 );				// remove all rows, words of new rows refer to a vocabulary of the given size
+	int AddImageWords( const std::vector<int> &vecWordIds );	// append words of the next image
+	void Compact();										// release unused capacity after bulk adding
+
+	int GetNumImages() const;							// number of rows
+	int GetVocabSize() const;							// number of leaves of the vocabulary the words refer to
+	int GetImageWords( const int nImageIdx,
+		const int *&pWordIds ) const;					// words of an image (valid while the table is unchanged), returns their number
+	size_t GetMemoryUsage() const;						// bytes used by the owned arrays
+
+	int SaveTableBinary( const std::string &strFileName ) const;	// save word table to binary file
+	int LoadTableBinary( const std::string &strFileName,
+		const bool fVerifyChecksum = true );						// map binary word table file and use it in place
+};
@@ -30,7 +30,9 @@
 #include <iostream>
 #include <opencv2/opencv.hpp>
 
+#include "Common.h"
 #include "SearchEngine.h"
+#include "TaskPool.h"
 
 using namespace std;
 using namespace cv;
@@ -72,12 +74,36 @@ int main( int argc, char* argv[] )
     }
 	
     string strDBPath, strDBName, strSockName;
+    int nNumThreads = 0;
+    int nRecordCacheMB = RECORD_CACHE_MB;
+    int nMatcherCacheMB = MATCHER_CACHE_MB;
     fs["dbpath"] >> strDBPath;
     fs["dbname"] >> strDBName;
     fs["socket"] >> strSockName;
+    fs["numthreads"] >> nNumThreads;
+    if( !fs["recordcachemb"].empty() )
+    {
+        fs["recordcachemb"] >> nRecordCacheMB;
+    }
+    if( !fs["matchercachemb"].empty() )
+    {
+        fs["matchercachemb"] >> nMatcherCacheMB;
+    }
     fs.release();
+
+    // worker threads scoring the database for each query (0 = number of CPUs)
+    g_TaskPool.SetNumThreads( nNumThreads );
+    cout << "Worker Threads: " << g_TaskPool.GetNumThreads() << endl;
     
     CSearchEngine cCoverSearch;
+
+    // image records are loaded on demand, the least recently used ones are dropped beyond this budget
+    cCoverSearch.SetRecordCacheBudget( nRecordCacheMB );
+    cout << "Record Cache: " << nRecordCacheMB << " MB" << endl;
+
+    // matcher indices of verified candidates are kept across queries within this budget
+    cCoverSearch.SetMatcherCacheBudget( nMatcherCacheMB );
+    cout << "Matcher Cache: " << nMatcherCacheMB << " MB" << endl;
     
     // try loading the database
     cout << "Database Path: " << strDBPath << endl;
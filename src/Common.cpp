@@ -38,15 +38,35 @@ const int MAX_HEIGHT = 480;
 
 const int NUM_TOP_MATCHES = 5;
 
+const int VOCAB_SAMPLE_SIZE = 1000000;
+const int VOCAB_SAMPLES_PER_IMAGE = 500;
+const int NUM_VERIFY_CANDIDATES = 20;
+const int MIN_VERIFY_INLIERS = 12;
+const int CONFIDENT_INLIERS = 50;
+const int VERIFY_TIME_MS = 250;
+const int MAX_VERIFY_POINTS = 500;
+const bool VERIFY_BY_WORDS = true;
+
+const int MAX_KEYPOINTS = 1000;
+const bool ADAPTIVE_THRESHOLD = false;
+
 const std::string TEMP_FOLDER = "temp";
 const std::string IMAGE_FOLDER = "image";
 const std::string DESCR_FOLDER = "descr";
 const std::string HASH_FOLDER = "hash";
 
 const std::string FILE_FORMAT = ".xml";
+const std::string BINARY_FORMAT = ".bin";
 const std::string MAIN_FILE = "_main";
 const std::string VOCAB_FILE = "_vocab";
 const std::string HASH_FILE = "_hash";
+const std::string WORD_FILE = "_words";
+const std::string RECORD_FORMAT = BINARY_FORMAT;
+const bool QUANTIZE_RECORDS = false;
+const std::string RECORD_FILE = "_records";
+const bool PACK_RECORDS = true;
+const int RECORD_CACHE_MB = 256;
+const int MATCHER_CACHE_MB = 128;
 
 void LogData( const char *szFormat, ... )
 {
@@ -0,0 +1,305 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <stdint.h>
+#include "Common.h"
+#include "DescriptorSource.h"
+
+using namespace std;
+using namespace cv;
+
+// append descriptors of one image, converted to CV_32F, to a chunk
+static void AppendImageDescriptors( const Mat &matImageDescr, const int nImgIdx,
+	Mat &matDescriptors, vector<int> &vecDescImgIdx )
+{
+	Mat matFloatDescr = matImageDescr;
+	if( CV_32F != matImageDescr.type() )
+	{
+		matImageDescr.convertTo( matFloatDescr, CV_32F );
+	}
+	matDescriptors.push_back( matFloatDescr );
+	vecDescImgIdx.insert( vecDescImgIdx.end(), matFloatDescr.rows, nImgIdx );
+}
+
+// destructor
+CDescriptorSource::~CDescriptorSource()
+{
+}
+
+// constructor
+CImageListSource::CImageListSource( const std::vector<CImageData*> &vecImageData,
+	const int nChunkRows ) : m_vecImageData(vecImageData)
+{
+	m_nChunkRows = nChunkRows;
+	Rewind();
+}
+
+// restart reading from the first descriptor
+int CImageListSource::Rewind()
+{
+	m_nNextIdx = 0;
+
+	return 0;
+}
+
+// read descriptors of the next images until the chunk is full
+int CImageListSource::ReadChunk( cv::Mat &matDescriptors, std::vector<int> &vecDescImgIdx )
+{
+	matDescriptors = Mat();
+	vecDescImgIdx.clear();
+	for( ; m_nNextIdx < (int)m_vecImageData.size() && matDescriptors.rows < m_nChunkRows; m_nNextIdx++ )
+	{
+		const Mat &matImageDescr = m_vecImageData[m_nNextIdx]->GetDescriptors();
+		if( matImageDescr.rows > 0 )
+		{
+			AppendImageDescriptors( matImageDescr, m_nNextIdx, matDescriptors, vecDescImgIdx );
+		}
+	}
+
+	return matDescriptors.rows;
+}
+
+// number of images in the source
+int CImageListSource::GetNumImages() const
+{
+	return m_vecImageData.size();
+}
+
+// constructor
+CDescrFolderSource::CDescrFolderSource( const std::string &strDBPath,
+	const std::vector<std::string> &vecImageNames,
+	CRecordStore *pRecordStore,
+	const int nChunkRows ) : m_strDBPath(strDBPath), m_vecImageNames(vecImageNames)
+{
+	m_pRecordStore = pRecordStore;
+	m_nChunkRows = nChunkRows;
+	Rewind();
+}
+
+// restart reading from the first descriptor
+int CDescrFolderSource::Rewind()
+{
+	m_nNextIdx = 0;
+
+	return 0;
+}
+
+// load descriptor records of the next images until the chunk is full
+int CDescrFolderSource::ReadChunk( cv::Mat &matDescriptors, std::vector<int> &vecDescImgIdx )
+{
+	matDescriptors = Mat();
+	vecDescImgIdx.clear();
+	for( ; m_nNextIdx < (int)m_vecImageNames.size() && matDescriptors.rows < m_nChunkRows; m_nNextIdx++ )
+	{
+		// only keypoints and descriptors are read, the image frame is not needed
+		CImageData cImageData( m_strDBPath, m_vecImageNames[m_nNextIdx] );
+		if( NULL != m_pRecordStore )
+		{
+			cImageData.SetRecordStore( m_pRecordStore, m_nNextIdx );
+		}
+		if( 0 != cImageData.LoadDescriptorRecord() )
+		{
+			LogData( "Failed to load descriptor record: %s\n", m_vecImageNames[m_nNextIdx].c_str() );
+			return -1;
+		}
+
+		const Mat &matImageDescr = cImageData.GetDescriptors();
+		if( matImageDescr.rows > 0 )
+		{
+			AppendImageDescriptors( matImageDescr, m_nNextIdx, matDescriptors, vecDescImgIdx );
+		}
+	}
+
+	return matDescriptors.rows;
+}
+
+// number of images in the source
+int CDescrFolderSource::GetNumImages() const
+{
+	return m_vecImageNames.size();
+}
+
+// constructor
+CPartitionFileWriter::CPartitionFileWriter()
+{
+	m_pFile = NULL;
+	m_nDims = 0;
+	m_nNumRows = 0;
+}
+
+// destructor
+CPartitionFileWriter::~CPartitionFileWriter()
+{
+	Close();
+}
+
+// create partition file
+int CPartitionFileWriter::Open( const std::string &strFileName, const int nDims )
+{
+	Close();
+
+	m_pFile = fopen( strFileName.c_str(), "wb" );
+	if( NULL == m_pFile )
+	{
+		return -1;
+	}
+	m_nDims = nDims;
+	m_nNumRows = 0;
+
+	// header: dimensions and number of rows (patched on close)
+	int32_t nHeaderDims = m_nDims;
+	int64 nHeaderRows = 0;
+	if( 1 != fwrite( &nHeaderDims, sizeof(nHeaderDims), 1, m_pFile )
+		|| 1 != fwrite( &nHeaderRows, sizeof(nHeaderRows), 1, m_pFile ) )
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+// append one row
+int CPartitionFileWriter::Append( const float *pDescriptor, const int nImgIdx )
+{
+	int32_t nRowImgIdx = nImgIdx;
+	if( NULL == m_pFile
+		|| 1 != fwrite( &nRowImgIdx, sizeof(nRowImgIdx), 1, m_pFile )
+		|| (size_t)m_nDims != fwrite( pDescriptor, sizeof(float), m_nDims, m_pFile ) )
+	{
+		return -1;
+	}
+	m_nNumRows++;
+
+	return 0;
+}
+
+// finalize header and close file
+int CPartitionFileWriter::Close()
+{
+	if( NULL == m_pFile )
+	{
+		return 0;
+	}
+
+	int error = 0;
+	int64 nHeaderRows = m_nNumRows;
+	if( 0 != fseek( m_pFile, sizeof(int32_t), SEEK_SET )
+		|| 1 != fwrite( &nHeaderRows, sizeof(nHeaderRows), 1, m_pFile ) )
+	{
+		error = -1;
+	}
+	if( 0 != fclose( m_pFile ) )
+	{
+		error = -1;
+	}
+	m_pFile = NULL;
+
+	return error;
+}
+
+// rows written so far
+int64 CPartitionFileWriter::GetNumRows() const
+{
+	return m_nNumRows;
+}
+
+// constructor
+CPartitionFileSource::CPartitionFileSource( const std::string &strFileName,
+	const int nNumImages, const int nChunkRows ) : m_strFileName(strFileName)
+{
+	m_nNumImages = nNumImages;
+	m_nChunkRows = nChunkRows;
+	m_nDims = 0;
+	m_nNumRows = 0;
+	m_nRowsRead = 0;
+
+	// read header, a missing or truncated file reads as an error on the first chunk
+	m_pFile = fopen( m_strFileName.c_str(), "rb" );
+	if( NULL != m_pFile )
+	{
+		int32_t nHeaderDims = 0;
+		int64 nHeaderRows = 0;
+		if( 1 != fread( &nHeaderDims, sizeof(nHeaderDims), 1, m_pFile )
+			|| 1 != fread( &nHeaderRows, sizeof(nHeaderRows), 1, m_pFile ) )
+		{
+			fclose( m_pFile );
+			m_pFile = NULL;
+		}
+		m_nDims = nHeaderDims;
+		m_nNumRows = nHeaderRows;
+	}
+}
+
+// destructor
+CPartitionFileSource::~CPartitionFileSource()
+{
+	if( NULL != m_pFile )
+	{
+		fclose( m_pFile );
+		m_pFile = NULL;
+	}
+}
+
+// restart reading from the first descriptor
+int CPartitionFileSource::Rewind()
+{
+	m_nRowsRead = 0;
+	if( NULL == m_pFile || 0 != fseek( m_pFile, sizeof(int32_t) + sizeof(int64), SEEK_SET ) )
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+// read next block of rows from the partition file
+int CPartitionFileSource::ReadChunk( cv::Mat &matDescriptors, std::vector<int> &vecDescImgIdx )
+{
+	if( NULL == m_pFile )
+	{
+		return -1;
+	}
+
+	int nRows = (int)MIN( (int64)m_nChunkRows, m_nNumRows - m_nRowsRead );
+	matDescriptors.create( nRows, m_nDims, CV_32F );
+	vecDescImgIdx.resize( nRows );
+	for( int i = 0; i < nRows; i++ )
+	{
+		int32_t nRowImgIdx;
+		if( 1 != fread( &nRowImgIdx, sizeof(nRowImgIdx), 1, m_pFile )
+			|| (size_t)m_nDims != fread( matDescriptors.ptr<float>( i ), sizeof(float), m_nDims, m_pFile ) )
+		{
+			return -1;
+		}
+		vecDescImgIdx[i] = nRowImgIdx;
+	}
+	m_nRowsRead += nRows;
+
+	return nRows;
+}
+
+// number of images of the whole corpus
+int CPartitionFileSource::GetNumImages() const
+{
+	return m_nNumImages;
+}
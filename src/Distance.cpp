@@ -0,0 +1,183 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <float.h>
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define SIMD_KERNELS 1
+#include <immintrin.h>
+#endif
+#include "Distance.h"
+
+// number of centers scored per block by FindClosestCenter (keeps distances on the stack)
+static const int CENTER_BLOCK = 16;
+
+// signature of the distance kernels
+typedef void (*SquaredL2Kernel)( const float *pQuery, const float *pCenters,
+	const int nNumCenters, const int nDims, float *pDistances );
+
+// portable scalar kernel
+static void SquaredL2Scalar( const float *pQuery, const float *pCenters,
+	const int nNumCenters, const int nDims, float *pDistances )
+{
+	for( int k = 0; k < nNumCenters; k++ )
+	{
+		const float *pCenter = pCenters + k * nDims;
+		float fDist = 0.0f;
+		for( int d = 0; d < nDims; d++ )
+		{
+			float fDiff = pQuery[d] - pCenter[d];
+			fDist += fDiff * fDiff;
+		}
+		pDistances[k] = fDist;
+	}
+}
+
+#if SIMD_KERNELS
+// SSE2 kernel (4 floats per lane, two accumulators)
+__attribute__((target("sse2")))
+static void SquaredL2SSE( const float *pQuery, const float *pCenters,
+	const int nNumCenters, const int nDims, float *pDistances )
+{
+	for( int k = 0; k < nNumCenters; k++ )
+	{
+		const float *pCenter = pCenters + k * nDims;
+		__m128 vAcc0 = _mm_setzero_ps(), vAcc1 = _mm_setzero_ps();
+		int d = 0;
+		for( ; d + 8 <= nDims; d += 8 )
+		{
+			__m128 vDiff0 = _mm_sub_ps( _mm_loadu_ps( pQuery + d ), _mm_loadu_ps( pCenter + d ) );
+			__m128 vDiff1 = _mm_sub_ps( _mm_loadu_ps( pQuery + d + 4 ), _mm_loadu_ps( pCenter + d + 4 ) );
+			vAcc0 = _mm_add_ps( vAcc0, _mm_mul_ps( vDiff0, vDiff0 ) );
+			vAcc1 = _mm_add_ps( vAcc1, _mm_mul_ps( vDiff1, vDiff1 ) );
+		}
+		float afSum[4];
+		_mm_storeu_ps( afSum, _mm_add_ps( vAcc0, vAcc1 ) );
+		float fDist = ( afSum[0] + afSum[1] ) + ( afSum[2] + afSum[3] );
+		for( ; d < nDims; d++ )
+		{
+			float fDiff = pQuery[d] - pCenter[d];
+			fDist += fDiff * fDiff;
+		}
+		pDistances[k] = fDist;
+	}
+}
+
+// AVX2 + FMA kernel (8 floats per lane, two accumulators)
+__attribute__((target("avx2,fma")))
+static void SquaredL2AVX2( const float *pQuery, const float *pCenters,
+	const int nNumCenters, const int nDims, float *pDistances )
+{
+	for( int k = 0; k < nNumCenters; k++ )
+	{
+		const float *pCenter = pCenters + k * nDims;
+		__m256 vAcc0 = _mm256_setzero_ps(), vAcc1 = _mm256_setzero_ps();
+		int d = 0;
+		for( ; d + 16 <= nDims; d += 16 )
+		{
+			__m256 vDiff0 = _mm256_sub_ps( _mm256_loadu_ps( pQuery + d ), _mm256_loadu_ps( pCenter + d ) );
+			__m256 vDiff1 = _mm256_sub_ps( _mm256_loadu_ps( pQuery + d + 8 ), _mm256_loadu_ps( pCenter + d + 8 ) );
+			vAcc0 = _mm256_fmadd_ps( vDiff0, vDiff0, vAcc0 );
+			vAcc1 = _mm256_fmadd_ps( vDiff1, vDiff1, vAcc1 );
+		}
+		vAcc0 = _mm256_add_ps( vAcc0, vAcc1 );
+		__m128 vSum = _mm_add_ps( _mm256_castps256_ps128( vAcc0 ), _mm256_extractf128_ps( vAcc0, 1 ) );
+		vSum = _mm_add_ps( vSum, _mm_movehl_ps( vSum, vSum ) );
+		vSum = _mm_add_ss( vSum, _mm_shuffle_ps( vSum, vSum, 1 ) );
+		float fDist = _mm_cvtss_f32( vSum );
+		for( ; d < nDims; d++ )
+		{
+			float fDiff = pQuery[d] - pCenter[d];
+			fDist += fDiff * fDiff;
+		}
+		pDistances[k] = fDist;
+	}
+}
+#endif
+
+// pick the widest kernel supported by the CPU
+static SquaredL2Kernel SelectKernel( const char **pszName )
+{
+#if SIMD_KERNELS
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) )
+	{
+		*pszName = "avx2";
+		return SquaredL2AVX2;
+	}
+	if( __builtin_cpu_supports( "sse2" ) )
+	{
+		*pszName = "sse2";
+		return SquaredL2SSE;
+	}
+#endif
+	*pszName = "scalar";
+	return SquaredL2Scalar;
+}
+
+// kernel selected once at startup
+static const char *g_szKernelName = "";
+static const SquaredL2Kernel g_pfnSquaredL2 = SelectKernel( &g_szKernelName );
+
+// name of the kernel selected for this CPU
+const char* GetDistanceKernelName()
+{
+	return g_szKernelName;
+}
+
+// distances of query to each of the contiguous centers
+void ComputeSquaredL2( const float *pQuery, const float *pCenters, const int nNumCenters,
+	const int nDims, float *pDistances )
+{
+	g_pfnSquaredL2( pQuery, pCenters, nNumCenters, nDims, pDistances );
+}
+
+// index of the closest of the contiguous centers
+int FindClosestCenter( const float *pQuery, const float *pCenters, const int nNumCenters,
+	const int nDims, float *pBestDistance )
+{
+	float afDistances[CENTER_BLOCK];
+	float fBestDistance = FLT_MAX;
+	int nBestCenter = 0;
+
+	// score the centers block by block without any allocation
+	for( int k = 0; k < nNumCenters; k += CENTER_BLOCK )
+	{
+		int nBlock = ( nNumCenters - k < CENTER_BLOCK ) ? nNumCenters - k : CENTER_BLOCK;
+		g_pfnSquaredL2( pQuery, pCenters + k * nDims, nBlock, nDims, afDistances );
+		for( int i = 0; i < nBlock; i++ )
+		{
+			if( afDistances[i] < fBestDistance )
+			{
+				fBestDistance = afDistances[i];
+				nBestCenter = k + i;
+			}
+		}
+	}
+
+	if( pBestDistance )
+	{
+		*pBestDistance = fBestDistance;
+	}
+
+	return nBestCenter;
+}
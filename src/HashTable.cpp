@@ -0,0 +1,288 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <string.h>
+#include "Common.h"
+#include "HashTable.h"
+
+using namespace std;
+using namespace cv;
+
+// header of the binary hash table file, followed by the table arrays
+struct SHashFileHeader
+{
+	char				szMagic[8];			// HASH_MAGIC
+	int					nVersion;			// HASH_VERSION
+	int					nNumImages;			// number of rows
+	int64				nNumBins;			// total number of bins
+	int64				nRowOffsetPos;		// file offset of row offsets (int64, images + 1)
+	int64				nLeafIdxPos;		// file offset of leaf indices (uint32, bins)
+	int64				nWeightPos;			// file offset of weights (float, bins)
+	int64				nInvNormPos;		// file offset of inverse magnitudes (float, images)
+	int64				nFileSize;			// size of the whole file
+	uint64				nChecksum;			// checksum of everything following the header
+};
+
+static const char HASH_MAGIC[8] = { 'H', 'A', 'S', 'H', 'T', 'A', 'B', 'L' };
+static const int HASH_VERSION = 1;
+
+// arrays of the binary hash table file in file order, positions refer to the header fields
+static void GetFileArrays( SHashFileHeader &sHeader, vector<STableArray> &vecArrays )
+{
+	STableArray sRowOffsets = { NULL, sizeof(int64), int64( sHeader.nNumImages ) + 1, &sHeader.nRowOffsetPos };
+	STableArray sLeafIdx = { NULL, sizeof(unsigned int), sHeader.nNumBins, &sHeader.nLeafIdxPos };
+	STableArray sWeights = { NULL, sizeof(float), sHeader.nNumBins, &sHeader.nWeightPos };
+	STableArray sInvNorms = { NULL, sizeof(float), sHeader.nNumImages, &sHeader.nInvNormPos };
+	vecArrays.clear();
+	vecArrays.push_back( sRowOffsets );
+	vecArrays.push_back( sLeafIdx );
+	vecArrays.push_back( sWeights );
+	vecArrays.push_back( sInvNorms );
+}
+
+// constructor
+CHashTable::CHashTable()
+{
+	Clear();
+}
+
+// destructor
+CHashTable::~CHashTable()
+{
+	Clear();
+}
+
+// remove all rows
+void CHashTable::Clear()
+{
+	m_cMappedFile.Close();
+	m_vecRowOffsets.assign( 1, 0 );
+	vector<unsigned int>().swap( m_vecLeafIdx );
+	vector<float>().swap( m_vecWeights );
+	vector<float>().swap( m_vecInvNorms );
+	m_nNumImages = 0;
+	BindArrays();
+}
+
+// point the table at the owned arrays
+void CHashTable::BindArrays()
+{
+	m_pRowOffsets = &m_vecRowOffsets[0];
+	m_pLeafIdx = m_vecLeafIdx.empty() ? NULL : &m_vecLeafIdx[0];
+	m_pWeights = m_vecWeights.empty() ? NULL : &m_vecWeights[0];
+	m_pInvNorms = m_vecInvNorms.empty() ? NULL : &m_vecInvNorms[0];
+}
+
+// copy a mapped table to owned arrays before appending
+void CHashTable::Thaw()
+{
+	if( !m_cMappedFile.IsOpen() )
+	{
+		return;
+	}
+
+	const int64 nNumBins = GetNumBins();
+	m_vecRowOffsets.assign( m_pRowOffsets, m_pRowOffsets + m_nNumImages + 1 );
+	m_vecLeafIdx.assign( m_pLeafIdx, m_pLeafIdx + nNumBins );
+	m_vecWeights.assign( m_pWeights, m_pWeights + nNumBins );
+	m_vecInvNorms.assign( m_pInvNorms, m_pInvNorms + m_nNumImages );
+	m_cMappedFile.Close();
+	BindArrays();
+}
+
+// append histogram of the next image
+int CHashTable::AddImageHash( const CImageHash &cImageHash )
+{
+	Thaw();
+
+	const int nNumBins = cImageHash.GetNumBins();
+	const unsigned int *pLeafIdx = cImageHash.GetLeafIndices();
+	const float *pWeights = cImageHash.GetWeights();
+	m_vecLeafIdx.insert( m_vecLeafIdx.end(), pLeafIdx, pLeafIdx + nNumBins );
+	m_vecWeights.insert( m_vecWeights.end(), pWeights, pWeights + nNumBins );
+	m_vecRowOffsets.push_back( m_vecLeafIdx.size() );
+
+	// norms are kept inverted, comparisons multiply by them
+	m_vecInvNorms.push_back( float( cImageHash.GetInvMagnitude() ) );
+	m_nNumImages++;
+	BindArrays();
+
+	return 0;
+}
+
+// release unused capacity after bulk adding
+void CHashTable::Compact()
+{
+	if( m_cMappedFile.IsOpen() )
+	{
+		return;
+	}
+
+	vector<int64>( m_vecRowOffsets ).swap( m_vecRowOffsets );
+	vector<unsigned int>( m_vecLeafIdx ).swap( m_vecLeafIdx );
+	vector<float>( m_vecWeights ).swap( m_vecWeights );
+	vector<float>( m_vecInvNorms ).swap( m_vecInvNorms );
+	BindArrays();
+}
+
+// number of rows
+int CHashTable::GetNumImages() const
+{
+	return m_nNumImages;
+}
+
+// total number of bins
+int64 CHashTable::GetNumBins() const
+{
+	return m_pRowOffsets[m_nNumImages];
+}
+
+// view of the histogram of an image, valid while the table is unchanged
+void CHashTable::GetImageHash( const int nImageIdx, CImageHash &cImageHash ) const
+{
+	const int64 nFirstBin = m_pRowOffsets[nImageIdx];
+	cImageHash.SetView( int( m_pRowOffsets[nImageIdx + 1] - nFirstBin ), m_pLeafIdx + nFirstBin,
+		m_pWeights + nFirstBin, m_pInvNorms[nImageIdx] );
+}
+
+// bytes used by the owned arrays
+size_t CHashTable::GetMemoryUsage() const
+{
+	return m_vecRowOffsets.capacity() * sizeof(int64)
+		+ m_vecLeafIdx.capacity() * sizeof(unsigned int)
+		+ m_vecWeights.capacity() * sizeof(float)
+		+ m_vecInvNorms.capacity() * sizeof(float);
+}
+
+// save hash table to XML/YAML file
+int CHashTable::SaveTable( const std::string &strFileName ) const
+{
+	// open file storage for writing
+	FileStorage fs( strFileName, FileStorage::WRITE );
+	if( !fs.isOpened() )
+	{
+		return -1;
+	}
+
+	int error = 0;
+	fs << "hashtable" << "[";
+	// save each image hash
+	CImageHash cImageHash;
+	for( int i = 0; i < m_nNumImages && 0 == error; i++ )
+	{
+		GetImageHash( i, cImageHash );
+		error = cImageHash.SaveImageHash( fs );
+	}
+	fs << "]";
+	fs.release();
+
+	return error;
+}
+
+// load hash table from XML/YAML file
+int CHashTable::LoadTable( const std::string &strFileName )
+{
+	Clear();
+
+	// open file storage for reading
+	FileStorage fs( strFileName, FileStorage::READ );
+	if( !fs.isOpened() )
+	{
+		return -1;
+	}
+
+	int error = 0;
+	FileNode fn = fs["hashtable"];
+	m_vecRowOffsets.reserve( fn.size() + 1 );
+	m_vecInvNorms.reserve( fn.size() );
+	// load each image hash into the table
+	CImageHash cImageHash;
+	for( FileNodeIterator it = fn.begin(); it != fn.end() && 0 == error; it++ )
+	{
+		FileNode fn_entry = *it;
+		error = cImageHash.LoadImageHash( fn_entry );
+		if( 0 == error )
+		{
+			error = AddImageHash( cImageHash );
+		}
+	}
+	fs.release();
+	Compact();
+
+	return error;
+}
+
+// save hash table to binary file
+int CHashTable::SaveTableBinary( const std::string &strFileName ) const
+{
+	const int64 nNumBins = GetNumBins();
+
+	SHashFileHeader sHeader;
+	memset( &sHeader, 0, sizeof(sHeader) );
+	memcpy( sHeader.szMagic, HASH_MAGIC, sizeof(HASH_MAGIC) );
+	sHeader.nVersion = HASH_VERSION;
+	sHeader.nNumImages = m_nNumImages;
+	sHeader.nNumBins = nNumBins;
+
+	vector<STableArray> vecArrays;
+	GetFileArrays( sHeader, vecArrays );
+	vecArrays[0].pData = m_pRowOffsets;
+	vecArrays[1].pData = m_pLeafIdx;
+	vecArrays[2].pData = m_pWeights;
+	vecArrays[3].pData = m_pInvNorms;
+
+	return SaveTableFile( strFileName, &sHeader, sizeof(sHeader), vecArrays, sHeader.nFileSize, sHeader.nChecksum );
+}
+
+// map binary hash table file and use it in place
+int CHashTable::LoadTableBinary( const std::string &strFileName, const bool fVerifyChecksum )
+{
+	Clear();
+
+	// validate header and arrays before pointing into the mapping
+	SHashFileHeader sHeader;
+	if( 0 != MapTableFile( m_cMappedFile, strFileName, &sHeader, sizeof(sHeader), HASH_MAGIC, HASH_VERSION ) )
+	{
+		Clear();
+		return -1;
+	}
+	vector<STableArray> vecArrays;
+	GetFileArrays( sHeader, vecArrays );
+	if( sHeader.nNumImages < 0
+		|| 0 != BindTableArrays( m_cMappedFile, sizeof(sHeader), sHeader.nFileSize, sHeader.nChecksum, vecArrays, fVerifyChecksum )
+		|| 0 != CheckRowOffsets( (const int64*)vecArrays[0].pData, sHeader.nNumImages, sHeader.nNumBins ) )
+	{
+		Clear();
+		return -1;
+	}
+
+	// arrays are used directly from the mapping, pages are loaded on demand
+	vector<int64>().swap( m_vecRowOffsets );
+	m_nNumImages = sHeader.nNumImages;
+	m_pRowOffsets = (const int64*)vecArrays[0].pData;
+	m_pLeafIdx = (const unsigned int*)vecArrays[1].pData;
+	m_pWeights = (const float*)vecArrays[2].pData;
+	m_pInvNorms = (const float*)vecArrays[3].pData;
+
+	return 0;
+}
@@ -21,12 +21,109 @@
  * Email:  sumandeep.banerjee@gmail.com
 */
 
+#include <string.h>
+#include <algorithm>
 #include "Common.h"
+#include "MappedFile.h"
 #include "ImageDB.h"
 
 using namespace std;
 using namespace cv;
 
+// header of a binary descriptor record, followed by the packed keypoints and the descriptor block
+struct SRecordFileHeader
+{
+	char				szMagic[8];			// RECORD_MAGIC
+	int					nVersion;			// RECORD_VERSION
+	int					nNumKeypoints;		// number of keypoints
+	int					nNumDescriptors;	// number of descriptor rows
+	int					nDims;				// descriptor dimensions
+	int					nDescType;			// RECORD_FLOAT32 or RECORD_UINT8
+	float				fQuantMin;			// value of level 0 of quantized descriptors
+	float				fQuantStep;			// value step between levels of quantized descriptors
+	int					nReserved;			// zero
+	int64				nKeypointPos;		// file offset of packed keypoints
+	int64				nDescriptorPos;		// file offset of descriptor block
+	int64				nFileSize;			// size of the whole file
+	uint64				nChecksum;			// checksum of everything following the header
+};
+
+// keypoint as stored in binary records
+struct SPackedKeypoint
+{
+	float				fX;					// position
+	float				fY;
+	float				fSize;				// diameter of the neighborhood
+	float				fAngle;				// orientation
+	float				fResponse;			// detector response
+	int					nOctave;			// pyramid octave
+	int					nClassId;			// object class
+};
+
+static const char RECORD_MAGIC[8] = { 'I', 'M', 'G', 'R', 'E', 'C', 'R', 'D' };
+static const int RECORD_VERSION = 1;
+
+// element types of the descriptor block
+static const int RECORD_FLOAT32 = 0;
+static const int RECORD_UINT8 = 1;
+
+// alignment of the descriptor block
+static const int RECORD_ALIGNMENT = 16;
+
+// correspondences needed to estimate a homography
+static const int MIN_HOMOGRAPHY_POINTS = 4;
+
+// matches closer than this are always good, even when the closest match is exact
+static const double MIN_GOOD_MATCH_DIST = 0.02;
+
+// words occurring more often in the query or the candidate do not give correspondences
+static const unsigned int MAX_WORD_OCCURRENCES = 3;
+
+// lowest Hessian threshold the adaptive detector goes down to (halving from the detector threshold)
+static const double MIN_HESSIAN_THRESHOLD = 50.0;
+
+// ordering of keypoints by decreasing detector response
+static bool IsStrongerKeypoint( const KeyPoint &cLeft, const KeyPoint &cRight )
+{
+	return cLeft.response > cRight.response;
+}
+
+// number of correspondences consistent with a planar homography, only the MAX_VERIFY_POINTS correspondences of
+// lowest cost are used so the time of a verification does not grow with the number of keypoints
+static int CountHomographyInliers( vector<Point2f> &vecObjectPoints, vector<Point2f> &vecQueryPoints,
+	const vector<float> &vecCosts )
+{
+	if( (int)vecQueryPoints.size() < MIN_HOMOGRAPHY_POINTS )
+	{
+		return 0;
+	}
+
+	if( MAX_VERIFY_POINTS > 0 && (int)vecQueryPoints.size() > MAX_VERIFY_POINTS )
+	{
+		vector< pair<float, int> > vecRanks( vecCosts.size() );
+		for( unsigned int i = 0; i < vecCosts.size(); i++ )
+		{
+			vecRanks[i] = pair<float, int>( vecCosts[i], i );
+		}
+		nth_element( vecRanks.begin(), vecRanks.begin() + MAX_VERIFY_POINTS, vecRanks.end() );
+
+		vector<Point2f> vecKeptObjectPoints( MAX_VERIFY_POINTS ), vecKeptQueryPoints( MAX_VERIFY_POINTS );
+		for( int i = 0; i < MAX_VERIFY_POINTS; i++ )
+		{
+			vecKeptObjectPoints[i] = vecObjectPoints[ vecRanks[i].second ];
+			vecKeptQueryPoints[i] = vecQueryPoints[ vecRanks[i].second ];
+		}
+		vecObjectPoints.swap( vecKeptObjectPoints );
+		vecQueryPoints.swap( vecKeptQueryPoints );
+	}
+
+	// Compute planar homography to determine valid matches
+	Mat matInliers;
+	findHomography( vecObjectPoints, vecQueryPoints, matInliers, CV_RANSAC );
+
+	return matInliers.empty() ? 0 : countNonZero( matInliers );
+}
+
 // keypoint feature descriptor computation class
 cv::SURF g_SURFDetector( 400 );
 // descriptor matcher (BBF+NN) class
@@ -36,6 +133,8 @@ cv::FlannBasedMatcher g_FLANNMatcher;
 CImageData::CImageData( const std::string &strDBPath, const std::string &strImageName ) : m_strDBPath(strDBPath), m_strImageName(strImageName)
 {
 	m_fRecordSaved = true;
+	m_pRecordStore = NULL;
+	m_nRecordIdx = -1;
 }
 
 // destructor
@@ -62,6 +161,12 @@ void CImageData::SetImageFrame( const cv::Mat &matImageFrame )
 	}
 }
 
+// drop image frame data, saved records reload it with LoadImageRecord
+void CImageData::ReleaseImageFrame()
+{
+	m_matImageFrame.release();
+}
+
 // checks if the image read was success
 bool CImageData::IsImageValid() const
 {
@@ -69,7 +174,13 @@ bool CImageData::IsImageValid() const
 }
 
 // computes keypoints and descriptors
-int CImageData::ComputeDescriptors()
+int CImageData::ComputeDescriptors( const int nMaxKeypoints, const bool fAdaptiveThreshold )
+{
+	return ComputeDescriptors( g_SURFDetector, nMaxKeypoints, fAdaptiveThreshold );
+}
+
+// computes keypoints and descriptors with a given detector
+int CImageData::ComputeDescriptors( const cv::SURF &cDetector, const int nMaxKeypoints, const bool fAdaptiveThreshold )
 {
 	// check valid image data before computing descriptors
 	if( NULL == m_matImageFrame.data )
@@ -79,8 +190,27 @@ int CImageData::ComputeDescriptors()
 
 	m_fRecordSaved = false;
     //initModule_nonfree();
-	g_SURFDetector.detect( m_matImageFrame, m_vecKeypoints );
-	g_SURFDetector.compute( m_matImageFrame, m_vecKeypoints, m_matDescriptors );
+	cDetector.detect( m_matImageFrame, m_vecKeypoints );
+
+	// images short of the budget are detected again with a halved threshold, so the count converges toward the budget
+	if( nMaxKeypoints > 0 && fAdaptiveThreshold )
+	{
+		double dThreshold = cDetector.hessianThreshold;
+		while( (int)m_vecKeypoints.size() < nMaxKeypoints && dThreshold > MIN_HESSIAN_THRESHOLD )
+		{
+			dThreshold = MAX( dThreshold / 2, MIN_HESSIAN_THRESHOLD );
+			SURF cAdaptedDetector( dThreshold, cDetector.nOctaves, cDetector.nOctaveLayers, cDetector.extended, cDetector.upright );
+			cAdaptedDetector.detect( m_matImageFrame, m_vecKeypoints );
+		}
+	}
+
+	// keep the strongest keypoints within the budget, which bounds record size and query cost
+	if( nMaxKeypoints > 0 && (int)m_vecKeypoints.size() > nMaxKeypoints )
+	{
+		nth_element( m_vecKeypoints.begin(), m_vecKeypoints.begin() + nMaxKeypoints, m_vecKeypoints.end(), IsStrongerKeypoint );
+		m_vecKeypoints.resize( nMaxKeypoints );
+	}
+	cDetector.compute( m_matImageFrame, m_vecKeypoints, m_matDescriptors );
 
 #ifdef _DEBUG
 	Mat	matKeyImage;
@@ -100,11 +230,57 @@ int CImageData::SaveImageRecord()
 		return 0;
 	}
 
+	// records of a packed store are appended to its segments
+	if( NULL != m_pRecordStore )
+	{
+		vector<unsigned char> vecRecord, vecImage;
+		if( 0 != EncodeBinaryRecord( vecRecord, QUANTIZE_RECORDS )
+			|| ( NULL != m_matImageFrame.data && !imencode( ".jpg", m_matImageFrame, vecImage ) )
+			|| 0 != m_pRecordStore->Append( m_nRecordIdx, &vecRecord[0], vecRecord.size(),
+				vecImage.empty() ? NULL : &vecImage[0], vecImage.size() ) )
+		{
+			return -1;
+		}
+
+		m_fRecordSaved = true;
+		return 0;
+	}
+
 	// save image frame data to file
 	imwrite( m_strDBPath + "/" + IMAGE_FOLDER + "/" + m_strImageName + ".jpg", m_matImageFrame );
 
 	// save keypoint and descriptor data
-	FileStorage fs( m_strDBPath + "/" + DESCR_FOLDER + "/" + m_strImageName + FILE_FORMAT, FileStorage::WRITE );
+	const string strFileName = m_strDBPath + "/" + DESCR_FOLDER + "/" + m_strImageName + RECORD_FORMAT;
+	int error = ( BINARY_FORMAT == RECORD_FORMAT ) ? SaveBinaryRecord( strFileName, QUANTIZE_RECORDS ) : SaveXMLRecord( strFileName );
+	if( 0 != error )
+	{
+		return error;
+	}
+
+	m_fRecordSaved = true;
+
+	return 0;
+}
+
+// remove a saved record from disk (record files or packed store entry)
+void CImageData::DeleteSavedRecord()
+{
+	if( NULL != m_pRecordStore )
+	{
+		m_pRecordStore->Remove( m_nRecordIdx );
+	}
+	else
+	{
+		remove( ( m_strDBPath + "/" + IMAGE_FOLDER + "/" + m_strImageName + ".jpg" ).c_str() );
+		remove( ( m_strDBPath + "/" + DESCR_FOLDER + "/" + m_strImageName + RECORD_FORMAT ).c_str() );
+	}
+	m_fRecordSaved = false;
+}
+
+// save keypoints and descriptors to XML/YAML file
+int CImageData::SaveXMLRecord( const std::string &strFileName ) const
+{
+	FileStorage fs( strFileName, FileStorage::WRITE );
 	if( !fs.isOpened() )
 	{
 		return -1;
@@ -113,19 +289,13 @@ int CImageData::SaveImageRecord()
 	write( fs, "descriptors", m_matDescriptors );
 	fs.release();
 
-	m_fRecordSaved = true;
-
 	return 0;
 }
 
-// loads image and descriptors
-int CImageData::LoadImageRecord()
+// load keypoints and descriptors from XML/YAML file
+int CImageData::LoadXMLRecord( const std::string &strFileName )
 {
-	// load image frame data from file
-	m_matImageFrame = imread( m_strDBPath + "/" + IMAGE_FOLDER + "/" + m_strImageName + ".jpg" );
-
-	// load keypoint and descriptor data
-	FileStorage fs( m_strDBPath + "/" + DESCR_FOLDER + "/" + m_strImageName + FILE_FORMAT, FileStorage::READ );
+	FileStorage fs( strFileName, FileStorage::READ );
 	if( !fs.isOpened() )
 	{
 		return -1;
@@ -136,6 +306,320 @@ int CImageData::LoadImageRecord()
 	read( fn_descnode, m_matDescriptors );
 	fs.release();
 
+	return 0;
+}
+
+// serialize keypoints and descriptors to a binary record, descriptors are optionally stored as 8-bit levels
+int CImageData::EncodeBinaryRecord( std::vector<unsigned char> &vecRecord, const bool fQuantize ) const
+{
+	const int nNumDescriptors = m_matDescriptors.rows;
+	const int nDims = m_matDescriptors.cols;
+	if( nNumDescriptors > 0 && CV_32F != m_matDescriptors.type() )
+	{
+		return -1;
+	}
+
+	// quantization range of the descriptor values
+	float fQuantMin = 0.0f, fQuantStep = 0.0f;
+	if( fQuantize && nNumDescriptors > 0 )
+	{
+		double dMin, dMax;
+		minMaxLoc( m_matDescriptors, &dMin, &dMax );
+		fQuantMin = float( dMin );
+		fQuantStep = float( ( dMax - dMin ) / 255.0 );
+	}
+
+	const int nElemSize = fQuantize ? sizeof(unsigned char) : sizeof(float);
+	SRecordFileHeader sHeader;
+	memset( &sHeader, 0, sizeof(sHeader) );
+	memcpy( sHeader.szMagic, RECORD_MAGIC, sizeof(RECORD_MAGIC) );
+	sHeader.nVersion = RECORD_VERSION;
+	sHeader.nNumKeypoints = m_vecKeypoints.size();
+	sHeader.nNumDescriptors = nNumDescriptors;
+	sHeader.nDims = nDims;
+	sHeader.nDescType = fQuantize ? RECORD_UINT8 : RECORD_FLOAT32;
+	sHeader.fQuantMin = fQuantMin;
+	sHeader.fQuantStep = fQuantStep;
+	sHeader.nKeypointPos = sizeof(SRecordFileHeader);
+	sHeader.nDescriptorPos = sHeader.nKeypointPos + int64( sHeader.nNumKeypoints ) * sizeof(SPackedKeypoint);
+	sHeader.nDescriptorPos = ( sHeader.nDescriptorPos + RECORD_ALIGNMENT - 1 ) / RECORD_ALIGNMENT * RECORD_ALIGNMENT;
+	sHeader.nFileSize = sHeader.nDescriptorPos + int64( nNumDescriptors ) * nDims * nElemSize;
+	vecRecord.assign( sHeader.nFileSize, 0 );
+	unsigned char *pData = &vecRecord[0];
+
+	// keypoints are packed field by field
+	for( int i = 0; i < sHeader.nNumKeypoints; i++ )
+	{
+		const KeyPoint &cKeypoint = m_vecKeypoints[i];
+		SPackedKeypoint sKeypoint;
+		sKeypoint.fX = cKeypoint.pt.x;
+		sKeypoint.fY = cKeypoint.pt.y;
+		sKeypoint.fSize = cKeypoint.size;
+		sKeypoint.fAngle = cKeypoint.angle;
+		sKeypoint.fResponse = cKeypoint.response;
+		sKeypoint.nOctave = cKeypoint.octave;
+		sKeypoint.nClassId = cKeypoint.class_id;
+		memcpy( pData + sHeader.nKeypointPos + int64( i ) * sizeof(SPackedKeypoint), &sKeypoint, sizeof(sKeypoint) );
+	}
+
+	unsigned char *pBlock = pData + sHeader.nDescriptorPos;
+	for( int i = 0; i < nNumDescriptors; i++ )
+	{
+		const float *pRow = m_matDescriptors.ptr<float>( i );
+		if( !fQuantize )
+		{
+			memcpy( pBlock + int64( i ) * nDims * sizeof(float), pRow, nDims * sizeof(float) );
+			continue;
+		}
+		unsigned char *pLevels = pBlock + int64( i ) * nDims;
+		for( int j = 0; j < nDims; j++ )
+		{
+			pLevels[j] = ( fQuantStep > 0.0f ) ? saturate_cast<unsigned char>( ( pRow[j] - fQuantMin ) / fQuantStep ) : 0;
+		}
+	}
+
+	// the checksum covers everything following the header
+	sHeader.nChecksum = ComputeChecksum( pData + sizeof(sHeader), sHeader.nFileSize - sizeof(sHeader) );
+	memcpy( pData, &sHeader, sizeof(sHeader) );
+
+	return 0;
+}
+
+// restore keypoints and descriptors from a binary record, quantized descriptors are restored as floats
+int CImageData::DecodeBinaryRecord( const unsigned char *pData, const size_t nSize )
+{
+	if( nSize < sizeof(SRecordFileHeader) )
+	{
+		return -1;
+	}
+
+	// validate header and checksum before reading the blocks
+	SRecordFileHeader sHeader;
+	memcpy( &sHeader, pData, sizeof(sHeader) );
+	const int nElemSize = ( RECORD_UINT8 == sHeader.nDescType ) ? sizeof(unsigned char) : sizeof(float);
+	if( 0 != memcmp( sHeader.szMagic, RECORD_MAGIC, sizeof(RECORD_MAGIC) )
+		|| RECORD_VERSION != sHeader.nVersion
+		|| sHeader.nNumKeypoints < 0 || sHeader.nNumDescriptors < 0 || sHeader.nDims < 0
+		|| ( RECORD_FLOAT32 != sHeader.nDescType && RECORD_UINT8 != sHeader.nDescType )
+		|| sHeader.nFileSize != (int64)nSize
+		|| sHeader.nKeypointPos < (int64)sizeof(sHeader)
+		|| sHeader.nDescriptorPos < sHeader.nKeypointPos + int64( sHeader.nNumKeypoints ) * (int64)sizeof(SPackedKeypoint)
+		|| sHeader.nFileSize < sHeader.nDescriptorPos + int64( sHeader.nNumDescriptors ) * sHeader.nDims * nElemSize
+		|| sHeader.nChecksum != ComputeChecksum( pData + sizeof(sHeader), nSize - sizeof(sHeader) ) )
+	{
+		return -1;
+	}
+
+	m_vecKeypoints.resize( sHeader.nNumKeypoints );
+	for( int i = 0; i < sHeader.nNumKeypoints; i++ )
+	{
+		SPackedKeypoint sKeypoint;
+		memcpy( &sKeypoint, pData + sHeader.nKeypointPos + int64( i ) * sizeof(SPackedKeypoint), sizeof(sKeypoint) );
+		m_vecKeypoints[i] = KeyPoint( sKeypoint.fX, sKeypoint.fY, sKeypoint.fSize, sKeypoint.fAngle,
+			sKeypoint.fResponse, sKeypoint.nOctave, sKeypoint.nClassId );
+	}
+
+	if( 0 == sHeader.nNumDescriptors )
+	{
+		m_matDescriptors.release();
+		return 0;
+	}
+	m_matDescriptors.create( sHeader.nNumDescriptors, sHeader.nDims, CV_32F );
+	const unsigned char *pBlock = pData + sHeader.nDescriptorPos;
+	for( int i = 0; i < sHeader.nNumDescriptors; i++ )
+	{
+		float *pRow = m_matDescriptors.ptr<float>( i );
+		if( RECORD_FLOAT32 == sHeader.nDescType )
+		{
+			memcpy( pRow, pBlock + int64( i ) * sHeader.nDims * sizeof(float), sHeader.nDims * sizeof(float) );
+			continue;
+		}
+		const unsigned char *pLevels = pBlock + int64( i ) * sHeader.nDims;
+		for( int j = 0; j < sHeader.nDims; j++ )
+		{
+			pRow[j] = sHeader.fQuantMin + sHeader.fQuantStep * pLevels[j];
+		}
+	}
+
+	return 0;
+}
+
+// save keypoints and descriptors to binary file
+int CImageData::SaveBinaryRecord( const std::string &strFileName, const bool fQuantize ) const
+{
+	vector<unsigned char> vecRecord;
+	if( 0 != EncodeBinaryRecord( vecRecord, fQuantize ) )
+	{
+		return -1;
+	}
+
+	FILE *pFile = fopen( strFileName.c_str(), "wb" );
+	if( NULL == pFile )
+	{
+		return -1;
+	}
+	int error = ( 1 == fwrite( &vecRecord[0], vecRecord.size(), 1, pFile ) ) ? 0 : -1;
+	if( 0 != fclose( pFile ) )
+	{
+		error = -1;
+	}
+
+	return error;
+}
+
+// load keypoints and descriptors from binary file
+int CImageData::LoadBinaryRecord( const std::string &strFileName )
+{
+	FILE *pFile = fopen( strFileName.c_str(), "rb" );
+	if( NULL == pFile )
+	{
+		return -1;
+	}
+
+	// records are small, the whole file is read at once
+	vector<unsigned char> vecRecord;
+	long nFileSize = -1;
+	if( 0 == fseek( pFile, 0, SEEK_END ) )
+	{
+		nFileSize = ftell( pFile );
+	}
+	if( nFileSize > 0 && 0 == fseek( pFile, 0, SEEK_SET ) )
+	{
+		vecRecord.resize( nFileSize );
+		if( 1 != fread( &vecRecord[0], nFileSize, 1, pFile ) )
+		{
+			vecRecord.clear();
+		}
+	}
+	fclose( pFile );
+	if( vecRecord.empty() )
+	{
+		return -1;
+	}
+
+	return DecodeBinaryRecord( &vecRecord[0], vecRecord.size() );
+}
+
+// keep the record in a packed store instead of separate files
+void CImageData::SetRecordStore( CRecordStore *pRecordStore, const int nRecordIdx )
+{
+	m_pRecordStore = pRecordStore;
+	m_nRecordIdx = nRecordIdx;
+}
+
+// load the record from its separate files and append it to a packed store
+int CImageData::PackRecord( CRecordStore *pRecordStore, const int nRecordIdx )
+{
+	SetRecordStore( NULL, -1 );
+	if( 0 != LoadImageRecord() )
+	{
+		return -1;
+	}
+
+	SetRecordStore( pRecordStore, nRecordIdx );
+	m_fRecordSaved = false;
+
+	return SaveImageRecord();
+}
+
+// convert the XML descriptor record of the image to the binary format
+int CImageData::MigrateRecord( const bool fQuantize )
+{
+	const string strFileName = m_strDBPath + "/" + DESCR_FOLDER + "/" + m_strImageName;
+	if( 0 != LoadXMLRecord( strFileName + FILE_FORMAT ) )
+	{
+		return -1;
+	}
+
+	return SaveBinaryRecord( strFileName + BINARY_FORMAT, fQuantize );
+}
+
+// loads image and descriptors
+int CImageData::LoadImageRecord()
+{
+	// load image frame data
+	if( 0 != LoadImageFrame() )
+	{
+		return -1;
+	}
+
+	// load keypoint and descriptor data
+	return LoadDescriptorRecord();
+}
+
+// loads image frame only, keypoints and descriptors are left untouched
+int CImageData::LoadImageFrame()
+{
+	// frames of a packed store are decoded from the mapped segments
+	if( NULL != m_pRecordStore )
+	{
+		const unsigned char *pRecord, *pImage;
+		size_t nRecordSize, nImageSize;
+		if( 0 != m_pRecordStore->GetRecord( m_nRecordIdx, pRecord, nRecordSize, pImage, nImageSize ) )
+		{
+			return -1;
+		}
+		m_matImageFrame = ( nImageSize > 0 ) ? imdecode( Mat( 1, (int)nImageSize, CV_8U, (void*)pImage ), IMREAD_COLOR ) : Mat();
+		return 0;
+	}
+
+	// load image frame data from file
+	m_matImageFrame = imread( m_strDBPath + "/" + IMAGE_FOLDER + "/" + m_strImageName + ".jpg" );
+
+	return 0;
+}
+
+// drop image frame, keypoints and descriptors of a saved record, they are reloaded on demand
+void CImageData::ReleaseRecord()
+{
+	if( !m_fRecordSaved )
+	{
+		return;
+	}
+
+	m_matImageFrame.release();
+	vector<KeyPoint>().swap( m_vecKeypoints );
+	m_matDescriptors.release();
+}
+
+// whether keypoints or descriptors are in memory
+bool CImageData::IsRecordLoaded() const
+{
+	return !m_vecKeypoints.empty() || !m_matDescriptors.empty();
+}
+
+// bytes held by image frame, keypoints and descriptors
+size_t CImageData::GetMemoryUsage() const
+{
+	return m_matImageFrame.total() * m_matImageFrame.elemSize()
+		+ m_vecKeypoints.capacity() * sizeof(KeyPoint)
+		+ m_matDescriptors.total() * m_matDescriptors.elemSize();
+}
+
+// loads keypoints and descriptors only, binary records are preferred over XML/YAML records
+int CImageData::LoadDescriptorRecord()
+{
+	// records of a packed store are decoded from the mapped segments
+	if( NULL != m_pRecordStore )
+	{
+		const unsigned char *pRecord, *pImage;
+		size_t nRecordSize, nImageSize;
+		if( 0 != m_pRecordStore->GetRecord( m_nRecordIdx, pRecord, nRecordSize, pImage, nImageSize )
+			|| 0 != DecodeBinaryRecord( pRecord, nRecordSize ) )
+		{
+			return -1;
+		}
+
+		m_fRecordSaved = true;
+		return 0;
+	}
+
+	const string strFileName = m_strDBPath + "/" + DESCR_FOLDER + "/" + m_strImageName;
+	if( 0 != LoadBinaryRecord( strFileName + BINARY_FORMAT ) && 0 != LoadXMLRecord( strFileName + FILE_FORMAT ) )
+	{
+		return -1;
+	}
+
 	m_fRecordSaved = true;
 
 	return 0;
@@ -165,60 +649,147 @@ const cv::Mat& CImageData::GetDescriptors() const
 	return m_matDescriptors;
 }
 
-// validate spatial consistency
-int CImageData::ValidateGeometry( const CImageData &cQueryImage ) const
+// set visual word of each keypoint
+void CImageData::SetWordIds( const std::vector<int> &vecWordIds )
+{
+	m_vecWordIds = vecWordIds;
+}
+
+// get visual word of each keypoint (empty if not assigned)
+const std::vector<int>& CImageData::GetWordIds() const
+{
+	return m_vecWordIds;
+}
+
+// validate spatial consistency, returns the number of matches consistent with a homography
+int CImageData::ValidateGeometry( const CImageData &cQueryImage, cv::flann::Index *pMatcherIndex ) const
 {
 	// Retrieve keypoint and descriptors from query image record
-	const Mat &matQueryImageFrame = cQueryImage.GetImageFrame();
 	const vector<KeyPoint> &vecQueryKeypoints = cQueryImage.GetKeypoints();
 	const Mat &matQueryDescriptors = cQueryImage.GetDescriptors();
 
-	// Matching descriptor vectors using FLANN matcher
-	vector<DMatch> vecMatches;
-	g_FLANNMatcher.match( matQueryDescriptors, m_matDescriptors, vecMatches );
-
-	// Quick calculation of max and min distances between keypoints
-	double dMaxDist = 0; double dMinDist = 100;
-	for( int i = 0; i < matQueryDescriptors.rows; i++ )
-	{ 
-		double dist = vecMatches[i].distance;
-		if( dist < dMinDist )
-			dMinDist = dist;
-		if( dist > dMaxDist )
-			dMaxDist = dist;
+	// a homography needs at least 4 correspondences
+	if( matQueryDescriptors.rows < MIN_HOMOGRAPHY_POINTS || m_matDescriptors.rows < MIN_HOMOGRAPHY_POINTS )
+	{
+		return 0;
 	}
 
-	// Draw only "good" matches (i.e. whose distance is less than 3*min_dist )
-	vector<DMatch> vecGoodMatches;
-	for( int i = 0; i < matQueryDescriptors.rows; i++ )
+	// Matching descriptor vectors using FLANN matcher (the shared matcher is cloned for a given train set,
+	// so concurrent validations do not interfere), a prebuilt index of the descriptors skips building one
+	vector<DMatch> vecMatches;
+	if( NULL != pMatcherIndex )
 	{
-		if( vecMatches[i].distance < 3 * dMinDist )
+		Mat matIndices, matDists;
+		pMatcherIndex->knnSearch( matQueryDescriptors, matIndices, matDists, 1, flann::SearchParams() );
+		vecMatches.resize( matQueryDescriptors.rows );
+		for( int i = 0; i < matQueryDescriptors.rows; i++ )
 		{
-			vecGoodMatches.push_back( vecMatches[i] );
+			// the index reports squared L2 distances
+			vecMatches[i] = DMatch( i, matIndices.at<int>( i, 0 ), (float)sqrt( matDists.at<float>( i, 0 ) ) );
 		}
 	}
+	else
+	{
+		g_FLANNMatcher.match( matQueryDescriptors, m_matDescriptors, vecMatches );
+	}
+
+	// Quick calculation of min distance between keypoints
+	double dMinDist = INF;
+	for( unsigned int i = 0; i < vecMatches.size(); i++ )
+	{
+		dMinDist = MIN( dMinDist, (double)vecMatches[i].distance );
+	}
 
-	// Localize the object
+	// Localize the object with "good" matches only (i.e. whose distance is less than 3*min_dist )
+	const double dMaxGoodDist = MAX( 3 * dMinDist, MIN_GOOD_MATCH_DIST );
 	vector<Point2f> vecQueryPoints;
 	vector<Point2f> vecObjectPoints;
-	for( unsigned int i = 0; i < vecGoodMatches.size(); i++ )
+	vector<float> vecCosts;
+	for( unsigned int i = 0; i < vecMatches.size(); i++ )
 	{
-		// Get the keypoints from the good matches
-		vecQueryPoints.push_back( vecQueryKeypoints[ vecGoodMatches[i].queryIdx ].pt );
-		vecObjectPoints.push_back( m_vecKeypoints[ vecGoodMatches[i].trainIdx ].pt );
+		if( vecMatches[i].distance < dMaxGoodDist )
+		{
+			// Get the keypoints from the good matches, closer matches are preferred
+			vecQueryPoints.push_back( vecQueryKeypoints[ vecMatches[i].queryIdx ].pt );
+			vecObjectPoints.push_back( m_vecKeypoints[ vecMatches[i].trainIdx ].pt );
+			vecCosts.push_back( vecMatches[i].distance );
+		}
 	}
 
-	// Compute planar homography to determine valid matches
-	Mat matInliers;
-	Mat H = findHomography( vecObjectPoints, vecQueryPoints, matInliers, CV_RANSAC );
-	
-	Mat img_matches;
-	vector<char> vecInliers = Mat_<unsigned char>(matInliers);
-	drawMatches( matQueryImageFrame, vecQueryKeypoints, m_matImageFrame, m_vecKeypoints, 
-		vecGoodMatches, img_matches, Scalar::all(-1), Scalar::all(-1),
-		vector<char>(), DrawMatchesFlags::NOT_DRAW_SINGLE_POINTS );
+	return CountHomographyInliers( vecObjectPoints, vecQueryPoints, vecCosts );
+}
 
-	imwrite( "match.jpg", img_matches );
+// validate spatial consistency of keypoints assigned to the same visual words, returns the number of homography inliers
+int CImageData::ValidateGeometryByWords( const CImageData &cQueryImage, const int *pImageWords, const int nNumImageWords ) const
+{
+	const vector<KeyPoint> &vecQueryKeypoints = cQueryImage.GetKeypoints();
+	const vector<int> &vecQueryWords = cQueryImage.GetWordIds();
+	if( vecQueryWords.size() != vecQueryKeypoints.size() || nNumImageWords != (int)m_vecKeypoints.size() )
+	{
+		return -1;
+	}
 
-	return 0;
+	// (word, keypoint) pairs of both images sorted by word, so shared words are found in one merge pass
+	vector< pair<int, int> > vecQueryEntries( vecQueryWords.size() );
+	for( unsigned int i = 0; i < vecQueryWords.size(); i++ )
+	{
+		vecQueryEntries[i] = pair<int, int>( vecQueryWords[i], i );
+	}
+	vector< pair<int, int> > vecImageEntries( nNumImageWords );
+	for( int i = 0; i < nNumImageWords; i++ )
+	{
+		vecImageEntries[i] = pair<int, int>( pImageWords[i], i );
+	}
+	sort( vecQueryEntries.begin(), vecQueryEntries.end() );
+	sort( vecImageEntries.begin(), vecImageEntries.end() );
+
+	// keypoints of a shared word are paired with each other, bursty words (repeated texture) are skipped
+	vector<Point2f> vecQueryPoints;
+	vector<Point2f> vecObjectPoints;
+	vector<float> vecCosts;
+	unsigned int iQuery = 0, iImage = 0;
+	while( iQuery < vecQueryEntries.size() && iImage < vecImageEntries.size() )
+	{
+		const int nQueryWord = vecQueryEntries[iQuery].first;
+		const int nImageWord = vecImageEntries[iImage].first;
+		if( nQueryWord < nImageWord )
+		{
+			iQuery++;
+			continue;
+		}
+		if( nImageWord < nQueryWord )
+		{
+			iImage++;
+			continue;
+		}
+
+		unsigned int nQueryEnd = iQuery, nImageEnd = iImage;
+		while( nQueryEnd < vecQueryEntries.size() && vecQueryEntries[nQueryEnd].first == nQueryWord )
+		{
+			nQueryEnd++;
+		}
+		while( nImageEnd < vecImageEntries.size() && vecImageEntries[nImageEnd].first == nImageWord )
+		{
+			nImageEnd++;
+		}
+		if( nQueryEnd - iQuery <= MAX_WORD_OCCURRENCES && nImageEnd - iImage <= MAX_WORD_OCCURRENCES )
+		{
+			for( unsigned int q = iQuery; q < nQueryEnd; q++ )
+			{
+				for( unsigned int m = iImage; m < nImageEnd; m++ )
+				{
+					// pairs of strong keypoints are preferred
+					const KeyPoint &cQueryKeypoint = vecQueryKeypoints[ vecQueryEntries[q].second ];
+					const KeyPoint &cImageKeypoint = m_vecKeypoints[ vecImageEntries[m].second ];
+					vecQueryPoints.push_back( cQueryKeypoint.pt );
+					vecObjectPoints.push_back( cImageKeypoint.pt );
+					vecCosts.push_back( -MIN( cQueryKeypoint.response, cImageKeypoint.response ) );
+				}
+			}
+		}
+		iQuery = nQueryEnd;
+		iImage = nImageEnd;
+	}
+
+	return CountHomographyInliers( vecObjectPoints, vecQueryPoints, vecCosts );
 }
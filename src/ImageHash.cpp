@@ -21,16 +21,86 @@
  * Email:  sumandeep.banerjee@gmail.com
 */
 
+#include <algorithm>
 #include "Common.h"
 #include "ImageHash.h"
 
 using namespace std;
 using namespace cv;
 
+// size ratio from which Compare gallops through the larger histogram
+static const int GALLOP_RATIO = 8;
+
+// first position from nPos on with leaf index not less than nLeafIdx, probing 1, 2, 4.. bins ahead before a binary search
+static int GallopTo( const unsigned int *pLeafIdx, const int nSize, int nPos, const unsigned int nLeafIdx )
+{
+	int nStep = 1;
+	while( nPos + nStep < nSize && pLeafIdx[nPos + nStep] < nLeafIdx )
+	{
+		nPos += nStep;
+		nStep *= 2;
+	}
+
+	return lower_bound( pLeafIdx + nPos, pLeafIdx + MIN( nPos + nStep + 1, nSize ), nLeafIdx ) - pLeafIdx;
+}
+
+// sum of products of the weights of matching bins, the smaller histogram gallops through the larger one
+static double SkewedDotProduct( const unsigned int *pSmallLeafIdx, const float *pSmallWeights, const int nSmallSize,
+	const unsigned int *pLargeLeafIdx, const float *pLargeWeights, const int nLargeSize )
+{
+	double dScore = 0.0;
+	for( int i = 0, nPos = 0; i < nSmallSize && nPos < nLargeSize; i++ )
+	{
+		nPos = GallopTo( pLargeLeafIdx, nLargeSize, nPos, pSmallLeafIdx[i] );
+		if( nPos < nLargeSize && pLargeLeafIdx[nPos] == pSmallLeafIdx[i] )
+		{
+			dScore += double( pSmallWeights[i] ) * pLargeWeights[nPos];
+			nPos++;
+		}
+	}
+
+	return dScore;
+}
+
 // constructor
 CImageHash::CImageHash()
 {
-	m_dMagnitude = 0.0;
+	m_dInvMagnitude = 0.0;
+	m_nNumBins = 0;
+	m_pLeafIdx = NULL;
+	m_pWeights = NULL;
+}
+
+// copy constructor
+CImageHash::CImageHash( const CImageHash &cImageHash )
+{
+	m_pLeafIdx = NULL;
+	m_pWeights = NULL;
+	*this = cImageHash;
+}
+
+// assignment, own arrays are copied and views keep pointing at the hash table
+CImageHash& CImageHash::operator=( const CImageHash &cImageHash )
+{
+	if( this != &cImageHash )
+	{
+		m_dInvMagnitude = cImageHash.m_dInvMagnitude;
+		m_nNumBins = cImageHash.m_nNumBins;
+		m_vecLeafIdx = cImageHash.m_vecLeafIdx;
+		m_vecWeights = cImageHash.m_vecWeights;
+		if( cImageHash.IsView() )
+		{
+			m_pLeafIdx = cImageHash.m_pLeafIdx;
+			m_pWeights = cImageHash.m_pWeights;
+		}
+		else
+		{
+			m_pLeafIdx = m_vecLeafIdx.empty() ? NULL : &m_vecLeafIdx[0];
+			m_pWeights = m_vecWeights.empty() ? NULL : &m_vecWeights[0];
+		}
+	}
+
+	return *this;
 }
 
 // destructor
@@ -40,42 +110,98 @@ CImageHash::~CImageHash()
 }
 
 // compute word histogram from set of image descriptors
-void CImageHash::Compute ( const cv::Mat &matQueryDescriptors, const CVocabTree &cVocabTree )
+void CImageHash::Compute ( const cv::Mat &matQueryDescriptors, const CVocabTree &cVocabTree, std::vector<int> *pWordIds )
 {
 	// clear word histogram before computing a new one
-	m_mapWordHist.clear();
+	Clear();
+	if( NULL != pWordIds )
+	{
+		pWordIds->clear();
+	}
 
-	int nNumDescriptors = matQueryDescriptors.rows;
-	// for descriotors of all keypoints
-	for( int iRow = 0; iRow < nNumDescriptors; iRow++ )
+	// quantize all descriptors to their closest leaf nodes in one batch
+	vector<int> vecLeafNodes;
+	if( 0 != cVocabTree.QuantizeBatch( matQueryDescriptors, vecLeafNodes ) )
 	{
-		// search for the closest leaf node
-		const CVocabTreeNode* pLeafNode = cVocabTree.SearchTree( matQueryDescriptors.row( iRow ) );
-		double dNodeWt = pLeafNode->GetNodeWeight();
-		int iLeafNode = pLeafNode->GetLeafIndex();
+		return;
+	}
 
-		// check for existing entry for leaf index in the histogram
-		map<int, double>::iterator it = m_mapWordHist.find( iLeafNode );
-		if ( m_mapWordHist.end() ==  it )
+	// word of each descriptor in row order, before the nodes are sorted
+	if( NULL != pWordIds )
+	{
+		pWordIds->resize( vecLeafNodes.size() );
+		for( unsigned int i = 0; i < vecLeafNodes.size(); i++ )
 		{
-			// new entry (computes and adds the inverse document frequency)
-			m_mapWordHist.insert( pair<int, double>( iLeafNode, dNodeWt / double(nNumDescriptors) ) );
+			(*pWordIds)[i] = cVocabTree.GetLeafIndex( vecLeafNodes[i] );
 		}
-		else
+	}
+
+	ComputeFromNodes( vecLeafNodes, cVocabTree );
+}
+
+// compute word histogram from the stored words of image keypoints
+int CImageHash::ComputeFromWords( const int *pWordIds, const int nNumWords, const CVocabTree &cVocabTree )
+{
+	Clear();
+
+	vector<int> vecLeafNodes( nNumWords );
+	for( int i = 0; i < nNumWords; i++ )
+	{
+		vecLeafNodes[i] = cVocabTree.GetLeafNode( pWordIds[i] );
+		if( vecLeafNodes[i] < 0 )
 		{
-			// existing entry (keeps increasing the term frequency)
-			it->second += dNodeWt / double(nNumDescriptors);
+			return -1;
 		}
 	}
+	ComputeFromNodes( vecLeafNodes, cVocabTree );
 
-	// compute the magnitude of histogram for the purpose of normalization
-	m_dMagnitude = 0.0;
-	for( map<int, double>::iterator it = m_mapWordHist.begin(); it != m_mapWordHist.end(); it++ )
+	return 0;
+}
+
+// compute word histogram from the leaf node of each descriptor (sorted in place)
+void CImageHash::ComputeFromNodes( std::vector<int> &vecLeafNodes, const CVocabTree &cVocabTree )
+{
+	// equal leaf nodes become runs, the run length is the term frequency
+	int nNumDescriptors = vecLeafNodes.size();
+	sort( vecLeafNodes.begin(), vecLeafNodes.end() );
+	vector< pair<unsigned int, float> > vecBins;
+	for( int iRow = 0; iRow < nNumDescriptors; )
+	{
+		int nLeafNode = vecLeafNodes[iRow];
+		int nRunEnd = iRow + 1;
+		while( nRunEnd < nNumDescriptors && vecLeafNodes[nRunEnd] == nLeafNode )
+		{
+			nRunEnd++;
+		}
+
+		// term frequency times the inverse document frequency stored as node weight
+		vecBins.push_back( pair<unsigned int, float>( cVocabTree.GetLeafIndex( nLeafNode ),
+			float( cVocabTree.GetNodeWeight( nLeafNode ) * double( nRunEnd - iRow ) / double( nNumDescriptors ) ) ) );
+		iRow = nRunEnd;
+	}
+
+	// leaf indices do not follow the node order
+	sort( vecBins.begin(), vecBins.end() );
+	m_nNumBins = vecBins.size();
+	m_vecLeafIdx.resize( m_nNumBins );
+	m_vecWeights.resize( m_nNumBins );
+	for( int i = 0; i < m_nNumBins; i++ )
+	{
+		m_vecLeafIdx[i] = vecBins[i].first;
+		m_vecWeights[i] = vecBins[i].second;
+	}
+	m_pLeafIdx = m_nNumBins > 0 ? &m_vecLeafIdx[0] : NULL;
+	m_pWeights = m_nNumBins > 0 ? &m_vecWeights[0] : NULL;
+
+	// compute the magnitude of histogram for the purpose of normalization, comparisons multiply by its inverse
+	double dMagnitude = 0.0;
+	for( int i = 0; i < m_nNumBins; i++ )
 	{
-		m_dMagnitude += it->second * it->second;
+		dMagnitude += double( m_pWeights[i] ) * m_pWeights[i];
 	}
 
-	m_dMagnitude = sqrt( m_dMagnitude );
+	dMagnitude = sqrt( dMagnitude );
+	m_dInvMagnitude = ( dMagnitude > 0.0 ) ? 1.0 / dMagnitude : 0.0;
 }
 
 // add entries to the word histogram
@@ -96,24 +222,38 @@ void CImageHash::Compute ( const cv::Mat &matQueryDescriptors, const CVocabTree
 //	m_dMagnitude = sqrt( m_dMagnitude );
 //}
 
+// point the hash at a row of a hash table, the arrays must outlive the view
+void CImageHash::SetView( const int nNumBins, const unsigned int *pLeafIdx, const float *pWeights, const double dInvMagnitude )
+{
+	Clear();
+	m_dInvMagnitude = dInvMagnitude;
+	m_nNumBins = nNumBins;
+	m_pLeafIdx = pLeafIdx;
+	m_pWeights = pWeights;
+}
+
 // clear histogram
 void CImageHash::Clear()
 {
-	m_dMagnitude = 0.0;
-	m_mapWordHist.clear();
+	m_dInvMagnitude = 0.0;
+	m_nNumBins = 0;
+	m_pLeafIdx = NULL;
+	m_pWeights = NULL;
+	vector<unsigned int>().swap( m_vecLeafIdx );
+	vector<float>().swap( m_vecWeights );
 }
 
 // save hash map to XML/YAML file
 int CImageHash::SaveImageHash( cv::FileStorage &fs ) const
 {
 	fs << "{";
-	fs << "magnitude" << m_dMagnitude;
+	fs << "magnitude" << GetMagnitude();
 	fs << "wordhist" << "[";
-	for( map<int, double>::const_iterator it = m_mapWordHist.begin(); it != m_mapWordHist.end(); it++ )
+	for( int i = 0; i < m_nNumBins; i++ )
 	{
 		fs << "{";
-		fs << "bin" << it->first;
-		fs << "freq" << it->second;
+		fs << "bin" << (int)m_pLeafIdx[i];
+		fs << "freq" << m_pWeights[i];
 		fs << "}";
 	}
 	fs << "]";
@@ -127,54 +267,110 @@ int CImageHash::LoadImageHash( cv::FileNode &fn )
 {
 	Clear();
 
-	fn["magnitude"] >> m_dMagnitude;
+	double dMagnitude = 0.0;
+	fn["magnitude"] >> dMagnitude;
+	m_dInvMagnitude = ( dMagnitude > 0.0 ) ? 1.0 / dMagnitude : 0.0;
 	FileNode fn_wordhist = fn["wordhist"];
+	vector< pair<unsigned int, float> > vecBins;
+	vecBins.reserve( fn_wordhist.size() );
 	for( FileNodeIterator it = fn_wordhist.begin(); it != fn_wordhist.end(); it++ )
 	{
 		int nBinIdx;
 		double dTermFreq;
 		(*it)["bin"] >> nBinIdx;
 		(*it)["freq"] >> dTermFreq;
-		m_mapWordHist.insert( pair<int, double>( nBinIdx, dTermFreq ) );
+		vecBins.push_back( pair<unsigned int, float>( nBinIdx, float( dTermFreq ) ) );
 	}
 
+	// bins are saved in leaf order, histograms of other writers are sorted
+	sort( vecBins.begin(), vecBins.end() );
+	m_nNumBins = vecBins.size();
+	m_vecLeafIdx.resize( m_nNumBins );
+	m_vecWeights.resize( m_nNumBins );
+	for( int i = 0; i < m_nNumBins; i++ )
+	{
+		m_vecLeafIdx[i] = vecBins[i].first;
+		m_vecWeights[i] = vecBins[i].second;
+	}
+	m_pLeafIdx = m_nNumBins > 0 ? &m_vecLeafIdx[0] : NULL;
+	m_pWeights = m_nNumBins > 0 ? &m_vecWeights[0] : NULL;
+
 	return 0;
 }
 
 // compare hash with query
 double CImageHash::Compare( const CImageHash &cQueryHistogram ) const
 {
-	// initialize the iterators
-	map<int, double>::const_iterator 
-		itTarget = this->m_mapWordHist.begin(),
-		itTargetEnd = this->m_mapWordHist.end(),
-		itQuery = cQueryHistogram.m_mapWordHist.begin(),
-		itQueryEnd = cQueryHistogram.m_mapWordHist.end();
+	const unsigned int *pTargetLeafIdx = this->m_pLeafIdx;
+	const unsigned int *pQueryLeafIdx = cQueryHistogram.m_pLeafIdx;
+	const int nTargetSize = this->m_nNumBins;
+	const int nQuerySize = cQueryHistogram.m_nNumBins;
 
 	double dScore = 0.0;
-	// run a double chain through the target and query histograms
-	while( itTarget != itTargetEnd && itQuery != itQueryEnd )
+	if( nTargetSize > GALLOP_RATIO * nQuerySize )
 	{
-		if( itTarget->first < itQuery->first ) // target index is less than query index
-		{
-			itTarget++;	// skip target bin
-		}
-		else if( itTarget->first > itQuery->first ) // query index is less than target index
-		{
-			itQuery++; // skip query bin
-		}
-		else // target and query index match
+		dScore = SkewedDotProduct( pQueryLeafIdx, cQueryHistogram.m_pWeights, nQuerySize,
+			pTargetLeafIdx, this->m_pWeights, nTargetSize );
+	}
+	else if( nQuerySize > GALLOP_RATIO * nTargetSize )
+	{
+		dScore = SkewedDotProduct( pTargetLeafIdx, this->m_pWeights, nTargetSize,
+			pQueryLeafIdx, cQueryHistogram.m_pWeights, nQuerySize );
+	}
+	else
+	{
+		// run a double chain through the target and query histograms, the smaller index (or both) moves forward
+		for( int iTarget = 0, iQuery = 0; iTarget < nTargetSize && iQuery < nQuerySize; )
 		{
-			// accumulate score
-			dScore += itTarget->second * itQuery->second;
-			// move both bins forward
-			itTarget++; 
-			itQuery++;
+			const unsigned int nTargetLeaf = pTargetLeafIdx[iTarget];
+			const unsigned int nQueryLeaf = pQueryLeafIdx[iQuery];
+			if( nTargetLeaf == nQueryLeaf )
+			{
+				dScore += double( this->m_pWeights[iTarget] ) * cQueryHistogram.m_pWeights[iQuery];
+			}
+			iTarget += ( nTargetLeaf <= nQueryLeaf );
+			iQuery += ( nQueryLeaf <= nTargetLeaf );
 		}
 	}
 
 	// normalize the score
-	dScore /= this->m_dMagnitude * cQueryHistogram.m_dMagnitude;
+	dScore *= this->m_dInvMagnitude * cQueryHistogram.m_dInvMagnitude;
 
 	return dScore;
 }
+
+// get magnitude of vocab vector
+double CImageHash::GetMagnitude() const
+{
+	return ( m_dInvMagnitude > 0.0 ) ? 1.0 / m_dInvMagnitude : 0.0;
+}
+
+// inverse magnitude of vocab vector (0 for an empty histogram)
+double CImageHash::GetInvMagnitude() const
+{
+	return m_dInvMagnitude;
+}
+
+// whether the hash points at a hash table row instead of own arrays
+bool CImageHash::IsView() const
+{
+	return m_nNumBins > 0 && ( m_vecLeafIdx.empty() || m_pLeafIdx != &m_vecLeafIdx[0] );
+}
+
+// number of non-empty bins
+int CImageHash::GetNumBins() const
+{
+	return m_nNumBins;
+}
+
+// leaf indices of the bins in increasing order
+const unsigned int* CImageHash::GetLeafIndices() const
+{
+	return m_pLeafIdx;
+}
+
+// TF-IDF scores of the bins
+const float* CImageHash::GetWeights() const
+{
+	return m_pWeights;
+}
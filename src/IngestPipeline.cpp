@@ -0,0 +1,414 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include "Common.h"
+#include "IngestPipeline.h"
+
+using namespace std;
+using namespace cv;
+
+// names of the stages in the statistics
+static const char *STAGE_NAMES[] = { "reader", "extractor", "writer" };
+
+// constructor
+CIngestQueue::CIngestQueue()
+{
+	pthread_mutex_init( &m_mutex, NULL );
+	pthread_cond_init( &m_condNotFull, NULL );
+	pthread_cond_init( &m_condNotEmpty, NULL );
+	Reset( 1 );
+}
+
+// destructor
+CIngestQueue::~CIngestQueue()
+{
+	pthread_cond_destroy( &m_condNotEmpty );
+	pthread_cond_destroy( &m_condNotFull );
+	pthread_mutex_destroy( &m_mutex );
+}
+
+// empty the queue, reset its counters and set its capacity
+void CIngestQueue::Reset( const int nCapacity )
+{
+	pthread_mutex_lock( &m_mutex );
+	m_nCapacity = MAX( nCapacity, 1 );
+	m_fClosed = false;
+	m_dqItems.clear();
+	m_nNumPushed = 0;
+	m_nMaxSize = 0;
+	m_dSizeSum = 0.0;
+	m_nNumFullWaits = 0;
+	m_nNumEmptyWaits = 0;
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// queue an item, waits while the queue is full
+void CIngestQueue::Push( const SIngestItem &sItem )
+{
+	pthread_mutex_lock( &m_mutex );
+	if( (int)m_dqItems.size() >= m_nCapacity )
+	{
+		m_nNumFullWaits++;
+		while( (int)m_dqItems.size() >= m_nCapacity )
+		{
+			pthread_cond_wait( &m_condNotFull, &m_mutex );
+		}
+	}
+
+	m_dqItems.push_back( sItem );
+	m_nNumPushed++;
+	m_nMaxSize = MAX( m_nMaxSize, (int)m_dqItems.size() );
+	m_dSizeSum += m_dqItems.size();
+	pthread_cond_signal( &m_condNotEmpty );
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// dequeue an item, waits while empty, false once closed and empty
+bool CIngestQueue::Pop( SIngestItem &sItem )
+{
+	pthread_mutex_lock( &m_mutex );
+	if( m_dqItems.empty() && !m_fClosed )
+	{
+		m_nNumEmptyWaits++;
+		while( m_dqItems.empty() && !m_fClosed )
+		{
+			pthread_cond_wait( &m_condNotEmpty, &m_mutex );
+		}
+	}
+
+	bool fPopped = !m_dqItems.empty();
+	if( fPopped )
+	{
+		sItem = m_dqItems.front();
+		m_dqItems.pop_front();
+		pthread_cond_signal( &m_condNotFull );
+	}
+	pthread_mutex_unlock( &m_mutex );
+
+	return fPopped;
+}
+
+// wake up waiting consumers, pops fail once the queue is drained
+void CIngestQueue::Close()
+{
+	pthread_mutex_lock( &m_mutex );
+	m_fClosed = true;
+	pthread_cond_broadcast( &m_condNotEmpty );
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// maximum number of queued items
+int CIngestQueue::GetCapacity() const
+{
+	return m_nCapacity;
+}
+
+// log capacity and occupancy counters
+void CIngestQueue::LogStats( const char *szName ) const
+{
+	LogData( "%-16s capacity %4d  mean occupancy %6.1f  max %4d  full waits %6d  empty waits %6d\n",
+		szName, m_nCapacity, ( m_nNumPushed > 0 ) ? m_dSizeSum / m_nNumPushed : 0.0, m_nMaxSize,
+		m_nNumFullWaits, m_nNumEmptyWaits );
+}
+
+// constructor
+CIngestPipeline::CIngestPipeline( const int nNumReaders, const int nNumExtractors,
+	const int nNumWriters, const int nQueueCapacity, const int nMaxKeypoints, const bool fAdaptiveThreshold )
+{
+	m_nMaxKeypoints = nMaxKeypoints;
+	m_fAdaptiveThreshold = fAdaptiveThreshold;
+	m_pInputFilePaths = NULL;
+	m_pImageData = NULL;
+	m_pErrors = NULL;
+	m_nNumFiles = 0;
+	m_nNextFile = 0;
+	m_nFirstFailed = 0;
+	m_dWallTime = 0.0;
+	const int anNumThreads[NUM_STAGES] = { nNumReaders, nNumExtractors, nNumWriters };
+	for( int s = 0; s < NUM_STAGES; s++ )
+	{
+		m_anNumActive[s] = 0;
+		m_asStageStats[s].nNumThreads = MAX( anNumThreads[s], 1 );
+		m_asStageStats[s].nNumItems = 0;
+		m_asStageStats[s].nNumFailed = 0;
+		m_asStageStats[s].dBusyTime = 0.0;
+	}
+	m_cDecodedQueue.Reset( nQueueCapacity );
+	m_cExtractedQueue.Reset( nQueueCapacity );
+	pthread_mutex_init( &m_mutex, NULL );
+}
+
+// destructor
+CIngestPipeline::~CIngestPipeline()
+{
+	pthread_mutex_destroy( &m_mutex );
+}
+
+// reader thread entry point, decodes image files in the order of the input list
+void* CIngestPipeline::ReaderMain( void *pArg )
+{
+	CIngestPipeline *pPipeline = (CIngestPipeline*)pArg;
+	int nNumItems = 0, nNumFailed = 0;
+	double dBusyTime = 0.0;
+	for( ;; )
+	{
+		// files are taken in input order, so none is read after a failure
+		pthread_mutex_lock( &pPipeline->m_mutex );
+		SIngestItem sItem;
+		sItem.nIndex = ( pPipeline->m_nFirstFailed < pPipeline->m_nNumFiles ) ? pPipeline->m_nNumFiles : pPipeline->m_nNextFile++;
+		pthread_mutex_unlock( &pPipeline->m_mutex );
+		if( sItem.nIndex >= pPipeline->m_nNumFiles )
+		{
+			break;
+		}
+
+		int64 nStart = getTickCount();
+		sItem.matFrame = imread( (*pPipeline->m_pInputFilePaths)[sItem.nIndex] );
+		dBusyTime += double( getTickCount() - nStart ) / getTickFrequency();
+		nNumItems++;
+
+		if( !sItem.matFrame.data )
+		{
+			pPipeline->SetFailed( sItem.nIndex, -1 );
+			nNumFailed++;
+			continue;
+		}
+		pPipeline->m_cDecodedQueue.Push( sItem );
+	}
+	pPipeline->FinishThread( READER_STAGE, nNumItems, nNumFailed, dBusyTime );
+
+	return NULL;
+}
+
+// extractor thread entry point, resizes the frames and computes descriptors
+void* CIngestPipeline::ExtractorMain( void *pArg )
+{
+	CIngestPipeline *pPipeline = (CIngestPipeline*)pArg;
+
+	// the global detector is not shared between threads, each thread uses a detector with the same settings
+	SURF cDetector( g_SURFDetector.hessianThreshold, g_SURFDetector.nOctaves, g_SURFDetector.nOctaveLayers,
+		g_SURFDetector.extended, g_SURFDetector.upright );
+
+	int nNumItems = 0, nNumFailed = 0;
+	double dBusyTime = 0.0;
+	SIngestItem sItem;
+	while( pPipeline->m_cDecodedQueue.Pop( sItem ) )
+	{
+		if( pPipeline->IsDropped( sItem.nIndex ) )
+		{
+			continue;
+		}
+
+		int64 nStart = getTickCount();
+		CImageData *pImageData = pPipeline->m_pImageData[sItem.nIndex];
+		pImageData->SetImageFrame( sItem.matFrame );
+		sItem.matFrame.release();
+		int error = pImageData->ComputeDescriptors( cDetector, pPipeline->m_nMaxKeypoints, pPipeline->m_fAdaptiveThreshold );
+		dBusyTime += double( getTickCount() - nStart ) / getTickFrequency();
+		nNumItems++;
+
+		if( 0 != error )
+		{
+			pPipeline->SetFailed( sItem.nIndex, error );
+			pImageData->ReleaseImageFrame();
+			nNumFailed++;
+			continue;
+		}
+		pPipeline->m_cExtractedQueue.Push( sItem );
+	}
+	pPipeline->FinishThread( EXTRACTOR_STAGE, nNumItems, nNumFailed, dBusyTime );
+
+	return NULL;
+}
+
+// writer thread entry point, saves the records and drops their frames
+void* CIngestPipeline::WriterMain( void *pArg )
+{
+	CIngestPipeline *pPipeline = (CIngestPipeline*)pArg;
+	int nNumItems = 0, nNumFailed = 0;
+	double dBusyTime = 0.0;
+	SIngestItem sItem;
+	while( pPipeline->m_cExtractedQueue.Pop( sItem ) )
+	{
+		CImageData *pImageData = pPipeline->m_pImageData[sItem.nIndex];
+		if( pPipeline->IsDropped( sItem.nIndex ) )
+		{
+			pImageData->ReleaseImageFrame();
+			continue;
+		}
+
+		int64 nStart = getTickCount();
+		int error = pImageData->SaveImageRecord();
+		pImageData->ReleaseImageFrame();
+		dBusyTime += double( getTickCount() - nStart ) / getTickFrequency();
+		nNumItems++;
+
+		if( 0 != error )
+		{
+			pPipeline->SetFailed( sItem.nIndex, error );
+			nNumFailed++;
+			continue;
+		}
+		pPipeline->m_vecSaved[sItem.nIndex] = 1;
+	}
+	pPipeline->FinishThread( WRITER_STAGE, nNumItems, nNumFailed, dBusyTime );
+
+	return NULL;
+}
+
+// add thread counters, the last thread of a stage closes its output queue
+void CIngestPipeline::FinishThread( const int nStage, const int nNumItems, const int nNumFailed, const double dBusyTime )
+{
+	pthread_mutex_lock( &m_mutex );
+	m_asStageStats[nStage].nNumItems += nNumItems;
+	m_asStageStats[nStage].nNumFailed += nNumFailed;
+	m_asStageStats[nStage].dBusyTime += dBusyTime;
+	bool fLastThread = ( 0 == --m_anNumActive[nStage] );
+	pthread_mutex_unlock( &m_mutex );
+
+	if( fLastThread && READER_STAGE == nStage )
+	{
+		m_cDecodedQueue.Close();
+	}
+	if( fLastThread && EXTRACTOR_STAGE == nStage )
+	{
+		m_cExtractedQueue.Close();
+	}
+}
+
+// record the error of an image file, later files are dropped
+void CIngestPipeline::SetFailed( const int nIndex, const int error )
+{
+	pthread_mutex_lock( &m_mutex );
+	m_pErrors[nIndex] = error;
+	m_nFirstFailed = MIN( m_nFirstFailed, nIndex );
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// whether an earlier image file failed
+bool CIngestPipeline::IsDropped( const int nIndex )
+{
+	pthread_mutex_lock( &m_mutex );
+	bool fDropped = ( nIndex > m_nFirstFailed );
+	pthread_mutex_unlock( &m_mutex );
+
+	return fDropped;
+}
+
+// ingest image files onto their records up to the first failure, returns -1 if any file failed
+int CIngestPipeline::Run( const std::vector<std::string> &vecInputFilePaths,
+	const std::vector<CImageData*> &vecImageData, std::vector<int> &vecErrors )
+{
+	m_nNumFiles = MIN( vecInputFilePaths.size(), vecImageData.size() );
+	vecErrors.assign( m_nNumFiles, 0 );
+	if( 0 == m_nNumFiles )
+	{
+		return 0;
+	}
+
+	m_pInputFilePaths = &vecInputFilePaths;
+	m_pImageData = &vecImageData[0];
+	m_pErrors = &vecErrors[0];
+	m_nNextFile = 0;
+	m_nFirstFailed = m_nNumFiles;
+	m_vecSaved.assign( m_nNumFiles, 0 );
+	int nNumThreads = 0;
+	for( int s = 0; s < NUM_STAGES; s++ )
+	{
+		m_anNumActive[s] = m_asStageStats[s].nNumThreads;
+		m_asStageStats[s].nNumItems = 0;
+		m_asStageStats[s].nNumFailed = 0;
+		m_asStageStats[s].dBusyTime = 0.0;
+		nNumThreads += m_asStageStats[s].nNumThreads;
+	}
+	m_cDecodedQueue.Reset( m_cDecodedQueue.GetCapacity() );
+	m_cExtractedQueue.Reset( m_cExtractedQueue.GetCapacity() );
+
+	// all stages run at the same time, each stage waits on its input queue, stages are started from the
+	// writer back so that no stage feeds a queue of a stage without threads
+	void* (*apfnStageMain[NUM_STAGES])( void* ) = { ReaderMain, ExtractorMain, WriterMain };
+	int64 nStart = getTickCount();
+	vector<pthread_t> vecThreads;
+	vecThreads.reserve( nNumThreads );
+	bool fStageFailed = false;
+	for( int s = NUM_STAGES - 1; s >= 0 && !fStageFailed; s-- )
+	{
+		int nNumStarted = 0;
+		for( int t = 0; t < m_asStageStats[s].nNumThreads; t++ )
+		{
+			pthread_t thread;
+			if( 0 != pthread_create( &thread, NULL, apfnStageMain[s], this ) )
+			{
+				// the stage runs with fewer threads, the last one not started closes the output queue of a stage without threads
+				FinishThread( s, 0, 0, 0.0 );
+				continue;
+			}
+			vecThreads.push_back( thread );
+			nNumStarted++;
+		}
+		fStageFailed = ( 0 == nNumStarted );
+	}
+	for( unsigned int i = 0; i < vecThreads.size(); i++ )
+	{
+		pthread_join( vecThreads[i], NULL );
+	}
+	m_dWallTime = double( getTickCount() - nStart ) / getTickFrequency();
+
+	// without threads for a stage no file was read, all of them fail
+	if( fStageFailed )
+	{
+		for( int i = 0; i < m_nNumFiles; i++ )
+		{
+			SetFailed( i, -1 );
+		}
+		return -1;
+	}
+
+	// records saved before an earlier file failed are removed, nothing after the first failure is kept
+	for( int i = m_nFirstFailed + 1; i < m_nNumFiles; i++ )
+	{
+		if( m_vecSaved[i] )
+		{
+			m_pImageData[i]->DeleteSavedRecord();
+		}
+	}
+
+	return ( m_nFirstFailed < m_nNumFiles ) ? -1 : 0;
+}
+
+// log throughput of the stages and occupancy of the queues
+void CIngestPipeline::LogStats() const
+{
+	LogData( "Ingested %d file(s) in %.2f s\n", m_nNumFiles, m_dWallTime );
+	LogData( "%-16s threads   items  failed    busy (s)  items/s  utilization\n", "stage" );
+	for( int s = 0; s < NUM_STAGES; s++ )
+	{
+		const SIngestStageStats &sStats = m_asStageStats[s];
+		LogData( "%-16s %7d %7d %7d %11.2f %8.1f %11.0f%%\n",
+			STAGE_NAMES[s], sStats.nNumThreads, sStats.nNumItems, sStats.nNumFailed, sStats.dBusyTime,
+			( m_dWallTime > 0.0 ) ? sStats.nNumItems / m_dWallTime : 0.0,
+			( m_dWallTime > 0.0 ) ? 100.0 * sStats.dBusyTime / ( sStats.nNumThreads * m_dWallTime ) : 0.0 );
+	}
+	m_cDecodedQueue.LogStats( "decoded queue" );
+	m_cExtractedQueue.LogStats( "extracted queue" );
+}
@@ -0,0 +1,630 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <algorithm>
+#include "Common.h"
+#include "InvertedIndex.h"
+#include "TopKCollector.h"
+#include "TaskPool.h"
+
+using namespace std;
+
+// relative slack on score bounds, covers rounding of the float scores and of the dequantized weights
+static const double BOUND_SLACK = 1.001;
+// lists with more postings per candidate image than this are seeked instead of scored in full
+static const int DENSE_CANDIDATE_RATIO = 4;
+// minimum number of images for scoring a query as parallel ranges of images
+static const int MIN_PARALLEL_IMAGES = 20000;
+
+// query word with its posting list
+struct SQueryTerm
+{
+	int						nLeafIdx;							// leaf index of the word
+	float					fQueryWeight;						// query weight normalized by the query hash magnitude
+	double					dUpperBound;						// largest contribution of the word to any score
+	const CPostingList		*pPostingList;						// postings of the word
+};
+
+// scoring order of query words, decreasing upper bound
+static bool IsHigherBound( const SQueryTerm &sTermA, const SQueryTerm &sTermB )
+{
+	return sTermA.dUpperBound > sTermB.dUpperBound
+		|| ( sTermA.dUpperBound == sTermB.dUpperBound && sTermA.nLeafIdx < sTermB.nLeafIdx );
+}
+
+// query words with postings in scoring order, Search and SearchPruned add the contributions
+// to an image in the same order so both compute bit identical scores
+static void GetQueryTerms( const vector<CPostingList> &vecPostingLists, const CImageHash &cQueryHash,
+	vector<SQueryTerm> &vecTerms )
+{
+	vecTerms.clear();
+
+	const double dQueryMagnitude = cQueryHash.GetMagnitude();
+	if( dQueryMagnitude <= 0.0 )
+	{
+		return;
+	}
+
+	const int nNumBins = cQueryHash.GetNumBins();
+	const unsigned int *pLeafIdx = cQueryHash.GetLeafIndices();
+	const float *pWeights = cQueryHash.GetWeights();
+	for( int i = 0; i < nNumBins; i++ )
+	{
+		if( pLeafIdx[i] >= vecPostingLists.size() || pWeights[i] <= 0.0f
+			|| 0 == vecPostingLists[ pLeafIdx[i] ].GetNumPostings() )
+		{
+			continue;
+		}
+
+		SQueryTerm sTerm;
+		sTerm.nLeafIdx = pLeafIdx[i];
+		sTerm.fQueryWeight = float( pWeights[i] / dQueryMagnitude );
+		sTerm.pPostingList = &vecPostingLists[ pLeafIdx[i] ];
+		sTerm.dUpperBound = double( sTerm.fQueryWeight ) * sTerm.pPostingList->GetMaxWeight();
+		vecTerms.push_back( sTerm );
+	}
+
+	sort( vecTerms.begin(), vecTerms.end(), IsHigherBound );
+}
+
+// k best partial scores seen so far, the smallest one is a lower bound of the k-th best final score
+struct STopScores
+{
+	int						nNumTop;							// number of kept scores
+	std::vector<int>		vecImageIdx;						// images of the kept scores
+	std::vector<float>		vecScores;							// kept scores
+	int						nMinPos;							// position of the smallest kept score
+	float					fThreshold;							// smallest kept score once k images are kept, 0 before
+};
+
+// raise the score of an image, called when the new score exceeds the threshold (linear in k)
+static void UpdateTopScores( STopScores &sTopScores, const int nImageIdx, const float fScore )
+{
+	int nPos = find( sTopScores.vecImageIdx.begin(), sTopScores.vecImageIdx.end(), nImageIdx ) - sTopScores.vecImageIdx.begin();
+	if( nPos == (int)sTopScores.vecImageIdx.size() )
+	{
+		if( (int)sTopScores.vecImageIdx.size() < sTopScores.nNumTop )
+		{
+			sTopScores.vecImageIdx.push_back( nImageIdx );
+			sTopScores.vecScores.push_back( fScore );
+		}
+		else
+		{
+			// the image replaces the smallest kept score
+			nPos = sTopScores.nMinPos;
+			sTopScores.vecImageIdx[nPos] = nImageIdx;
+		}
+	}
+	sTopScores.vecScores[nPos] = fScore;
+
+	if( (int)sTopScores.vecScores.size() == sTopScores.nNumTop )
+	{
+		sTopScores.nMinPos = min_element( sTopScores.vecScores.begin(), sTopScores.vecScores.end() ) - sTopScores.vecScores.begin();
+		sTopScores.fThreshold = sTopScores.vecScores[sTopScores.nMinPos];
+	}
+}
+
+// contiguous range of images scored by one task, with its own touched list and top scores
+struct SSearchShard
+{
+	int						nBeginImage;						// first image of the range
+	int						nEndImage;							// one past the last image of the range
+	STopScores				sTopScores;							// best partial scores of the range
+	float					*pAccumulator;						// dense score accumulator of the query (one entry per image)
+	std::vector<int>		vecTouched;							// images of the range with a non-zero accumulator entry
+	std::vector<int>		vecBlockImageIdx;					// image indices of the decoded block
+	std::vector<float>		vecBlockWeights;					// weights of the decoded block
+	int64					nNumDecoded;						// number of decoded postings
+	std::vector< std::pair<double, int> > vecTopMatches;		// best matches of the range, best first
+};
+
+// first block of a posting list that may hold images from nImageIdx on
+static int FindFirstBlock( const CPostingList &cPostingList, const int nImageIdx )
+{
+	int nLow = 0, nHigh = cPostingList.GetNumBlocks();
+	while( nLow < nHigh )
+	{
+		int nMid = ( nLow + nHigh ) / 2;
+		if( cPostingList.GetBlockLastImageIdx( nMid ) < nImageIdx )
+		{
+			nLow = nMid + 1;
+		}
+		else
+		{
+			nHigh = nMid;
+		}
+	}
+
+	return nLow;
+}
+
+// pruned scoring of a range of images
+class CSearchShardTask : public CTask
+{
+public:
+	const CInvertedIndex*	m_pIndex;							// searched index
+	const vector<SQueryTerm>* m_pTerms;						// query words in scoring order
+	int						m_nNumTop;							// number of best matches
+	SSearchShard*			m_pShard;							// range of images and its results
+
+	void Run()
+	{
+		m_pIndex->SearchShard( *m_pTerms, m_nNumTop, *m_pShard );
+	}
+};
+
+// constructor
+CInvertedIndex::CInvertedIndex()
+{
+	m_nNumImages = 0;
+	m_nNumPostings = 0;
+	pthread_mutex_init( &m_mutex, NULL );
+}
+
+// destructor
+CInvertedIndex::~CInvertedIndex()
+{
+	Clear();
+	pthread_mutex_destroy( &m_mutex );
+}
+
+// clear index
+void CInvertedIndex::Clear()
+{
+	m_nNumImages = 0;
+	m_nNumPostings = 0;
+	m_vecPostingLists.clear();
+
+	pthread_mutex_lock( &m_mutex );
+	for( vector< vector<float>* >::iterator it = m_vecFreeAccumulators.begin(); it != m_vecFreeAccumulators.end(); it++ )
+	{
+		delete *it;
+	}
+	m_vecFreeAccumulators.clear();
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// zeroed accumulator of a query, taken from the free ones or allocated
+vector<float>* CInvertedIndex::AcquireAccumulator() const
+{
+	vector<float> *pAccumulator = NULL;
+	pthread_mutex_lock( &m_mutex );
+	if( !m_vecFreeAccumulators.empty() )
+	{
+		pAccumulator = m_vecFreeAccumulators.back();
+		m_vecFreeAccumulators.pop_back();
+	}
+	pthread_mutex_unlock( &m_mutex );
+
+	// each concurrent query gets its own accumulator, entries are reset through the touched lists
+	if( NULL == pAccumulator )
+	{
+		pAccumulator = new vector<float>;
+	}
+	if( (int)pAccumulator->size() < m_nNumImages )
+	{
+		pAccumulator->resize( m_nNumImages, 0.0f );
+	}
+
+	return pAccumulator;
+}
+
+// return a zeroed accumulator to the free ones
+void CInvertedIndex::ReleaseAccumulator( vector<float> *pAccumulator ) const
+{
+	pthread_mutex_lock( &m_mutex );
+	m_vecFreeAccumulators.push_back( pAccumulator );
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// append postings of an image (image indices must increase)
+int CInvertedIndex::AddImage( const int nImageIdx, const CImageHash &cImageHash )
+{
+	if( nImageIdx < m_nNumImages )
+	{
+		return -1;
+	}
+	m_nNumImages = nImageIdx + 1;
+
+	// images without words are counted but get no postings
+	const double dMagnitude = cImageHash.GetMagnitude();
+	if( dMagnitude <= 0.0 )
+	{
+		return 0;
+	}
+
+	const int nNumBins = cImageHash.GetNumBins();
+	const unsigned int *pLeafIdx = cImageHash.GetLeafIndices();
+	const float *pWeights = cImageHash.GetWeights();
+	for( int i = 0; i < nNumBins; i++ )
+	{
+		// words without weight add nothing to any score
+		if( pWeights[i] <= 0.0f )
+		{
+			continue;
+		}
+		if( pLeafIdx[i] >= m_vecPostingLists.size() )
+		{
+			m_vecPostingLists.resize( pLeafIdx[i] + 1 );
+		}
+
+		if( 0 != m_vecPostingLists[ pLeafIdx[i] ].Append( nImageIdx, float( pWeights[i] / dMagnitude ) ) )
+		{
+			return -1;
+		}
+		m_nNumPostings++;
+	}
+
+	return 0;
+}
+
+// release unused capacity after bulk adding
+void CInvertedIndex::Compact()
+{
+	for( vector<CPostingList>::iterator it = m_vecPostingLists.begin(); it != m_vecPostingLists.end(); it++ )
+	{
+		it->Compact();
+	}
+}
+
+// number of indexed images
+int CInvertedIndex::GetNumImages() const
+{
+	return m_nNumImages;
+}
+
+// total number of postings
+int64 CInvertedIndex::GetNumPostings() const
+{
+	return m_nNumPostings;
+}
+
+// bytes used by the posting lists
+size_t CInvertedIndex::GetMemoryUsage() const
+{
+	size_t nBytes = 0;
+	for( vector<CPostingList>::const_iterator it = m_vecPostingLists.begin(); it != m_vecPostingLists.end(); it++ )
+	{
+		nBytes += it->GetMemoryUsage();
+	}
+
+	return nBytes + ( m_vecPostingLists.capacity() - m_vecPostingLists.size() ) * sizeof(CPostingList);
+}
+
+// term-at-a-time scoring, returns best (score, image index) first
+int CInvertedIndex::Search( const CImageHash &cQueryHash, const int nNumTop,
+	std::vector< std::pair<double, int> > &vecTopMatches ) const
+{
+	vecTopMatches.clear();
+
+	vector<SQueryTerm> vecTerms;
+	GetQueryTerms( m_vecPostingLists, cQueryHash, vecTerms );
+	if( vecTerms.empty() )
+	{
+		return 0;
+	}
+
+	vector<float> &vecAccumulator = *AcquireAccumulator();
+	vector<int> vecTouched;
+
+	// walk the posting list of each query word, only images sharing words are touched
+	vector<int> vecBlockImageIdx( POSTING_BLOCK_SIZE );
+	vector<float> vecBlockWeights( POSTING_BLOCK_SIZE );
+	for( vector<SQueryTerm>::const_iterator it = vecTerms.begin(); it != vecTerms.end(); it++ )
+	{
+		// postings are decoded one block at a time
+		const float fQueryWeight = it->fQueryWeight;
+		const CPostingList &cPostingList = *it->pPostingList;
+		const int nNumBlocks = cPostingList.GetNumBlocks();
+		for( int iBlock = 0; iBlock < nNumBlocks; iBlock++ )
+		{
+			int nCount = cPostingList.DecodeBlock( iBlock, &vecBlockImageIdx[0], &vecBlockWeights[0] );
+			for( int i = 0; i < nCount; i++ )
+			{
+				// all contributions are positive, so a zero entry has not been touched yet
+				float &fScore = vecAccumulator[ vecBlockImageIdx[i] ];
+				if( 0.0f == fScore )
+				{
+					vecTouched.push_back( vecBlockImageIdx[i] );
+				}
+				fScore += fQueryWeight * vecBlockWeights[i];
+			}
+		}
+	}
+
+	// select the best matches and reset the accumulator
+	CTopKCollector cTopMatches( nNumTop );
+	for( vector<int>::const_iterator it = vecTouched.begin(); it != vecTouched.end(); it++ )
+	{
+		cTopMatches.Add( vecAccumulator[*it], *it );
+		vecAccumulator[*it] = 0.0f;
+	}
+	ReleaseAccumulator( &vecAccumulator );
+
+	// best matches first
+	cTopMatches.GetSortedMatches( vecTopMatches );
+
+	return 0;
+}
+
+// add the contributions of a whole posting list to the accumulator entries of a shard
+void CInvertedIndex::ScorePostingList( const SQueryTerm &sTerm, SSearchShard &sShard ) const
+{
+	const CPostingList &cPostingList = *sTerm.pPostingList;
+	const int nNumBlocks = cPostingList.GetNumBlocks();
+	int *pBlockImageIdx = &sShard.vecBlockImageIdx[0];
+	float *pBlockWeights = &sShard.vecBlockWeights[0];
+	float *pAccumulator = sShard.pAccumulator;
+	float fThreshold = sShard.sTopScores.fThreshold;
+	for( int iBlock = FindFirstBlock( cPostingList, sShard.nBeginImage ); iBlock < nNumBlocks; iBlock++ )
+	{
+		int nCount = cPostingList.DecodeBlock( iBlock, pBlockImageIdx, pBlockWeights );
+		sShard.nNumDecoded += nCount;
+		for( int i = 0; i < nCount; i++ )
+		{
+			const int nImageIdx = pBlockImageIdx[i];
+			if( nImageIdx < sShard.nBeginImage )
+			{
+				continue;
+			}
+			if( nImageIdx >= sShard.nEndImage )
+			{
+				return;
+			}
+
+			float &fScore = pAccumulator[nImageIdx];
+			if( 0.0f == fScore )
+			{
+				sShard.vecTouched.push_back( nImageIdx );
+			}
+			fScore += sTerm.fQueryWeight * pBlockWeights[i];
+			if( fScore > fThreshold )
+			{
+				UpdateTopScores( sShard.sTopScores, nImageIdx, fScore );
+				fThreshold = sShard.sTopScores.fThreshold;
+			}
+		}
+	}
+}
+
+// MaxScore pruned scoring of the images of a shard
+void CInvertedIndex::SearchShard( const std::vector<SQueryTerm> &vecTerms, const int nNumTop, SSearchShard &sShard ) const
+{
+	const int nNumShardImages = sShard.nEndImage - sShard.nBeginImage;
+	sShard.vecTouched.clear();
+	sShard.vecBlockImageIdx.resize( POSTING_BLOCK_SIZE );
+	sShard.vecBlockWeights.resize( POSTING_BLOCK_SIZE );
+	sShard.nNumDecoded = 0;
+	sShard.vecTopMatches.clear();
+
+	// bound on the score still to be added by words [i, n)
+	const int nNumTerms = vecTerms.size();
+	vector<double> vecRestBound( nNumTerms + 1, 0.0 );
+	for( int i = nNumTerms - 1; i >= 0; i-- )
+	{
+		vecRestBound[i] = vecRestBound[i + 1] + BOUND_SLACK * vecTerms[i].dUpperBound;
+	}
+
+	// words with high bounds are scored over their full lists, until an image not touched yet can no longer
+	// beat the k-th best partial score with the bounds of the remaining words
+	STopScores &sTopScores = sShard.sTopScores;
+	sTopScores.nNumTop = nNumTop;
+	sTopScores.vecImageIdx.clear();
+	sTopScores.vecScores.clear();
+	sTopScores.nMinPos = 0;
+	sTopScores.fThreshold = 0.0f;
+	vector<int> &vecTouched = sShard.vecTouched;
+	float *pAccumulator = sShard.pAccumulator;
+	int iTerm = 0;
+	for( ; iTerm < nNumTerms && !( vecRestBound[iTerm] < sTopScores.fThreshold ); iTerm++ )
+	{
+		ScorePostingList( vecTerms[iTerm], sShard );
+	}
+
+	// remaining words only add to the touched images that can still reach the best matches,
+	// blocks without such images are skipped without decoding
+	vector<int> vecCandidates;
+	if( iTerm == nNumTerms )
+	{
+		// nothing to skip
+	}
+	else if( (int)vecTouched.size() < nNumShardImages / DENSE_CANDIDATE_RATIO )
+	{
+		for( vector<int>::const_iterator it = vecTouched.begin(); it != vecTouched.end(); it++ )
+		{
+			if( !( BOUND_SLACK * pAccumulator[*it] + vecRestBound[iTerm] < sTopScores.fThreshold ) )
+			{
+				vecCandidates.push_back( *it );
+			}
+		}
+		sort( vecCandidates.begin(), vecCandidates.end() );
+	}
+	else
+	{
+		// most images are touched, a scan of the accumulator gives the candidates in order without sorting
+		for( int i = sShard.nBeginImage; i < sShard.nEndImage; i++ )
+		{
+			if( pAccumulator[i] > 0.0f
+				&& !( BOUND_SLACK * pAccumulator[i] + vecRestBound[iTerm] < sTopScores.fThreshold ) )
+			{
+				vecCandidates.push_back( i );
+			}
+		}
+	}
+	for( ; iTerm < nNumTerms; iTerm++ )
+	{
+		const SQueryTerm &sTerm = vecTerms[iTerm];
+		const CPostingList &cPostingList = *sTerm.pPostingList;
+		const int nNumBlocks = cPostingList.GetNumBlocks();
+		const int nNumCandidates = vecCandidates.size();
+
+		// with many candidates scoring the whole list is cheaper than seeking, the postings of the shard are
+		// estimated from its share of the images
+		if( nNumCandidates > int64( cPostingList.GetNumPostings() ) * nNumShardImages / m_nNumImages / DENSE_CANDIDATE_RATIO )
+		{
+			ScorePostingList( sTerm, sShard );
+			continue;
+		}
+
+		int nNumKept = 0, c = 0;
+		int *pBlockImageIdx = &sShard.vecBlockImageIdx[0];
+		float *pBlockWeights = &sShard.vecBlockWeights[0];
+		for( int iBlock = ( nNumCandidates > 0 ) ? FindFirstBlock( cPostingList, vecCandidates[0] ) : nNumBlocks;
+			iBlock < nNumBlocks && c < nNumCandidates; iBlock++ )
+		{
+			// candidates up to the last image of the block, the block is decoded for the first one that can still make it
+			const int nLastImageIdx = cPostingList.GetBlockLastImageIdx( iBlock );
+			double dBlockBound = -1.0;
+			int nCount = 0, nPos = 0;
+			for( ; c < nNumCandidates && vecCandidates[c] <= nLastImageIdx; c++ )
+			{
+				const int nImageIdx = vecCandidates[c];
+				float &fScore = pAccumulator[nImageIdx];
+				if( BOUND_SLACK * fScore + vecRestBound[iTerm] < sTopScores.fThreshold )
+				{
+					continue;
+				}
+
+				// the block max weight bounds the contribution tighter than the list max weight
+				if( dBlockBound < 0.0 )
+				{
+					dBlockBound = BOUND_SLACK * sTerm.fQueryWeight * cPostingList.GetBlockMaxWeight( iBlock ) + vecRestBound[iTerm + 1];
+				}
+				if( BOUND_SLACK * fScore + dBlockBound < sTopScores.fThreshold )
+				{
+					continue;
+				}
+				vecCandidates[nNumKept++] = nImageIdx;
+
+				if( 0 == nCount )
+				{
+					nCount = cPostingList.DecodeBlock( iBlock, pBlockImageIdx, pBlockWeights );
+					sShard.nNumDecoded += nCount;
+				}
+				while( pBlockImageIdx[nPos] < nImageIdx )
+				{
+					nPos++;
+				}
+				if( pBlockImageIdx[nPos] == nImageIdx )
+				{
+					fScore += sTerm.fQueryWeight * pBlockWeights[nPos];
+					if( fScore > sTopScores.fThreshold )
+					{
+						UpdateTopScores( sTopScores, nImageIdx, fScore );
+					}
+				}
+			}
+		}
+
+		// candidates past the end of the list get nothing from this word
+		for( ; c < nNumCandidates; c++ )
+		{
+			if( !( BOUND_SLACK * pAccumulator[ vecCandidates[c] ] + vecRestBound[iTerm + 1] < sTopScores.fThreshold ) )
+			{
+				vecCandidates[nNumKept++] = vecCandidates[c];
+			}
+		}
+		vecCandidates.resize( nNumKept );
+	}
+
+	// images of the best matches score at least the k-th best partial score, select them and reset the accumulator
+	CTopKCollector cTopMatches( nNumTop );
+	for( vector<int>::const_iterator it = vecTouched.begin(); it != vecTouched.end(); it++ )
+	{
+		if( pAccumulator[*it] >= sTopScores.fThreshold )
+		{
+			cTopMatches.Add( pAccumulator[*it], *it );
+		}
+		pAccumulator[*it] = 0.0f;
+	}
+	vecTouched.clear();
+	cTopMatches.GetSortedMatches( sShard.vecTopMatches );
+}
+
+// MaxScore pruned scoring, same matches as Search, counts postings not decoded
+int CInvertedIndex::SearchPruned( const CImageHash &cQueryHash, const int nNumTop,
+	std::vector< std::pair<double, int> > &vecTopMatches, int64 &nNumSkipped ) const
+{
+	vecTopMatches.clear();
+	nNumSkipped = 0;
+
+	vector<SQueryTerm> vecTerms;
+	GetQueryTerms( m_vecPostingLists, cQueryHash, vecTerms );
+	if( vecTerms.empty() || nNumTop <= 0 )
+	{
+		return 0;
+	}
+
+	int64 nNumListPostings = 0;
+	for( vector<SQueryTerm>::const_iterator it = vecTerms.begin(); it != vecTerms.end(); it++ )
+	{
+		nNumListPostings += it->pPostingList->GetNumPostings();
+	}
+
+	// split the images into ranges, run in parallel for large indices, the ranges share
+	// the accumulator of the query as they touch disjoint entries
+	vector<float> &vecAccumulator = *AcquireAccumulator();
+	int nNumShards = ( m_nNumImages >= MIN_PARALLEL_IMAGES ) ? g_TaskPool.GetNumThreads() : 1;
+	vector<SSearchShard> vecShards( nNumShards );
+	vector<CSearchShardTask> vecTasks( nNumShards );
+	vector<CTask*> vecTaskPtrs( nNumShards );
+	for( int s = 0; s < nNumShards; s++ )
+	{
+		vecShards[s].nBeginImage = int( int64(m_nNumImages) * s / nNumShards );
+		vecShards[s].nEndImage = int( int64(m_nNumImages) * ( s + 1 ) / nNumShards );
+		vecShards[s].pAccumulator = &vecAccumulator[0];
+		vecTasks[s].m_pIndex = this;
+		vecTasks[s].m_pTerms = &vecTerms;
+		vecTasks[s].m_nNumTop = nNumTop;
+		vecTasks[s].m_pShard = &vecShards[s];
+		vecTaskPtrs[s] = &vecTasks[s];
+	}
+	if( nNumShards > 1 )
+	{
+		g_TaskPool.Run( vecTaskPtrs );
+	}
+	else
+	{
+		vecTasks[0].Run();
+	}
+	ReleaseAccumulator( &vecAccumulator );
+
+	// the best matches of all images are among the best matches of their ranges
+	CTopKCollector cTopMatches( nNumTop );
+	int64 nNumDecoded = 0;
+	for( int s = 0; s < nNumShards; s++ )
+	{
+		const vector< pair<double, int> > &vecShardMatches = vecShards[s].vecTopMatches;
+		for( unsigned int i = 0; i < vecShardMatches.size(); i++ )
+		{
+			cTopMatches.Add( vecShardMatches[i].first, vecShardMatches[i].second );
+		}
+		nNumDecoded += vecShards[s].nNumDecoded;
+	}
+
+	// best matches first, blocks on range borders are decoded by both ranges
+	cTopMatches.GetSortedMatches( vecTopMatches );
+	nNumSkipped = MAX( nNumListPostings - nNumDecoded, (int64)0 );
+
+	return 0;
+}
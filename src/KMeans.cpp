@@ -0,0 +1,529 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <float.h>
+#include <math.h>
+#include "Distance.h"
+#include "TaskPool.h"
+#include "KMeans.h"
+
+using namespace std;
+using namespace cv;
+
+// minimum number of points for running the assignment step as parallel tasks
+static const int MIN_PARALLEL_POINTS = 20000;
+
+// assignment of a contiguous range of points to their closest centers
+class CAssignTask : public CTask
+{
+public:
+	const Mat*			m_pData;				// data points (one per row)
+	const Mat*			m_pCenters;				// current centers (one per row)
+	const double*		m_pHalfSeparation;		// half distance of each center to its closest other center
+	int*				m_pLabels;				// assigned center of each point
+	double*				m_pUpper;				// upper bound of distance to the assigned center
+	double*				m_pLower;				// lower bound of distance to any other center
+	int					m_nBegin;				// first point of the range
+	int					m_nEnd;					// one past the last point of the range
+	bool				m_fFullScan;			// ignore bounds and compute all distances
+	int64				m_nDistanceEvals;		// distances computed by the last run
+	int					m_nChanged;				// labels changed by the last run
+
+	void Run()
+	{
+		const int nNumClusters = m_pCenters->rows;
+		const int nDims = m_pCenters->cols;
+		vector<float> vecDistances( nNumClusters );
+
+		m_nDistanceEvals = 0;
+		m_nChanged = 0;
+		for( int i = m_nBegin; i < m_nEnd; i++ )
+		{
+			const float *pPoint = m_pData->ptr<float>( i );
+			const int nLabel = m_pLabels[i];
+
+			if( !m_fFullScan )
+			{
+				// no other center can be closer than the assigned one
+				double dBound = MAX( m_pHalfSeparation[nLabel], m_pLower[i] );
+				if( m_pUpper[i] <= dBound )
+				{
+					continue;
+				}
+
+				// tighten the upper bound and test again
+				float fDistance;
+				ComputeSquaredL2( pPoint, m_pCenters->ptr<float>( nLabel ), 1, nDims, &fDistance );
+				m_nDistanceEvals++;
+				m_pUpper[i] = sqrt( double(fDistance) );
+				if( m_pUpper[i] <= dBound )
+				{
+					continue;
+				}
+			}
+
+			// bounds failed, score all centers in one call
+			ComputeSquaredL2( pPoint, m_pCenters->ptr<float>(), nNumClusters, nDims, &vecDistances[0] );
+			m_nDistanceEvals += nNumClusters;
+
+			int nBest = 0;
+			float fBest = FLT_MAX, fSecond = FLT_MAX;
+			for( int k = 0; k < nNumClusters; k++ )
+			{
+				if( vecDistances[k] < fBest )
+				{
+					fSecond = fBest;
+					fBest = vecDistances[k];
+					nBest = k;
+				}
+				else if( vecDistances[k] < fSecond )
+				{
+					fSecond = vecDistances[k];
+				}
+			}
+
+			if( nBest != nLabel )
+			{
+				m_nChanged++;
+			}
+			m_pLabels[i] = nBest;
+			m_pUpper[i] = sqrt( double(fBest) );
+			m_pLower[i] = sqrt( double(fSecond) );
+		}
+	}
+};
+
+// constructor
+CKMeans::CKMeans( const int nMaxIter, const int nAttempts, const int nFlags, const int nBatchSize )
+{
+	m_nMaxIter = nMaxIter;
+	m_nAttempts = nAttempts;
+	m_nFlags = nFlags;
+	m_nBatchSize = nBatchSize;
+}
+
+// pick initial centers
+void CKMeans::SeedCenters( const cv::Mat &matData, const int nNumClusters,
+	cv::RNG &rng, cv::Mat &matCenters, SKMeansStats &sStats ) const
+{
+	const int nNumPoints = matData.rows;
+	const int nDims = matData.cols;
+	matCenters.create( nNumClusters, nDims, CV_32F );
+
+	// random data points
+	if( !( m_nFlags & KMEANS_PP_CENTERS ) )
+	{
+		for( int k = 0; k < nNumClusters; k++ )
+		{
+			Mat matCenter = matCenters.row( k );
+			matData.row( rng.uniform( 0, nNumPoints ) ).copyTo( matCenter );
+		}
+		return;
+	}
+
+	// k-means++: sample each new center proportional to squared distance from the chosen ones
+	vector<float> vecMinDist( nNumPoints );
+	Mat matFirst = matCenters.row( 0 );
+	matData.row( rng.uniform( 0, nNumPoints ) ).copyTo( matFirst );
+	double dSum = 0.0;
+	for( int i = 0; i < nNumPoints; i++ )
+	{
+		ComputeSquaredL2( matData.ptr<float>( i ), matCenters.ptr<float>( 0 ), 1, nDims, &vecMinDist[i] );
+		dSum += vecMinDist[i];
+	}
+	sStats.nDistanceEvals += nNumPoints;
+	sStats.nNaiveEvals += nNumPoints;
+
+	for( int k = 1; k < nNumClusters; k++ )
+	{
+		// draw the next center
+		double dTarget = rng.uniform( 0.0, 1.0 ) * dSum;
+		int nChosen = nNumPoints - 1;
+		for( int i = 0; i < nNumPoints; i++ )
+		{
+			dTarget -= vecMinDist[i];
+			if( dTarget <= 0.0 )
+			{
+				nChosen = i;
+				break;
+			}
+		}
+		Mat matCenter = matCenters.row( k );
+		matData.row( nChosen ).copyTo( matCenter );
+
+		// update distances to the closest chosen center
+		dSum = 0.0;
+		for( int i = 0; i < nNumPoints; i++ )
+		{
+			float fDistance;
+			ComputeSquaredL2( matData.ptr<float>( i ), matCenters.ptr<float>( k ), 1, nDims, &fDistance );
+			vecMinDist[i] = MIN( vecMinDist[i], fDistance );
+			dSum += vecMinDist[i];
+		}
+		sStats.nDistanceEvals += nNumPoints;
+		sStats.nNaiveEvals += nNumPoints;
+	}
+}
+
+// single clustering attempt, returns compactness
+double CKMeans::RunAttempt( const cv::Mat &matData, const int nNumClusters,
+	cv::RNG &rng, std::vector<int> &vecLabels, cv::Mat &matCenters,
+	SKMeansStats &sStats ) const
+{
+	const int nNumPoints = matData.rows;
+	const int nDims = matData.cols;
+
+	SeedCenters( matData, nNumClusters, rng, matCenters, sStats );
+
+	// per point bounds and per center separation
+	vecLabels.assign( nNumPoints, -1 );
+	vector<double> vecUpper( nNumPoints, 0.0 );
+	vector<double> vecLower( nNumPoints, 0.0 );
+	vector<double> vecHalfSeparation( nNumClusters, 0.0 );
+
+	// split the points into ranges, run in parallel for large sets
+	int nNumShards = ( nNumPoints >= MIN_PARALLEL_POINTS ) ? 4 * g_TaskPool.GetNumThreads() : 1;
+	vector<CAssignTask> vecTasks( nNumShards );
+	vector<CTask*> vecTaskPtrs( nNumShards );
+	for( int s = 0; s < nNumShards; s++ )
+	{
+		vecTasks[s].m_pData = &matData;
+		vecTasks[s].m_pCenters = &matCenters;
+		vecTasks[s].m_pHalfSeparation = &vecHalfSeparation[0];
+		vecTasks[s].m_pLabels = &vecLabels[0];
+		vecTasks[s].m_pUpper = &vecUpper[0];
+		vecTasks[s].m_pLower = &vecLower[0];
+		vecTasks[s].m_nBegin = int( int64(nNumPoints) * s / nNumShards );
+		vecTasks[s].m_nEnd = int( int64(nNumPoints) * ( s + 1 ) / nNumShards );
+		vecTasks[s].m_fFullScan = true;
+		vecTaskPtrs[s] = &vecTasks[s];
+	}
+
+	// initial assignment scans all centers
+	if( nNumShards > 1 )
+	{
+		g_TaskPool.Run( vecTaskPtrs );
+	}
+	else
+	{
+		vecTasks[0].Run();
+	}
+	for( int s = 0; s < nNumShards; s++ )
+	{
+		sStats.nDistanceEvals += vecTasks[s].m_nDistanceEvals;
+		vecTasks[s].m_fFullScan = false;
+	}
+	sStats.nNaiveEvals += int64(nNumPoints) * nNumClusters;
+
+	// running sums of the points in each cluster
+	vector<double> vecSums( nNumClusters * nDims, 0.0 );
+	vector<int> vecCounts( nNumClusters, 0 );
+	for( int i = 0; i < nNumPoints; i++ )
+	{
+		const float *pPoint = matData.ptr<float>( i );
+		double *pSum = &vecSums[ vecLabels[i] * nDims ];
+		for( int d = 0; d < nDims; d++ )
+		{
+			pSum[d] += pPoint[d];
+		}
+		vecCounts[ vecLabels[i] ]++;
+	}
+
+	Mat matPrevCenter( 1, nDims, CV_32F );
+	vector<double> vecShift( nNumClusters );
+	vector<int> vecPrevLabels;
+	vector<float> vecCenterDist( nNumClusters );
+	for( int iter = 0; iter < m_nMaxIter; iter++ )
+	{
+		sStats.nIterations++;
+
+		// re-seed empty clusters with the point farthest from its center
+		for( int k = 0; k < nNumClusters; k++ )
+		{
+			if( vecCounts[k] > 0 )
+			{
+				continue;
+			}
+			int nFarthest = -1;
+			for( int i = 0; i < nNumPoints; i++ )
+			{
+				if( vecCounts[ vecLabels[i] ] > 1 && ( nFarthest < 0 || vecUpper[i] > vecUpper[nFarthest] ) )
+				{
+					nFarthest = i;
+				}
+			}
+			if( nFarthest < 0 )
+			{
+				break;
+			}
+			const float *pPoint = matData.ptr<float>( nFarthest );
+			double *pFrom = &vecSums[ vecLabels[nFarthest] * nDims ];
+			double *pTo = &vecSums[ k * nDims ];
+			for( int d = 0; d < nDims; d++ )
+			{
+				pFrom[d] -= pPoint[d];
+				pTo[d] += pPoint[d];
+			}
+			vecCounts[ vecLabels[nFarthest] ]--;
+			vecCounts[k]++;
+			vecLabels[nFarthest] = k;
+			// force an exact distance computation for the moved point
+			vecUpper[nFarthest] = DBL_MAX;
+			vecLower[nFarthest] = 0.0;
+		}
+
+		// move centers to the means of their points, remember how far they moved
+		double dMaxShift = 0.0, dSecondShift = 0.0;
+		int nMaxShift = 0;
+		for( int k = 0; k < nNumClusters; k++ )
+		{
+			float *pCenter = matCenters.ptr<float>( k );
+			matCenters.row( k ).copyTo( matPrevCenter );
+			if( vecCounts[k] > 0 )
+			{
+				const double *pSum = &vecSums[ k * nDims ];
+				for( int d = 0; d < nDims; d++ )
+				{
+					pCenter[d] = float( pSum[d] / vecCounts[k] );
+				}
+			}
+			float fShift;
+			ComputeSquaredL2( matPrevCenter.ptr<float>(), pCenter, 1, nDims, &fShift );
+			vecShift[k] = sqrt( double(fShift) );
+			if( vecShift[k] > dMaxShift )
+			{
+				dSecondShift = dMaxShift;
+				dMaxShift = vecShift[k];
+				nMaxShift = k;
+			}
+			else if( vecShift[k] > dSecondShift )
+			{
+				dSecondShift = vecShift[k];
+			}
+		}
+
+		// converged
+		if( 0.0 == dMaxShift )
+		{
+			break;
+		}
+
+		// loosen the bounds by the center movements
+		for( int i = 0; i < nNumPoints; i++ )
+		{
+			vecUpper[i] += vecShift[ vecLabels[i] ];
+			vecLower[i] -= ( vecLabels[i] == nMaxShift ) ? dSecondShift : dMaxShift;
+		}
+
+		// half distance of each center to its closest other center
+		for( int k = 0; k < nNumClusters; k++ )
+		{
+			ComputeSquaredL2( matCenters.ptr<float>( k ), matCenters.ptr<float>(), nNumClusters, nDims, &vecCenterDist[0] );
+			float fClosest = FLT_MAX;
+			for( int j = 0; j < nNumClusters; j++ )
+			{
+				if( j != k && vecCenterDist[j] < fClosest )
+				{
+					fClosest = vecCenterDist[j];
+				}
+			}
+			vecHalfSeparation[k] = 0.5 * sqrt( double(fClosest) );
+		}
+
+		// assignment step, skipping points whose bounds prove the label unchanged
+		vecPrevLabels = vecLabels;
+		if( nNumShards > 1 )
+		{
+			g_TaskPool.Run( vecTaskPtrs );
+		}
+		else
+		{
+			vecTasks[0].Run();
+		}
+		int nChanged = 0;
+		for( int s = 0; s < nNumShards; s++ )
+		{
+			sStats.nDistanceEvals += vecTasks[s].m_nDistanceEvals;
+			nChanged += vecTasks[s].m_nChanged;
+		}
+		sStats.nNaiveEvals += int64(nNumPoints) * nNumClusters;
+
+		if( 0 == nChanged )
+		{
+			break;
+		}
+
+		// move changed points between the cluster sums
+		for( int i = 0; i < nNumPoints; i++ )
+		{
+			if( vecPrevLabels[i] == vecLabels[i] )
+			{
+				continue;
+			}
+			const float *pPoint = matData.ptr<float>( i );
+			double *pFrom = &vecSums[ vecPrevLabels[i] * nDims ];
+			double *pTo = &vecSums[ vecLabels[i] * nDims ];
+			for( int d = 0; d < nDims; d++ )
+			{
+				pFrom[d] -= pPoint[d];
+				pTo[d] += pPoint[d];
+			}
+			vecCounts[ vecPrevLabels[i] ]--;
+			vecCounts[ vecLabels[i] ]++;
+		}
+
+		// last iteration, leave centers at the means of the final labels
+		if( iter + 1 == m_nMaxIter )
+		{
+			for( int k = 0; k < nNumClusters; k++ )
+			{
+				if( vecCounts[k] > 0 )
+				{
+					float *pCenter = matCenters.ptr<float>( k );
+					const double *pSum = &vecSums[ k * nDims ];
+					for( int d = 0; d < nDims; d++ )
+					{
+						pCenter[d] = float( pSum[d] / vecCounts[k] );
+					}
+				}
+			}
+		}
+	}
+
+	// compactness: sum of squared distances to the assigned centers
+	double dCompactness = 0.0;
+	for( int i = 0; i < nNumPoints; i++ )
+	{
+		float fDistance;
+		ComputeSquaredL2( matData.ptr<float>( i ), matCenters.ptr<float>( vecLabels[i] ), 1, nDims, &fDistance );
+		dCompactness += fDistance;
+	}
+	sStats.nDistanceEvals += nNumPoints;
+	sStats.nNaiveEvals += nNumPoints;
+
+	return dCompactness;
+}
+
+// single mini-batch attempt, returns compactness
+double CKMeans::RunMiniBatch( const cv::Mat &matData, const int nNumClusters,
+	cv::RNG &rng, std::vector<int> &vecLabels, cv::Mat &matCenters,
+	SKMeansStats &sStats ) const
+{
+	const int nNumPoints = matData.rows;
+	const int nDims = matData.cols;
+
+	SeedCenters( matData, nNumClusters, rng, matCenters, sStats );
+
+	// each iteration moves centers towards a random batch, with a per-center learning rate 1/count
+	vector<int> vecCounts( nNumClusters, 0 );
+	vector<int> vecBatch( m_nBatchSize );
+	vector<int> vecBatchLabels( m_nBatchSize );
+	for( int iter = 0; iter < m_nMaxIter; iter++ )
+	{
+		sStats.nIterations++;
+
+		// assign the batch against fixed centers
+		for( int b = 0; b < m_nBatchSize; b++ )
+		{
+			vecBatch[b] = rng.uniform( 0, nNumPoints );
+			vecBatchLabels[b] = FindClosestCenter( matData.ptr<float>( vecBatch[b] ), matCenters.ptr<float>(),
+				nNumClusters, nDims );
+		}
+		sStats.nDistanceEvals += int64(m_nBatchSize) * nNumClusters;
+		sStats.nNaiveEvals += int64(nNumPoints) * nNumClusters;
+
+		// gradient step
+		for( int b = 0; b < m_nBatchSize; b++ )
+		{
+			const float *pPoint = matData.ptr<float>( vecBatch[b] );
+			float *pCenter = matCenters.ptr<float>( vecBatchLabels[b] );
+			float fRate = 1.0f / float( ++vecCounts[ vecBatchLabels[b] ] );
+			for( int d = 0; d < nDims; d++ )
+			{
+				pCenter[d] += fRate * ( pPoint[d] - pCenter[d] );
+			}
+		}
+	}
+
+	// final labels and compactness over all points
+	vecLabels.resize( nNumPoints );
+	double dCompactness = 0.0;
+	for( int i = 0; i < nNumPoints; i++ )
+	{
+		float fDistance;
+		vecLabels[i] = FindClosestCenter( matData.ptr<float>( i ), matCenters.ptr<float>(), nNumClusters, nDims, &fDistance );
+		dCompactness += fDistance;
+	}
+	sStats.nDistanceEvals += int64(nNumPoints) * nNumClusters;
+	sStats.nNaiveEvals += int64(nNumPoints) * nNumClusters;
+
+	return dCompactness;
+}
+
+// cluster rows of CV_32F data, returns compactness
+double CKMeans::Cluster( const cv::Mat &matData, const int nNumClusters,
+	cv::Mat &matLabels, cv::Mat &matCenters, cv::RNG &rng,
+	SKMeansStats *pStats ) const
+{
+	SKMeansStats sStats;
+	sStats.nDistanceEvals = 0;
+	sStats.nNaiveEvals = 0;
+	sStats.nIterations = 0;
+
+	// the kernels need contiguous float rows
+	Mat matPoints;
+	if( CV_32F != matData.type() || !matData.isContinuous() )
+	{
+		matData.convertTo( matPoints, CV_32F );
+	}
+	else
+	{
+		matPoints = matData;
+	}
+
+	// mini-batch updates only pay off when the node has more points than a batch
+	const bool fMiniBatch = ( m_nBatchSize > 0 && matPoints.rows > m_nBatchSize );
+
+	double dBestCompactness = DBL_MAX;
+	vector<int> vecLabels;
+	Mat matAttemptCenters;
+	for( int a = 0; a < MAX( 1, m_nAttempts ); a++ )
+	{
+		double dCompactness = fMiniBatch ?
+			RunMiniBatch( matPoints, nNumClusters, rng, vecLabels, matAttemptCenters, sStats ) :
+			RunAttempt( matPoints, nNumClusters, rng, vecLabels, matAttemptCenters, sStats );
+		if( dCompactness < dBestCompactness )
+		{
+			dBestCompactness = dCompactness;
+			matAttemptCenters.copyTo( matCenters );
+			Mat( vecLabels, true ).copyTo( matLabels );
+		}
+	}
+
+	if( NULL != pStats )
+	{
+		*pStats = sStats;
+	}
+
+	return dBestCompactness;
+}
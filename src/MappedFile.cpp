@@ -0,0 +1,292 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "MappedFile.h"
+
+using namespace std;
+
+// constructor
+CMappedFile::CMappedFile()
+{
+	m_pData = NULL;
+	m_nSize = 0;
+}
+
+// destructor
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
+
+// map file into memory
+int CMappedFile::Open( const std::string &strFileName )
+{
+	Close();
+
+	int fd = open( strFileName.c_str(), O_RDONLY );
+	if( -1 == fd )
+	{
+		return -1;
+	}
+
+	struct stat sStat;
+	if( 0 != fstat( fd, &sStat ) || 0 == sStat.st_size )
+	{
+		close( fd );
+		return -1;
+	}
+
+	// pages are loaded on first access, the mapping stays valid after closing the descriptor
+	void *pData = mmap( NULL, sStat.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if( MAP_FAILED == pData )
+	{
+		return -1;
+	}
+
+	m_pData = pData;
+	m_nSize = sStat.st_size;
+
+	return 0;
+}
+
+// unmap file
+void CMappedFile::Close()
+{
+	if( NULL != m_pData )
+	{
+		munmap( m_pData, m_nSize );
+		m_pData = NULL;
+	}
+	m_nSize = 0;
+}
+
+// whether a file is mapped
+bool CMappedFile::IsOpen() const
+{
+	return ( NULL != m_pData );
+}
+
+// start of the mapped file
+const unsigned char* CMappedFile::GetData() const
+{
+	return (const unsigned char*)m_pData;
+}
+
+// size of the mapped file in bytes
+size_t CMappedFile::GetSize() const
+{
+	return m_nSize;
+}
+
+// 64-bit FNV-1a checksum of a byte range
+uint64 ComputeChecksum( const void *pData, size_t nSize, uint64 nChecksum )
+{
+	const unsigned char *pBytes = (const unsigned char*)pData;
+	for( size_t i = 0; i < nSize; i++ )
+	{
+		nChecksum ^= pBytes[i];
+		nChecksum *= 1099511628211ULL;
+	}
+
+	return nChecksum;
+}
+
+// write a block at the current file position and extend the checksum
+int WriteBlock( FILE *pFile, const void *pData, const size_t nSize, int64 &nPos, uint64 &nChecksum )
+{
+	if( nSize > 0 && 1 != fwrite( pData, nSize, 1, pFile ) )
+	{
+		return -1;
+	}
+	nChecksum = ComputeChecksum( pData, nSize, nChecksum );
+	nPos += nSize;
+
+	return 0;
+}
+
+// pad with zeros up to the given file position
+int WritePadding( FILE *pFile, const int64 nEndPos, int64 &nPos, uint64 &nChecksum )
+{
+	static const char szZeros[64] = { 0 };
+
+	return WriteBlock( pFile, szZeros, size_t( nEndPos - nPos ), nPos, nChecksum );
+}
+
+// open a temporary file next to the destination, mappings of the destination stay valid while it is written
+FILE* CreateReplacementFile( const std::string &strFileName )
+{
+	return fopen( ( strFileName + ".tmp" ).c_str(), "wb" );
+}
+
+// close the temporary file and move it over the destination (the temporary file is removed on error)
+int CommitReplacementFile( FILE *pFile, const std::string &strFileName, int error )
+{
+	if( 0 != fclose( pFile ) )
+	{
+		error = -1;
+	}
+
+	// a mapping of the replaced file keeps its pages, rename does not truncate it
+	const string strTempName = strFileName + ".tmp";
+	if( 0 == error && 0 != rename( strTempName.c_str(), strFileName.c_str() ) )
+	{
+		error = -1;
+	}
+	if( 0 != error )
+	{
+		remove( strTempName.c_str() );
+	}
+
+	return error;
+}
+
+// save a header followed by the arrays of a table, sets the array positions, file size and checksum fields of the header
+int SaveTableFile( const std::string &strFileName, void *pHeader, const size_t nHeaderSize,
+	std::vector<STableArray> &vecArrays, int64 &nFileSize, uint64 &nChecksum )
+{
+	// array positions, every array is aligned to its element size
+	int64 nEndPos = nHeaderSize;
+	for( vector<STableArray>::iterator it = vecArrays.begin(); it != vecArrays.end(); it++ )
+	{
+		nEndPos = ( nEndPos + it->nElemSize - 1 ) / it->nElemSize * it->nElemSize;
+		*it->pPos = nEndPos;
+		nEndPos += it->nNumElems * it->nElemSize;
+	}
+	nFileSize = nEndPos;
+	nChecksum = 0;
+
+	FILE *pFile = CreateReplacementFile( strFileName );
+	if( NULL == pFile )
+	{
+		return -1;
+	}
+
+	// header is rewritten with the checksum once the arrays are written
+	int64 nPos = 0;
+	uint64 nArrayChecksum = ComputeChecksum( NULL, 0 );
+	int error = 0;
+	if( 1 != fwrite( pHeader, nHeaderSize, 1, pFile ) )
+	{
+		error = -1;
+	}
+	nPos += nHeaderSize;
+	for( vector<STableArray>::const_iterator it = vecArrays.begin(); it != vecArrays.end() && 0 == error; it++ )
+	{
+		error = WritePadding( pFile, *it->pPos, nPos, nArrayChecksum )
+			|| WriteBlock( pFile, it->pData, it->nNumElems * it->nElemSize, nPos, nArrayChecksum ) ? -1 : 0;
+	}
+	if( 0 == error )
+	{
+		nChecksum = nArrayChecksum;
+		if( 0 != fseek( pFile, 0, SEEK_SET ) || 1 != fwrite( pHeader, nHeaderSize, 1, pFile ) )
+		{
+			error = -1;
+		}
+	}
+
+	return CommitReplacementFile( pFile, strFileName, error );
+}
+
+// map a table file and copy its header, headers start with an 8 byte magic followed by an int version
+int MapTableFile( CMappedFile &cMappedFile, const std::string &strFileName, void *pHeader, const size_t nHeaderSize,
+	const char *pMagic, const int nVersion )
+{
+	if( 0 != cMappedFile.Open( strFileName ) || cMappedFile.GetSize() < nHeaderSize )
+	{
+		cMappedFile.Close();
+		return -1;
+	}
+
+	// the mapping is only page aligned for the header, fields are read from a copy
+	memcpy( pHeader, cMappedFile.GetData(), nHeaderSize );
+	int nFileVersion = 0;
+	memcpy( &nFileVersion, (const char*)pHeader + 8, sizeof(int) );
+	if( 0 != memcmp( pHeader, pMagic, 8 ) || nVersion != nFileVersion )
+	{
+		cMappedFile.Close();
+		return -1;
+	}
+
+	return 0;
+}
+
+// check the array positions against the file size, verify the checksum and point the arrays into the mapping
+int BindTableArrays( const CMappedFile &cMappedFile, const size_t nHeaderSize, const int64 nFileSize,
+	const uint64 nChecksum, std::vector<STableArray> &vecArrays, const bool fVerifyChecksum )
+{
+	if( nFileSize != (int64)cMappedFile.GetSize() )
+	{
+		return -1;
+	}
+
+	// arrays follow each other without overlapping and end inside the file
+	int64 nEndPos = nHeaderSize;
+	for( vector<STableArray>::const_iterator it = vecArrays.begin(); it != vecArrays.end(); it++ )
+	{
+		const int64 nPos = *it->pPos;
+		if( nPos < nEndPos || nPos > nFileSize || 0 != nPos % it->nElemSize
+			|| it->nNumElems < 0 || it->nNumElems > ( nFileSize - nPos ) / (int64)it->nElemSize )
+		{
+			return -1;
+		}
+		nEndPos = nPos + it->nNumElems * it->nElemSize;
+	}
+
+	const unsigned char *pData = cMappedFile.GetData();
+	if( fVerifyChecksum && nChecksum != ComputeChecksum( pData + nHeaderSize, nFileSize - nHeaderSize ) )
+	{
+		return -1;
+	}
+
+	// arrays are used directly from the mapping, pages are loaded on demand
+	for( vector<STableArray>::iterator it = vecArrays.begin(); it != vecArrays.end(); it++ )
+	{
+		it->pData = pData + *it->pPos;
+	}
+
+	return 0;
+}
+
+// check that compressed sparse row offsets start at 0, do not decrease and end at the number of entries
+int CheckRowOffsets( const int64 *pRowOffsets, const int64 nNumRows, const int64 nNumEntries )
+{
+	if( 0 != pRowOffsets[0] || nNumEntries != pRowOffsets[nNumRows] )
+	{
+		return -1;
+	}
+	for( int64 i = 0; i < nNumRows; i++ )
+	{
+		if( pRowOffsets[i] > pRowOffsets[i + 1] )
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include "Common.h"
+#include "MatcherCache.h"
+
+using namespace std;
+using namespace cv;
+
+// index parameters of the shared FLANN matcher (4 randomized kd-trees)
+static const int MATCHER_INDEX_TREES = 4;
+
+// constructor
+CMatcherCache::CMatcherCache( const int64 nBudget )
+{
+	m_nBudget = nBudget;
+	m_nResident = 0;
+	m_nNumHits = 0;
+	m_nNumMisses = 0;
+	m_nNumEvictions = 0;
+	pthread_mutex_init( &m_mutex, NULL );
+}
+
+// destructor
+CMatcherCache::~CMatcherCache()
+{
+	Clear();
+	pthread_mutex_destroy( &m_mutex );
+}
+
+// set bytes of cached indices before eviction (0 disables caching)
+void CMatcherCache::SetBudget( const int64 nBudget )
+{
+	pthread_mutex_lock( &m_mutex );
+	m_nBudget = nBudget;
+	Evict();
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// drop least recently used indices over the budget (requires lock)
+void CMatcherCache::Evict()
+{
+	while( m_nResident > m_nBudget && !m_lstEntries.empty() )
+	{
+		m_nResident -= m_lstEntries.back().second->nBytes;
+		m_mapEntries.erase( m_lstEntries.back().first );
+		m_lstEntries.pop_back();
+		m_nNumEvictions++;
+	}
+}
+
+// cached index of an image, built from its descriptors on a miss
+cv::Ptr<SMatcherIndex> CMatcherCache::Acquire( const int nImageIdx, const cv::Mat &matDescriptors )
+{
+	pthread_mutex_lock( &m_mutex );
+	map<int, CEntryList::iterator>::iterator itMap = m_mapEntries.find( nImageIdx );
+	if( itMap != m_mapEntries.end() )
+	{
+		m_lstEntries.splice( m_lstEntries.begin(), m_lstEntries, itMap->second );
+		Ptr<SMatcherIndex> pIndex = itMap->second->second;
+		m_nNumHits++;
+		pthread_mutex_unlock( &m_mutex );
+		return pIndex;
+	}
+	m_nNumMisses++;
+	pthread_mutex_unlock( &m_mutex );
+
+	// nothing to index for an image without descriptors
+	if( matDescriptors.empty() )
+	{
+		return Ptr<SMatcherIndex>();
+	}
+
+	// build outside the lock, the index keeps its own copy of the descriptors
+	Ptr<SMatcherIndex> pIndex( new SMatcherIndex );
+	pIndex->matDescriptors = matDescriptors.clone();
+	pIndex->cIndex.build( pIndex->matDescriptors, flann::KDTreeIndexParams( MATCHER_INDEX_TREES ) );
+	// tree nodes are estimated at the size of the descriptors
+	pIndex->nBytes = 2 * pIndex->matDescriptors.total() * pIndex->matDescriptors.elemSize();
+
+	pthread_mutex_lock( &m_mutex );
+	itMap = m_mapEntries.find( nImageIdx );
+	if( itMap != m_mapEntries.end() )
+	{
+		// another thread built the same index meanwhile, keep the cached one
+		pIndex = itMap->second->second;
+	}
+	else if( (int64)pIndex->nBytes <= m_nBudget )
+	{
+		m_lstEntries.push_front( make_pair( nImageIdx, pIndex ) );
+		m_mapEntries[nImageIdx] = m_lstEntries.begin();
+		m_nResident += pIndex->nBytes;
+		Evict();
+	}
+	pthread_mutex_unlock( &m_mutex );
+
+	return pIndex;
+}
+
+// drop all cached indices
+void CMatcherCache::Clear()
+{
+	pthread_mutex_lock( &m_mutex );
+	m_lstEntries.clear();
+	m_mapEntries.clear();
+	m_nResident = 0;
+	m_nNumHits = 0;
+	m_nNumMisses = 0;
+	m_nNumEvictions = 0;
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// log hit, miss and eviction counters
+void CMatcherCache::LogStats() const
+{
+	pthread_mutex_lock( &m_mutex );
+	LogData( "Matcher cache: %d indices, %lld of %lld bytes, hits %lld, misses %lld, evictions %lld\n",
+		(int)m_mapEntries.size(), (long long)m_nResident, (long long)m_nBudget,
+		(long long)m_nNumHits, (long long)m_nNumMisses, (long long)m_nNumEvictions );
+	pthread_mutex_unlock( &m_mutex );
+}
@@ -0,0 +1,351 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <math.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "PostingList.h"
+
+using namespace std;
+
+// number of postings per compressed block
+const int POSTING_BLOCK_SIZE = 128;
+
+// zero bytes kept after the last block, so gaps can be read with unaligned 64-bit loads
+static const int DATA_PADDING = 8;
+
+// read the packed value starting at a constant bit offset
+template<int BITPOS>
+static inline unsigned int ReadBits( const unsigned char *pData )
+{
+	unsigned long long nBits;
+	memcpy( &nBits, pData + ( BITPOS >> 3 ), sizeof(nBits) );
+	return (unsigned int)( nBits >> ( BITPOS & 7 ) );
+}
+
+// unpack gaps of a fixed bit width, a group of 8 gaps spans exactly BITS bytes so all shifts are constants
+template<int BITS>
+static void UnpackGaps( const unsigned char *pData, const int nNumGaps, unsigned int *pGaps )
+{
+	const unsigned int nMask = (unsigned int)( ( 1ULL << BITS ) - 1 );
+	int i = 0;
+	for( ; i + 8 <= nNumGaps; i += 8, pData += BITS )
+	{
+		pGaps[i] = ReadBits<0>( pData ) & nMask;
+		pGaps[i + 1] = ReadBits<BITS>( pData ) & nMask;
+		pGaps[i + 2] = ReadBits<2 * BITS>( pData ) & nMask;
+		pGaps[i + 3] = ReadBits<3 * BITS>( pData ) & nMask;
+		pGaps[i + 4] = ReadBits<4 * BITS>( pData ) & nMask;
+		pGaps[i + 5] = ReadBits<5 * BITS>( pData ) & nMask;
+		pGaps[i + 6] = ReadBits<6 * BITS>( pData ) & nMask;
+		pGaps[i + 7] = ReadBits<7 * BITS>( pData ) & nMask;
+	}
+
+	// last partial group
+	for( int nBitPos = 0; i < nNumGaps; i++, nBitPos += BITS )
+	{
+		unsigned long long nBits;
+		memcpy( &nBits, pData + ( nBitPos >> 3 ), sizeof(nBits) );
+		pGaps[i] = (unsigned int)( nBits >> ( nBitPos & 7 ) ) & nMask;
+	}
+}
+
+// gap unpacking routine for every bit width
+typedef void (*PFN_UNPACK_GAPS)( const unsigned char *pData, const int nNumGaps, unsigned int *pGaps );
+static const PFN_UNPACK_GAPS s_apfnUnpackGaps[33] = { UnpackGaps<1>,
+	UnpackGaps<1>, UnpackGaps<2>, UnpackGaps<3>, UnpackGaps<4>, UnpackGaps<5>, UnpackGaps<6>, UnpackGaps<7>, UnpackGaps<8>,
+	UnpackGaps<9>, UnpackGaps<10>, UnpackGaps<11>, UnpackGaps<12>, UnpackGaps<13>, UnpackGaps<14>, UnpackGaps<15>, UnpackGaps<16>,
+	UnpackGaps<17>, UnpackGaps<18>, UnpackGaps<19>, UnpackGaps<20>, UnpackGaps<21>, UnpackGaps<22>, UnpackGaps<23>, UnpackGaps<24>,
+	UnpackGaps<25>, UnpackGaps<26>, UnpackGaps<27>, UnpackGaps<28>, UnpackGaps<29>, UnpackGaps<30>, UnpackGaps<31>, UnpackGaps<32> };
+
+// constructor
+CPostingList::CPostingList()
+{
+	Clear();
+}
+
+// remove all postings
+void CPostingList::Clear()
+{
+	m_nNumPostings = 0;
+	m_fMaxWeight = 0.0f;
+	m_vecBlocks.clear();
+	m_vecData.clear();
+	m_vecTailImageIdx.clear();
+	m_vecTailWeights.clear();
+}
+
+// append posting
+int CPostingList::Append( const int nImageIdx, const float fWeight )
+{
+	// a compacted partial block is reopened
+	if( m_vecTailImageIdx.empty() && !m_vecBlocks.empty() && GetBlockSize( m_vecBlocks.size() - 1 ) < POSTING_BLOCK_SIZE )
+	{
+		// decode while the tail is still empty, the block size is derived from the tail size
+		int nBlock = m_vecBlocks.size() - 1;
+		vector<int> vecImageIdx( POSTING_BLOCK_SIZE );
+		vector<float> vecWeights( POSTING_BLOCK_SIZE );
+		int nCount = DecodeBlock( nBlock, &vecImageIdx[0], &vecWeights[0] );
+		m_vecTailImageIdx.assign( vecImageIdx.begin(), vecImageIdx.begin() + nCount );
+		m_vecTailWeights.assign( vecWeights.begin(), vecWeights.begin() + nCount );
+		m_vecData.resize( m_vecBlocks[nBlock].nDataOffset + DATA_PADDING, 0 );
+		m_vecBlocks.pop_back();
+	}
+
+	int nLastImageIdx = !m_vecTailImageIdx.empty() ? m_vecTailImageIdx.back()
+		: ( !m_vecBlocks.empty() ? m_vecBlocks.back().nLastImageIdx : -1 );
+	if( nImageIdx <= nLastImageIdx || !( fWeight > 0.0f ) )
+	{
+		return -1;
+	}
+
+	m_vecTailImageIdx.push_back( nImageIdx );
+	m_vecTailWeights.push_back( fWeight );
+	m_nNumPostings++;
+	if( fWeight > m_fMaxWeight )
+	{
+		m_fMaxWeight = fWeight;
+	}
+
+	if( POSTING_BLOCK_SIZE == (int)m_vecTailImageIdx.size() )
+	{
+		CompressTail();
+	}
+
+	return 0;
+}
+
+// encode the partial block
+void CPostingList::CompressTail()
+{
+	const int nCount = m_vecTailImageIdx.size();
+	if( 0 == nCount )
+	{
+		return;
+	}
+
+	// new block replaces the padding
+	if( !m_vecData.empty() )
+	{
+		m_vecData.resize( m_vecData.size() - DATA_PADDING );
+	}
+
+	SPostingBlock sBlock;
+	sBlock.nFirstImageIdx = m_vecTailImageIdx.front();
+	sBlock.nLastImageIdx = m_vecTailImageIdx.back();
+	sBlock.nDataOffset = m_vecData.size();
+	sBlock.fMaxWeight = 0.0f;
+	for( int i = 0; i < nCount; i++ )
+	{
+		if( m_vecTailWeights[i] > sBlock.fMaxWeight )
+		{
+			sBlock.fMaxWeight = m_vecTailWeights[i];
+		}
+	}
+
+	// weights relative to the block maximum, never rounded to zero so every posting keeps a positive score
+	for( int i = 0; i < nCount; i++ )
+	{
+		int nLevel = (int)floor( 255.0f * m_vecTailWeights[i] / sBlock.fMaxWeight + 0.5f );
+		m_vecData.push_back( (unsigned char)( nLevel < 1 ? 1 : nLevel ) );
+	}
+
+	// gaps to the previous image index, bit packed with the width of the largest gap
+	unsigned int nMaxGap = 0;
+	for( int i = 1; i < nCount; i++ )
+	{
+		nMaxGap |= (unsigned int)( m_vecTailImageIdx[i] - m_vecTailImageIdx[i - 1] );
+	}
+	int nGapBits = 1;
+	while( nGapBits < 32 && ( nMaxGap >> nGapBits ) )
+	{
+		nGapBits++;
+	}
+	m_vecData.push_back( (unsigned char)nGapBits );
+
+	unsigned long long nBitBuffer = 0;
+	int nBufferedBits = 0;
+	for( int i = 1; i < nCount; i++ )
+	{
+		nBitBuffer |= (unsigned long long)( m_vecTailImageIdx[i] - m_vecTailImageIdx[i - 1] ) << nBufferedBits;
+		nBufferedBits += nGapBits;
+		while( nBufferedBits >= 8 )
+		{
+			m_vecData.push_back( (unsigned char)nBitBuffer );
+			nBitBuffer >>= 8;
+			nBufferedBits -= 8;
+		}
+	}
+	if( nBufferedBits > 0 )
+	{
+		m_vecData.push_back( (unsigned char)nBitBuffer );
+	}
+	m_vecData.resize( m_vecData.size() + DATA_PADDING, 0 );
+
+	m_vecBlocks.push_back( sBlock );
+
+	// release the raw buffers, most lists never fill another block
+	vector<int>().swap( m_vecTailImageIdx );
+	vector<float>().swap( m_vecTailWeights );
+}
+
+// encode the partial block and release unused capacity after bulk appending
+void CPostingList::Compact()
+{
+	CompressTail();
+	vector<SPostingBlock>( m_vecBlocks ).swap( m_vecBlocks );
+	vector<unsigned char>( m_vecData ).swap( m_vecData );
+}
+
+// number of postings in a block
+int CPostingList::GetBlockSize( const int nBlock ) const
+{
+	if( nBlock < (int)m_vecBlocks.size() - 1 )
+	{
+		return POSTING_BLOCK_SIZE;
+	}
+	if( nBlock == (int)m_vecBlocks.size() - 1 )
+	{
+		return m_nNumPostings - m_vecTailImageIdx.size() - nBlock * POSTING_BLOCK_SIZE;
+	}
+
+	return m_vecTailImageIdx.size();
+}
+
+// total number of postings
+int CPostingList::GetNumPostings() const
+{
+	return m_nNumPostings;
+}
+
+// number of blocks including the raw partial block
+int CPostingList::GetNumBlocks() const
+{
+	return m_vecBlocks.size() + ( m_vecTailImageIdx.empty() ? 0 : 1 );
+}
+
+// largest weight in the list
+float CPostingList::GetMaxWeight() const
+{
+	return m_fMaxWeight;
+}
+
+// last image index of a block
+int CPostingList::GetBlockLastImageIdx( const int nBlock ) const
+{
+	if( nBlock < (int)m_vecBlocks.size() )
+	{
+		return m_vecBlocks[nBlock].nLastImageIdx;
+	}
+
+	return m_vecTailImageIdx.back();
+}
+
+// largest weight of a block
+float CPostingList::GetBlockMaxWeight( const int nBlock ) const
+{
+	if( nBlock < (int)m_vecBlocks.size() )
+	{
+		return m_vecBlocks[nBlock].fMaxWeight;
+	}
+
+	float fMaxWeight = 0.0f;
+	for( unsigned int i = 0; i < m_vecTailWeights.size(); i++ )
+	{
+		if( m_vecTailWeights[i] > fMaxWeight )
+		{
+			fMaxWeight = m_vecTailWeights[i];
+		}
+	}
+
+	return fMaxWeight;
+}
+
+// decode a block into POSTING_BLOCK_SIZE sized buffers, returns number of postings
+int CPostingList::DecodeBlock( const int nBlock, int *pImageIdx, float *pWeight ) const
+{
+	const int nCount = GetBlockSize( nBlock );
+
+	// raw partial block
+	if( nBlock >= (int)m_vecBlocks.size() )
+	{
+		for( int i = 0; i < nCount; i++ )
+		{
+			pImageIdx[i] = m_vecTailImageIdx[i];
+			pWeight[i] = m_vecTailWeights[i];
+		}
+		return nCount;
+	}
+
+	const SPostingBlock &sBlock = m_vecBlocks[nBlock];
+	const unsigned char *pData = &m_vecData[sBlock.nDataOffset];
+
+	// weights from the 8 bit levels
+	const float fScale = sBlock.fMaxWeight / 255.0f;
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128 vScale = _mm_set1_ps( fScale );
+	const __m128i vZero = _mm_setzero_si128();
+	for( ; i + 16 <= nCount; i += 16 )
+	{
+		__m128i vLevels = _mm_loadu_si128( (const __m128i*)( pData + i ) );
+		__m128i vLow = _mm_unpacklo_epi8( vLevels, vZero );
+		__m128i vHigh = _mm_unpackhi_epi8( vLevels, vZero );
+		_mm_storeu_ps( pWeight + i, _mm_mul_ps( vScale, _mm_cvtepi32_ps( _mm_unpacklo_epi16( vLow, vZero ) ) ) );
+		_mm_storeu_ps( pWeight + i + 4, _mm_mul_ps( vScale, _mm_cvtepi32_ps( _mm_unpackhi_epi16( vLow, vZero ) ) ) );
+		_mm_storeu_ps( pWeight + i + 8, _mm_mul_ps( vScale, _mm_cvtepi32_ps( _mm_unpacklo_epi16( vHigh, vZero ) ) ) );
+		_mm_storeu_ps( pWeight + i + 12, _mm_mul_ps( vScale, _mm_cvtepi32_ps( _mm_unpackhi_epi16( vHigh, vZero ) ) ) );
+	}
+#endif
+	for( ; i < nCount; i++ )
+	{
+		pWeight[i] = fScale * pData[i];
+	}
+	pData += nCount;
+
+	// image indices from the bit packed gaps
+	unsigned int anGaps[POSTING_BLOCK_SIZE];
+	const int nGapBits = *pData++;
+	s_apfnUnpackGaps[nGapBits]( pData, nCount - 1, anGaps );
+	int nImageIdx = sBlock.nFirstImageIdx;
+	pImageIdx[0] = nImageIdx;
+	for( i = 1; i < nCount; i++ )
+	{
+		nImageIdx += anGaps[i - 1];
+		pImageIdx[i] = nImageIdx;
+	}
+
+	return nCount;
+}
+
+// bytes used by the encoded list
+size_t CPostingList::GetMemoryUsage() const
+{
+	return sizeof(CPostingList)
+		+ m_vecBlocks.capacity() * sizeof(SPostingBlock)
+		+ m_vecData.capacity()
+		+ m_vecTailImageIdx.capacity() * sizeof(int)
+		+ m_vecTailWeights.capacity() * sizeof(float);
+}
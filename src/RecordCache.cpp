@@ -0,0 +1,215 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include "Common.h"
+#include "RecordCache.h"
+
+using namespace std;
+
+// constructor
+CRecordCache::CRecordCache( const int64 nBudget )
+{
+	m_nBudget = nBudget;
+	m_nResident = 0;
+	m_nNumHits = 0;
+	m_nNumMisses = 0;
+	m_nNumEvictions = 0;
+	pthread_mutex_init( &m_mutex, NULL );
+	pthread_cond_init( &m_condLoaded, NULL );
+}
+
+// destructor
+CRecordCache::~CRecordCache()
+{
+	pthread_cond_destroy( &m_condLoaded );
+	pthread_mutex_destroy( &m_mutex );
+}
+
+// set bytes of resident records before eviction (0 keeps every loaded record)
+void CRecordCache::SetBudget( const int64 nBudget )
+{
+	pthread_mutex_lock( &m_mutex );
+	m_nBudget = nBudget;
+	Evict();
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// drop least recently used unpinned records over the budget (requires lock)
+void CRecordCache::Evict()
+{
+	if( m_nBudget <= 0 )
+	{
+		return;
+	}
+
+	CEntryList::iterator it = m_lstEntries.end();
+	while( m_nResident > m_nBudget && it != m_lstEntries.begin() )
+	{
+		--it;
+		if( it->nNumPins > 0 || it->fLoading )
+		{
+			continue;
+		}
+
+		it->pImageData->ReleaseRecord();
+		m_nResident -= it->nBytes;
+		m_mapEntries.erase( it->pImageData );
+		it = m_lstEntries.erase( it );
+		m_nNumEvictions++;
+	}
+}
+
+// load the record on first access and pin it until released
+int CRecordCache::Acquire( CImageData *pImageData, const bool fLoadFrame )
+{
+	pthread_mutex_lock( &m_mutex );
+
+	// wait while another thread loads the record
+	map<const CImageData*, CEntryList::iterator>::iterator itMap = m_mapEntries.find( pImageData );
+	while( itMap != m_mapEntries.end() && itMap->second->fLoading )
+	{
+		pthread_cond_wait( &m_condLoaded, &m_mutex );
+		itMap = m_mapEntries.find( pImageData );
+	}
+
+	CEntryList::iterator itEntry;
+	if( itMap == m_mapEntries.end() )
+	{
+		// records loaded outside the cache (eager loading, freshly added images) are used as they are
+		if( pImageData->IsRecordLoaded() && ( !fLoadFrame || pImageData->IsImageValid() ) )
+		{
+			m_nNumHits++;
+			pthread_mutex_unlock( &m_mutex );
+			return 0;
+		}
+
+		SCacheEntry sEntry;
+		sEntry.pImageData = pImageData;
+		sEntry.nBytes = 0;
+		sEntry.nNumPins = 1;
+		sEntry.fFrame = false;
+		sEntry.fLoading = true;
+		m_lstEntries.push_front( sEntry );
+		itEntry = m_lstEntries.begin();
+		m_mapEntries[pImageData] = itEntry;
+	}
+	else
+	{
+		itEntry = itMap->second;
+		m_lstEntries.splice( m_lstEntries.begin(), m_lstEntries, itEntry );
+		itEntry->nNumPins++;
+		if( !fLoadFrame || itEntry->fFrame )
+		{
+			m_nNumHits++;
+			pthread_mutex_unlock( &m_mutex );
+			return 0;
+		}
+		itEntry->fLoading = true;
+	}
+	m_nNumMisses++;
+	pthread_mutex_unlock( &m_mutex );
+
+	// load outside the lock, other records stay accessible meanwhile
+	int nError = 0;
+	if( !pImageData->IsRecordLoaded() )
+	{
+		nError = pImageData->LoadDescriptorRecord();
+	}
+	if( 0 == nError && fLoadFrame )
+	{
+		nError = pImageData->LoadImageFrame();
+	}
+
+	pthread_mutex_lock( &m_mutex );
+	itEntry->fLoading = false;
+	m_nResident -= itEntry->nBytes;
+	if( 0 != nError && 1 == itEntry->nNumPins )
+	{
+		// nobody else uses the record, forget it
+		pImageData->ReleaseRecord();
+		m_mapEntries.erase( pImageData );
+		m_lstEntries.erase( itEntry );
+	}
+	else
+	{
+		if( 0 != nError )
+		{
+			itEntry->nNumPins--;
+		}
+		else
+		{
+			itEntry->fFrame = fLoadFrame || itEntry->fFrame;
+		}
+		itEntry->nBytes = pImageData->GetMemoryUsage();
+		m_nResident += itEntry->nBytes;
+	}
+	Evict();
+	pthread_cond_broadcast( &m_condLoaded );
+	pthread_mutex_unlock( &m_mutex );
+
+	return nError;
+}
+
+// unpin a record acquired before
+void CRecordCache::Release( CImageData *pImageData )
+{
+	pthread_mutex_lock( &m_mutex );
+	map<const CImageData*, CEntryList::iterator>::iterator itMap = m_mapEntries.find( pImageData );
+	if( itMap != m_mapEntries.end() && itMap->second->nNumPins > 0 )
+	{
+		itMap->second->nNumPins--;
+		Evict();
+	}
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// drop all resident records (none may be pinned)
+void CRecordCache::Clear()
+{
+	pthread_mutex_lock( &m_mutex );
+	for( CEntryList::iterator it = m_lstEntries.begin(); it != m_lstEntries.end(); it++ )
+	{
+		it->pImageData->ReleaseRecord();
+	}
+	m_lstEntries.clear();
+	m_mapEntries.clear();
+	m_nResident = 0;
+	m_nNumHits = 0;
+	m_nNumMisses = 0;
+	m_nNumEvictions = 0;
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// bytes held by resident records
+int64 CRecordCache::GetResidentBytes() const
+{
+	return m_nResident;
+}
+
+// log hit, miss and eviction counters
+void CRecordCache::LogStats() const
+{
+	LogData( "Record cache: %d records, %lld of %lld bytes, hits %lld, misses %lld, evictions %lld\n",
+		(int)m_mapEntries.size(), (long long)m_nResident, (long long)m_nBudget,
+		(long long)m_nNumHits, (long long)m_nNumMisses, (long long)m_nNumEvictions );
+}
@@ -0,0 +1,421 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <string.h>
+#include <sys/stat.h>
+#include "Common.h"
+#include "RecordStore.h"
+
+using namespace std;
+
+// header of the index file, followed by one entry per image index
+struct SRecordIndexHeader
+{
+	char				szMagic[8];			// INDEX_MAGIC
+	int					nVersion;			// INDEX_VERSION
+	int					nNumRecords;		// number of entries
+	int					nNumSegments;		// number of segment files
+	int					nReserved;			// zero
+	uint64				nChecksum;			// checksum of the entries
+};
+
+static const char INDEX_MAGIC[8] = { 'R', 'E', 'C', 'I', 'N', 'D', 'E', 'X' };
+static const int INDEX_VERSION = 1;
+
+// segments are closed once they reach this size
+static const int64 SEGMENT_MAX_SIZE = int64( 1 ) << 30;
+// alignment of records in the segments
+static const int64 SEGMENT_ALIGNMENT = 16;
+
+// constructor
+CRecordStore::CRecordStore()
+{
+	m_pAppendFile = NULL;
+	m_nAppendSegment = 0;
+	m_nAppendPos = 0;
+	m_fModified = false;
+	pthread_mutex_init( &m_mutex, NULL );
+}
+
+// destructor
+CRecordStore::~CRecordStore()
+{
+	Close();
+	pthread_mutex_destroy( &m_mutex );
+}
+
+// name of a segment file
+std::string CRecordStore::GetSegmentFileName( const int nSegment ) const
+{
+	char szSegment[16];
+	sprintf( szSegment, "_%04d", nSegment );
+
+	return m_strFilePrefix + szSegment + BINARY_FORMAT;
+}
+
+// start an empty store, existing files are replaced
+int CRecordStore::Create( const std::string &strFilePrefix )
+{
+	Close();
+
+	m_strFilePrefix = strFilePrefix;
+	m_nAppendSegment = 0;
+	m_nAppendPos = 0;
+	m_pAppendFile = fopen( GetSegmentFileName( 0 ).c_str(), "wb" );
+	if( NULL == m_pAppendFile )
+	{
+		m_strFilePrefix.clear();
+		return -1;
+	}
+
+	// an empty index marks the store as present
+	m_fModified = true;
+	if( 0 != Flush() )
+	{
+		Close();
+		return -1;
+	}
+
+	return 0;
+}
+
+// load the index and map the segments, appends continue the last segment
+int CRecordStore::Open( const std::string &strFilePrefix )
+{
+	Close();
+
+	FILE *pFile = fopen( ( strFilePrefix + BINARY_FORMAT ).c_str(), "rb" );
+	if( NULL == pFile )
+	{
+		return -1;
+	}
+
+	SRecordIndexHeader sHeader;
+	int error = ( 1 == fread( &sHeader, sizeof(sHeader), 1, pFile ) ) ? 0 : -1;
+	if( 0 == error && ( 0 != memcmp( sHeader.szMagic, INDEX_MAGIC, sizeof(INDEX_MAGIC) )
+		|| INDEX_VERSION != sHeader.nVersion || sHeader.nNumRecords < 0 || sHeader.nNumSegments < 1 ) )
+	{
+		error = -1;
+	}
+	if( 0 == error )
+	{
+		m_vecEntries.resize( sHeader.nNumRecords );
+		if( sHeader.nNumRecords > 0
+			&& 1 != fread( &m_vecEntries[0], sHeader.nNumRecords * sizeof(SRecordIndexEntry), 1, pFile ) )
+		{
+			error = -1;
+		}
+	}
+	fclose( pFile );
+	if( 0 == error && sHeader.nChecksum != ComputeChecksum( m_vecEntries.empty() ? NULL : &m_vecEntries[0],
+		m_vecEntries.size() * sizeof(SRecordIndexEntry) ) )
+	{
+		error = -1;
+	}
+	if( 0 != error )
+	{
+		m_vecEntries.clear();
+		return -1;
+	}
+
+	// appends continue at the end of the last segment, which is only opened for writing by the first append,
+	// so stores of read-only databases open as well
+	m_strFilePrefix = strFilePrefix;
+	m_nAppendSegment = sHeader.nNumSegments - 1;
+	struct stat sStat;
+	if( 0 != stat( GetSegmentFileName( m_nAppendSegment ).c_str(), &sStat ) )
+	{
+		Close();
+		return -1;
+	}
+	m_nAppendPos = sStat.st_size;
+	m_fModified = false;
+
+	if( 0 != MapSegments() )
+	{
+		Close();
+		return -1;
+	}
+
+	return 0;
+}
+
+// write the index if modified and release the files
+void CRecordStore::Close()
+{
+	if( m_fModified && NULL != m_pAppendFile )
+	{
+		fflush( m_pAppendFile );
+		WriteIndex();
+	}
+	if( NULL != m_pAppendFile )
+	{
+		fclose( m_pAppendFile );
+		m_pAppendFile = NULL;
+	}
+	for( unsigned int i = 0; i < m_vecSegments.size(); i++ )
+	{
+		delete m_vecSegments[i];
+	}
+	m_vecSegments.clear();
+	for( unsigned int i = 0; i < m_vecRetiredSegments.size(); i++ )
+	{
+		delete m_vecRetiredSegments[i];
+	}
+	m_vecRetiredSegments.clear();
+	m_vecEntries.clear();
+	m_strFilePrefix.clear();
+	m_nAppendSegment = 0;
+	m_nAppendPos = 0;
+	m_fModified = false;
+}
+
+// whether a store is open
+bool CRecordStore::IsOpen() const
+{
+	return !m_strFilePrefix.empty();
+}
+
+// append the record of an image, replaces an earlier one
+int CRecordStore::Append( const int nRecordIdx, const unsigned char *pRecord, const size_t nRecordSize,
+	const unsigned char *pImage, const size_t nImageSize )
+{
+	static const char szZeros[SEGMENT_ALIGNMENT] = { 0 };
+
+	if( nRecordIdx < 0 )
+	{
+		return -1;
+	}
+
+	pthread_mutex_lock( &m_mutex );
+	if( NULL == m_pAppendFile && !m_strFilePrefix.empty() )
+	{
+		m_pAppendFile = fopen( GetSegmentFileName( m_nAppendSegment ).c_str(), "ab" );
+	}
+	if( NULL == m_pAppendFile )
+	{
+		pthread_mutex_unlock( &m_mutex );
+		return -1;
+	}
+
+	// full segments are left behind, a record larger than a segment gets a segment of its own
+	const int64 nAlignedRecordSize = ( nRecordSize + SEGMENT_ALIGNMENT - 1 ) / SEGMENT_ALIGNMENT * SEGMENT_ALIGNMENT;
+	if( m_nAppendPos > 0 && m_nAppendPos + nAlignedRecordSize + (int64)nImageSize > SEGMENT_MAX_SIZE )
+	{
+		FILE *pFile = fopen( GetSegmentFileName( m_nAppendSegment + 1 ).c_str(), "wb" );
+		if( NULL == pFile )
+		{
+			pthread_mutex_unlock( &m_mutex );
+			return -1;
+		}
+		fclose( m_pAppendFile );
+		m_pAppendFile = pFile;
+		m_nAppendSegment++;
+		m_nAppendPos = 0;
+	}
+
+	// segment positions stay aligned as every block is padded
+	SRecordIndexEntry sEntry;
+	sEntry.nSegment = m_nAppendSegment;
+	sEntry.nReserved = 0;
+	sEntry.nRecordPos = m_nAppendPos;
+	sEntry.nRecordSize = nRecordSize;
+	sEntry.nImagePos = m_nAppendPos + nAlignedRecordSize;
+	sEntry.nImageSize = nImageSize;
+	const int64 nImagePadding = ( SEGMENT_ALIGNMENT - int64( nImageSize ) % SEGMENT_ALIGNMENT ) % SEGMENT_ALIGNMENT;
+	int error = 0;
+	if( ( nRecordSize > 0 && 1 != fwrite( pRecord, nRecordSize, 1, m_pAppendFile ) )
+		|| ( nAlignedRecordSize > (int64)nRecordSize && 1 != fwrite( szZeros, nAlignedRecordSize - nRecordSize, 1, m_pAppendFile ) )
+		|| ( nImageSize > 0 && 1 != fwrite( pImage, nImageSize, 1, m_pAppendFile ) )
+		|| ( nImagePadding > 0 && 1 != fwrite( szZeros, nImagePadding, 1, m_pAppendFile ) ) )
+	{
+		error = -1;
+	}
+	m_nAppendPos = sEntry.nImagePos + nImageSize + nImagePadding;
+
+	if( 0 == error )
+	{
+		if( nRecordIdx >= (int)m_vecEntries.size() )
+		{
+			SRecordIndexEntry sMissing;
+			memset( &sMissing, 0, sizeof(sMissing) );
+			sMissing.nSegment = -1;
+			m_vecEntries.resize( nRecordIdx + 1, sMissing );
+		}
+		m_vecEntries[nRecordIdx] = sEntry;
+		m_fModified = true;
+	}
+	pthread_mutex_unlock( &m_mutex );
+
+	return error;
+}
+
+// forget the record of an image, its bytes stay unreferenced in the segments
+void CRecordStore::Remove( const int nRecordIdx )
+{
+	pthread_mutex_lock( &m_mutex );
+	if( nRecordIdx >= 0 && nRecordIdx < (int)m_vecEntries.size() )
+	{
+		m_vecEntries[nRecordIdx].nSegment = -1;
+
+		// missing records at the end are not kept in the index
+		while( !m_vecEntries.empty() && m_vecEntries.back().nSegment < 0 )
+		{
+			m_vecEntries.pop_back();
+		}
+		m_fModified = true;
+	}
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// write the index file
+int CRecordStore::WriteIndex() const
+{
+	SRecordIndexHeader sHeader;
+	memset( &sHeader, 0, sizeof(sHeader) );
+	memcpy( sHeader.szMagic, INDEX_MAGIC, sizeof(INDEX_MAGIC) );
+	sHeader.nVersion = INDEX_VERSION;
+	sHeader.nNumRecords = m_vecEntries.size();
+	sHeader.nNumSegments = m_nAppendSegment + 1;
+	sHeader.nChecksum = ComputeChecksum( m_vecEntries.empty() ? NULL : &m_vecEntries[0],
+		m_vecEntries.size() * sizeof(SRecordIndexEntry) );
+
+	FILE *pFile = fopen( ( m_strFilePrefix + BINARY_FORMAT ).c_str(), "wb" );
+	if( NULL == pFile )
+	{
+		return -1;
+	}
+	int error = 0;
+	if( 1 != fwrite( &sHeader, sizeof(sHeader), 1, pFile )
+		|| ( !m_vecEntries.empty() && 1 != fwrite( &m_vecEntries[0], m_vecEntries.size() * sizeof(SRecordIndexEntry), 1, pFile ) ) )
+	{
+		error = -1;
+	}
+	if( 0 != fclose( pFile ) )
+	{
+		error = -1;
+	}
+
+	return error;
+}
+
+// map new and grown segment files, empty segments stay unmapped (requires lock)
+int CRecordStore::MapSegments()
+{
+	// mappings are never released while the store is open, so bytes returned by GetRecord stay valid
+	m_vecSegments.resize( m_nAppendSegment + 1, NULL );
+	for( int s = 0; s <= m_nAppendSegment; s++ )
+	{
+		const string strSegmentName = GetSegmentFileName( s );
+		struct stat sStat;
+		if( NULL != m_vecSegments[s] && 0 == stat( strSegmentName.c_str(), &sStat )
+			&& (int64)m_vecSegments[s]->GetSize() == (int64)sStat.st_size )
+		{
+			continue;
+		}
+
+		CMappedFile *pSegment = new CMappedFile;
+		if( 0 != pSegment->Open( strSegmentName ) && ( s < m_nAppendSegment || m_nAppendPos > 0 ) )
+		{
+			delete pSegment;
+			return -1;
+		}
+		if( NULL != m_vecSegments[s] )
+		{
+			m_vecRetiredSegments.push_back( m_vecSegments[s] );
+		}
+		m_vecSegments[s] = pSegment;
+	}
+
+	return 0;
+}
+
+// write the index and remap the segments
+int CRecordStore::Flush()
+{
+	pthread_mutex_lock( &m_mutex );
+	int error = -1;
+	if( !m_strFilePrefix.empty() && ( NULL == m_pAppendFile || 0 == fflush( m_pAppendFile ) ) )
+	{
+		error = ( m_fModified && 0 != WriteIndex() ) ? -1 : MapSegments();
+		m_fModified = m_fModified && 0 != error;
+	}
+	pthread_mutex_unlock( &m_mutex );
+
+	return error;
+}
+
+// number of image indices in the index
+int CRecordStore::GetNumRecords() const
+{
+	pthread_mutex_lock( &m_mutex );
+	int nNumRecords = m_vecEntries.size();
+	pthread_mutex_unlock( &m_mutex );
+
+	return nNumRecords;
+}
+
+// whether the record of an image is readable
+bool CRecordStore::HasRecord( const int nRecordIdx ) const
+{
+	const unsigned char *pRecord, *pImage;
+	size_t nRecordSize, nImageSize;
+
+	return 0 == GetRecord( nRecordIdx, pRecord, nRecordSize, pImage, nImageSize );
+}
+
+// mapped bytes of the record of an image, valid until the store is closed
+int CRecordStore::GetRecord( const int nRecordIdx, const unsigned char *&pRecord, size_t &nRecordSize,
+	const unsigned char *&pImage, size_t &nImageSize ) const
+{
+	// appends resize the entries and flushes add mappings while queries read records
+	pthread_mutex_lock( &m_mutex );
+	if( nRecordIdx < 0 || nRecordIdx >= (int)m_vecEntries.size() )
+	{
+		pthread_mutex_unlock( &m_mutex );
+		return -1;
+	}
+
+	// records appended after the last flush are not mapped yet
+	const SRecordIndexEntry sEntry = m_vecEntries[nRecordIdx];
+	const CMappedFile *pSegment = ( sEntry.nSegment >= 0 && sEntry.nSegment < (int)m_vecSegments.size() )
+		? m_vecSegments[sEntry.nSegment] : NULL;
+	pthread_mutex_unlock( &m_mutex );
+	if( NULL == pSegment || !pSegment->IsOpen() )
+	{
+		return -1;
+	}
+	if( sEntry.nRecordPos < 0 || sEntry.nRecordSize < 0 || sEntry.nImagePos < 0 || sEntry.nImageSize < 0
+		|| sEntry.nRecordPos + sEntry.nRecordSize > (int64)pSegment->GetSize()
+		|| sEntry.nImagePos + sEntry.nImageSize > (int64)pSegment->GetSize() )
+	{
+		return -1;
+	}
+
+	pRecord = pSegment->GetData() + sEntry.nRecordPos;
+	nRecordSize = sEntry.nRecordSize;
+	pImage = pSegment->GetData() + sEntry.nImagePos;
+	nImageSize = sEntry.nImageSize;
+
+	return 0;
+}
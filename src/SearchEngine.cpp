@@ -29,15 +29,125 @@
 #include <sys/stat.h>
 #endif
 #include <utility>
+#include <algorithm>
 #include "Common.h"
 #include "SearchEngine.h"
+#include "TaskPool.h"
+#include "IngestPipeline.h"
 
 using namespace std;
 using namespace cv;
 
+// threads of the ingestion stages, the extractor stage uses one thread per CPU
+static const int INGEST_READER_THREADS = 2;
+static const int INGEST_WRITER_THREADS = 2;
+// capacity of the queues between the ingestion stages per extractor thread
+static const int INGEST_QUEUE_PER_EXTRACTOR = 4;
+
+#if HIST_SEARCH
+// minimum number of images for comparing the query hash as parallel tasks
+static const int MIN_PARALLEL_IMAGES = 20000;
+
+// comparison of the query hash with a contiguous range of rows of the hash table (exhaustive search,
+// only used when SCORE_SEARCH is off)
+class CHashScoreTask : public CTask
+{
+public:
+	const CHashTable*	m_pHashTable;			// word histograms of all images
+	const CImageHash*	m_pQueryHash;			// word histogram of the query
+	int					m_nBegin;				// first image of the range
+	int					m_nEnd;					// one past the last image of the range
+	CTopKCollector		m_cTopMatches;			// best matches of the range
+
+	void Run()
+	{
+		CImageHash cImageHash;
+		for( int i = m_nBegin; i < m_nEnd; i++ )
+		{
+			m_pHashTable->GetImageHash( i, cImageHash );
+			m_cTopMatches.Add( cImageHash.Compare( *m_pQueryHash ), i );
+		}
+	}
+};
+#endif
+
+#if GEOMETRIC_RERANK
+// state shared by the verification tasks of a query
+struct SVerifyShared
+{
+	volatile int		nStop;					// set once a candidate is verified with confidence
+	int64				nDeadline;				// tick count after which no verification is started
+};
+
+// geometric verification of a candidate against the query
+class CVerifyTask : public CTask
+{
+public:
+	const CSearchEngine*	m_pEngine;			// engine holding the candidate record
+	const CVocabTree*		m_pVocabTree;		// quantizes candidate descriptors to words
+	const CWordTable*		m_pWordTable;		// stored words of the candidates
+	CMatcherCache*			m_pMatcherCache;	// matcher indices of candidates shared across queries
+	const CImageData*		m_pQueryImage;		// query keypoints, descriptors and words
+	SVerifyShared*			m_pShared;			// early stop and time budget
+	int						m_nImageIdx;		// candidate image
+	int						m_nInliers;			// homography inliers (-1 if not verified)
+
+	void Run()
+	{
+		m_nInliers = -1;
+		if( m_pShared->nStop || getTickCount() > m_pShared->nDeadline )
+		{
+			return;
+		}
+
+		// keypoints and descriptors are loaded on demand, the frame is not needed
+		const CImageData *pImageData = m_pEngine->AcquireImageRecord( m_nImageIdx );
+		if( NULL == pImageData )
+		{
+			return;
+		}
+		if( VERIFY_BY_WORDS )
+		{
+			// keypoints sharing a visual word correspond, no matcher index is built for the candidate,
+			// stored words are used when the candidate has them, otherwise its descriptors are quantized
+			const int *pImageWords = NULL;
+			int nNumImageWords = 0;
+			vector<int> vecImageWords;
+			if( m_nImageIdx < m_pWordTable->GetNumImages() && m_pWordTable->GetVocabSize() == m_pVocabTree->GetNumLeaves() )
+			{
+				nNumImageWords = m_pWordTable->GetImageWords( m_nImageIdx, pImageWords );
+			}
+			else
+			{
+				m_pVocabTree->QuantizeWords( pImageData->GetDescriptors(), vecImageWords );
+				pImageWords = vecImageWords.empty() ? NULL : &vecImageWords[0];
+				nNumImageWords = vecImageWords.size();
+			}
+			m_nInliers = pImageData->ValidateGeometryByWords( *m_pQueryImage, pImageWords, nNumImageWords );
+		}
+		else
+		{
+			// the matcher index of the candidate is built once and reused by later queries
+			Ptr<SMatcherIndex> pMatcherIndex = m_pMatcherCache->Acquire( m_nImageIdx, pImageData->GetDescriptors() );
+			m_nInliers = pImageData->ValidateGeometry( *m_pQueryImage, pMatcherIndex.empty() ? NULL : &pMatcherIndex->cIndex );
+		}
+		m_pEngine->ReleaseImageRecord( m_nImageIdx );
+
+		if( m_nInliers >= CONFIDENT_INLIERS )
+		{
+			__sync_lock_test_and_set( &m_pShared->nStop, 1 );
+		}
+	}
+};
+#endif
+
 // constructor
 CSearchEngine::CSearchEngine()
 {
+	m_nMaxKeypoints = MAX_KEYPOINTS;
+	m_fAdaptiveThreshold = ADAPTIVE_THRESHOLD;
+	m_cRecordCache.SetBudget( int64( RECORD_CACHE_MB ) << 20 );
+	m_cMatcherCache.SetBudget( int64( MATCHER_CACHE_MB ) << 20 );
 }
 
 // destructor
@@ -153,6 +263,13 @@ int CSearchEngine::CreateDB( const std::string &strPath, const std::string &strN
 	LogData( "success\n" );
 #endif
 
+	// image records are appended to a packed store instead of the image and descriptor folders
+	if( PACK_RECORDS && 0 != m_cRecordStore.Create( m_strDBPath + "/" + m_strDBName + RECORD_FILE ) )
+	{
+		cerr << "Failed to create record store." << endl;
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -211,6 +328,10 @@ int CSearchEngine::AddFile( const std::string &strInputFilePath,
 
 	// create new image data record
 	CImageData*	pImageData = new CImageData( m_strDBPath, strImageName );
+	if( m_cRecordStore.IsOpen() )
+	{
+		pImageData->SetRecordStore( &m_cRecordStore, m_vecImageData.size() );
+	}
 
 	// load image frame data onto the image record
 	Mat matTempFrame = imread( strInputFilePath );
@@ -227,7 +348,7 @@ int CSearchEngine::AddFile( const std::string &strInputFilePath,
 	LogData( "Computing Descriptors..." );
 #endif
 	// detect keypoints and compute descriptors
-	int error = pImageData->ComputeDescriptors();
+	int error = pImageData->ComputeDescriptors( m_nMaxKeypoints, m_fAdaptiveThreshold );
 	if( 0 != error )
 	{
 #ifdef _DEBUG
@@ -243,12 +364,21 @@ int CSearchEngine::AddFile( const std::string &strInputFilePath,
 	if( fComputeHash )
 	{
 		// check whether vocab tree already exists and propper image hash records exist
-		if( !m_cVocabTree.IsEmpty() && m_vecImageData.size() == m_vecHashMap.size() )
+		if( !m_cVocabTree.IsEmpty() && (int)m_vecImageData.size() == m_cHashTable.GetNumImages() )
 		{
-			// create hash for the new image record
-			CImageHash* pImageHash = new CImageHash();
-			pImageHash->Compute( pImageData->GetDescriptors(), m_cVocabTree );
-			m_vecHashMap.push_back( pImageHash );
+			// create hash for the new image record, its words extend the word table while it covers all images
+			CImageHash cImageHash;
+			vector<int> vecWordIds;
+			cImageHash.Compute( pImageData->GetDescriptors(), m_cVocabTree, &vecWordIds );
+			m_cHashTable.AddImageHash( cImageHash );
+			if( (int)m_vecImageData.size() == m_cWordTable.GetNumImages() )
+			{
+				m_cWordTable.AddImageWords( vecWordIds );
+			}
+#if SCORE_SEARCH
+			// new image gets the next index, its postings go to the end of the lists
+			m_cInvertedIndex.AddImage( m_cHashTable.GetNumImages() - 1, cImageHash );
+#endif
 		}
 		else
 		{
@@ -268,16 +398,39 @@ int CSearchEngine::AddFile( const std::string &strInputFilePath,
 // add list of images to the database data structure
 int CSearchEngine::AddFileList( const std::vector<std::string> &vecInputFilePaths, const std::vector<std::string> &vecImageNames )
 {
-	// add image records one by one
-	for( unsigned int i = 0; i < vecImageNames.size(); i++ )
+	// create the records in input order
+	const int nNumFiles = vecImageNames.size();
+	vector<CImageData*> vecNewImageData( nNumFiles );
+	for( int i = 0; i < nNumFiles; i++ )
+	{
+		vecNewImageData[i] = new CImageData( m_strDBPath, vecImageNames[i] );
+		if( m_cRecordStore.IsOpen() )
+		{
+			vecNewImageData[i]->SetRecordStore( &m_cRecordStore, m_vecImageData.size() + i );
+		}
+	}
+
+	// decode, describe and save the image files in overlapped stages, frames are dropped once saved
+	const int nNumExtractors = g_TaskPool.GetNumThreads();
+	CIngestPipeline cPipeline( INGEST_READER_THREADS, nNumExtractors, INGEST_WRITER_THREADS,
+		INGEST_QUEUE_PER_EXTRACTOR * nNumExtractors, m_nMaxKeypoints, m_fAdaptiveThreshold );
+	vector<int> vecErrors;
+	cPipeline.Run( vecInputFilePaths, vecNewImageData, vecErrors );
+	cPipeline.LogStats();
+
+	// add image records in input order, up to the first image that failed
+	for( int i = 0; i < nNumFiles; i++ )
 	{
 		cout << "Adding file: " << vecImageNames[i] << endl;
-		// add image record
-		int error = AddFile( vecInputFilePaths[i], vecImageNames[i] );
-		if( 0 != error )
+		if( 0 != vecErrors[i] )
 		{
-			return error;
+			for( int j = i; j < nNumFiles; j++ )
+			{
+				delete vecNewImageData[j];
+			}
+			return vecErrors[i];
 		}
+		m_vecImageData.push_back( vecNewImageData[i] );
 	}
 
 	return 0;
@@ -288,7 +441,7 @@ int CSearchEngine::SaveImageDB ()
 {
 	vector<String>	vecImageNames;
 	// save image records one by one
-	for( list<CImageData*>::iterator it = m_vecImageData.begin(); it != m_vecImageData.end(); it++ )
+	for( vector<CImageData*>::iterator it = m_vecImageData.begin(); it != m_vecImageData.end(); it++ )
 	{
 		vecImageNames.push_back( (*it)->GetImageName() );
 #ifdef _DEBUG
@@ -315,7 +468,15 @@ int CSearchEngine::SaveImageDB ()
 		return -1;
 	}
 	write( fs, "images", vecImageNames );
+	fs << "maxkeypoints" << m_nMaxKeypoints;
+	fs << "adaptivethreshold" << ( m_fAdaptiveThreshold ? 1 : 0 );
 	fs.release();
+
+	// index of the packed store covers the appended records
+	if( m_cRecordStore.IsOpen() && 0 != m_cRecordStore.Flush() )
+	{
+		return -1;
+	}
 #ifdef _DEBUG
 	LogData( "success\n" );
 #endif
@@ -340,8 +501,30 @@ int CSearchEngine::LoadImageDB( bool fLoadFullImageRecord )
 	}
 	FileNode fs_imgnode = fs["images"];
 	read( fs_imgnode, vecImageNames );
+
+	// queries keep as many keypoints as the records, databases saved without a budget kept all keypoints
+	int nAdaptiveThreshold = 0;
+	m_nMaxKeypoints = 0;
+	if( !fs["maxkeypoints"].empty() )
+	{
+		fs["maxkeypoints"] >> m_nMaxKeypoints;
+	}
+	if( !fs["adaptivethreshold"].empty() )
+	{
+		fs["adaptivethreshold"] >> nAdaptiveThreshold;
+	}
+	m_fAdaptiveThreshold = ( 0 != nAdaptiveThreshold );
 	fs.release();
 
+	// records are read from the packed store when the database has one (its index file exists), separate files otherwise
+	const string strRecordFile = m_strDBPath + "/" + m_strDBName + RECORD_FILE;
+	struct stat sStat;
+	if( 0 == stat( ( strRecordFile + BINARY_FORMAT ).c_str(), &sStat ) && 0 != m_cRecordStore.Open( strRecordFile ) )
+	{
+		LogData( "Failed to open record store: %s\n", strRecordFile.c_str() );
+		return -1;
+	}
+
 	// load image records one by one
 	for( vector<String>::iterator it = vecImageNames.begin(); it != vecImageNames.end(); it++ )
 	{
@@ -349,6 +532,10 @@ int CSearchEngine::LoadImageDB( bool fLoadFullImageRecord )
 		LogData( "Loading record: %s...", (*it).c_str() );
 #endif
 		CImageData*	pImageData = new CImageData( m_strDBPath, *it );
+		if( m_cRecordStore.IsOpen() )
+		{
+			pImageData->SetRecordStore( &m_cRecordStore, m_vecImageData.size() );
+		}
 
 		// load image frame, keypoint and descriptors only if requested
 		if( fLoadFullImageRecord )
@@ -370,33 +557,147 @@ int CSearchEngine::LoadImageDB( bool fLoadFullImageRecord )
 	return 0;
 }
 
+// memory of lazily loaded records before least recently used ones are dropped
+void CSearchEngine::SetRecordCacheBudget( const int nBudgetMB )
+{
+	m_cRecordCache.SetBudget( int64( nBudgetMB ) << 20 );
+}
+
+// memory of cached matcher indices before least recently used ones are dropped
+void CSearchEngine::SetMatcherCacheBudget( const int nBudgetMB )
+{
+	m_cMatcherCache.SetBudget( int64( nBudgetMB ) << 20 );
+}
+
+// strongest keypoints kept of database and query images (0 keeps all), only before images are added
+int CSearchEngine::SetKeypointBudget( const int nMaxKeypoints, const bool fAdaptiveThreshold )
+{
+	// records of the database were extracted with the budget it was created with
+	if( !m_vecImageData.empty() )
+	{
+		return -1;
+	}
+	m_nMaxKeypoints = MAX( nMaxKeypoints, 0 );
+	m_fAdaptiveThreshold = fAdaptiveThreshold;
+
+	return 0;
+}
+
+// load an image record on demand and keep it until released (NULL on failure)
+const CImageData* CSearchEngine::AcquireImageRecord( const int nImageIdx, const bool fLoadFrame ) const
+{
+	if( nImageIdx < 0 || nImageIdx >= (int)m_vecImageData.size() )
+	{
+		return NULL;
+	}
+	if( 0 != m_cRecordCache.Acquire( m_vecImageData[nImageIdx], fLoadFrame ) )
+	{
+		LogData( "Failed to load image record: %s\n", m_vecImageData[nImageIdx]->GetImageName().c_str() );
+		return NULL;
+	}
+
+	return m_vecImageData[nImageIdx];
+}
+
+// release an image record acquired before
+void CSearchEngine::ReleaseImageRecord( const int nImageIdx ) const
+{
+	if( nImageIdx >= 0 && nImageIdx < (int)m_vecImageData.size() )
+	{
+		m_cRecordCache.Release( m_vecImageData[nImageIdx] );
+	}
+}
+
 // clear image database (from memory)
 void CSearchEngine::ClearImageDB()
 {
-	for( list<CImageData*>::iterator it = m_vecImageData.begin(); it != m_vecImageData.end(); it++ )
+	// cached records are dropped before the records themselves, matcher indices refer to image positions
+	m_cRecordCache.Clear();
+	m_cMatcherCache.Clear();
+	for( vector<CImageData*>::iterator it = m_vecImageData.begin(); it != m_vecImageData.end(); it++ )
 	{
 		delete *it;
 	}
 	m_vecImageData.clear();
+	m_cRecordStore.Close();
 }
 
 // build the vocabulary tree
-int CSearchEngine::BuildVocabTree( const int nNumClusters, const int nTreeLevels )
+int CSearchEngine::BuildVocabTree( const int nNumClusters, const int nTreeLevels,
+	const int nMaxSamples, const int nMaxPerImage )
 {
 	ClearVocabTree();
 #ifdef _DEBUG
 	LogData( "Building vocabulary tree...\n" );
 #endif	
+	if( nMaxSamples > 0 )
+	{
+		// records are read one image at a time for the sample and again for the node weights
+		vector<string> vecImageNames;
+		if( 0 != GetRecordNames( vecImageNames ) )
+		{
+			return -1;
+		}
+		CDescrFolderSource cSource( m_strDBPath, vecImageNames, m_cRecordStore.IsOpen() ? &m_cRecordStore : NULL );
+		return m_cVocabTree.BuildTreeSampled( cSource, nMaxSamples, nMaxPerImage,
+			nNumClusters, nTreeLevels );
+	}
+
 	return m_cVocabTree.BuildTree( m_vecImageData, nNumClusters, nTreeLevels );
 }
 
+// names of the saved image records, appended records are flushed so descriptor sources can read them
+int CSearchEngine::GetRecordNames( std::vector<std::string> &vecImageNames )
+{
+	vecImageNames.clear();
+	for( vector<CImageData*>::const_iterator it = m_vecImageData.begin(); it != m_vecImageData.end(); it++ )
+	{
+		vecImageNames.push_back( (*it)->GetImageName() );
+	}
+
+	// records appended since the last save become readable once the store is flushed
+	if( m_cRecordStore.IsOpen() && 0 != m_cRecordStore.Flush() )
+	{
+		return -1;
+	}
+
+	return 0;
+}
+
+// build the vocabulary tree from descriptor records on disk within a memory budget
+int CSearchEngine::BuildVocabTreeStreamed( const int nMemoryBudgetMB, const int nNumClusters,
+	const int nTreeLevels )
+{
+	ClearVocabTree();
+#ifdef _DEBUG
+	LogData( "Building vocabulary tree from descriptor records...\n" );
+#endif
+	// only the record names are needed, descriptors are streamed from the descriptor folder or the packed store
+	vector<string> vecImageNames;
+	if( 0 != GetRecordNames( vecImageNames ) )
+	{
+		return -1;
+	}
+
+	CDescrFolderSource cSource( m_strDBPath, vecImageNames, m_cRecordStore.IsOpen() ? &m_cRecordStore : NULL );
+	return m_cVocabTree.BuildTree( cSource, m_strDBPath + "/" + TEMP_FOLDER,
+		int64( nMemoryBudgetMB ) << 20, nNumClusters, nTreeLevels );
+}
+
 // save vocabulary tree
 int CSearchEngine::SaveVocabTree() const
 {
 #ifdef _DEBUG
 	LogData( "Saving vocabulary tree...\n" );
 #endif	
-	return m_cVocabTree.SaveTree( m_strDBPath + "/" + m_strDBName + VOCAB_FILE + FILE_FORMAT );
+	int error = m_cVocabTree.SaveTree( m_strDBPath + "/" + m_strDBName + VOCAB_FILE + FILE_FORMAT );
+	if( 0 != error )
+	{
+		return error;
+	}
+
+	// binary copy of the tree for fast loading
+	return m_cVocabTree.SaveTreeBinary( m_strDBPath + "/" + m_strDBName + VOCAB_FILE + BINARY_FORMAT );
 }
 
 // load vocabulary tree
@@ -406,6 +707,13 @@ int CSearchEngine::LoadVocabTree()
 #ifdef _DEBUG
 	LogData( "Loading vocabulary tree...\n" );
 #endif	
+	// map the binary tree if present, otherwise parse the XML/YAML tree, the structure is validated on load
+	// and the full checksum is left to the converter, so the centers are only paged in when searched
+	if( 0 == m_cVocabTree.LoadTreeBinary( m_strDBPath + "/" + m_strDBName + VOCAB_FILE + BINARY_FORMAT, false ) )
+	{
+		return 0;
+	}
+
 	return m_cVocabTree.LoadTree( m_strDBPath + "/" + m_strDBName + VOCAB_FILE + FILE_FORMAT );
 }
 
@@ -413,6 +721,10 @@ int CSearchEngine::LoadVocabTree()
 void CSearchEngine::ClearVocabTree()
 {
 	m_cVocabTree.Clear();
+#if HIST_SEARCH
+	// words refer to the leaves of the cleared tree
+	m_cWordTable.Clear();
+#endif
 }
 
 #if HIST_SEARCH
@@ -426,50 +738,71 @@ int CSearchEngine::BuildHashTable()
 	// clean up hash table
 	ClearHashTable();
 
-	// create a new empty hash map
-	m_vecHashMap.resize( m_vecImageData.size() );
-	for( list<CImageHash*>::iterator it = m_vecHashMap.begin(); it != m_vecHashMap.end(); it++ )
+	// stored words are reused when they cover all images, otherwise descriptors are quantized once and their words kept
+	const int nNumImages = m_vecImageData.size();
+	const bool fStoredWords = ( nNumImages == m_cWordTable.GetNumImages() && m_cWordTable.GetVocabSize() == m_cVocabTree.GetNumLeaves() );
+	if( !fStoredWords )
 	{
-		*it = new CImageHash;
+		m_cWordTable.Clear( m_cVocabTree.GetNumLeaves() );
 	}
 
-	// compute image hash for all image data records
-	list<CImageHash*>::iterator it_hash = m_vecHashMap.begin();
-	for( list<CImageData*>::iterator it = m_vecImageData.begin(); it != m_vecImageData.end(); it++, it_hash++ )
+	// compute image hash for all image data records, rows are appended to the table
+	CImageHash cImageHash;
+	vector<int> vecWordIds;
+	for( int i = 0; i < nNumImages; i++ )
 	{
 		// compute hash map for each entry
-		(*it_hash)->Compute( (*it)->GetDescriptors(), m_cVocabTree );
+		if( fStoredWords )
+		{
+			const int *pWordIds;
+			const int nNumWords = m_cWordTable.GetImageWords( i, pWordIds );
+			if( 0 != cImageHash.ComputeFromWords( pWordIds, nNumWords, m_cVocabTree ) )
+			{
+				return -1;
+			}
+		}
+		else
+		{
+			cImageHash.Compute( m_vecImageData[i]->GetDescriptors(), m_cVocabTree, &vecWordIds );
+			if( 0 != m_cWordTable.AddImageWords( vecWordIds ) )
+			{
+				return -1;
+			}
+		}
+		m_cHashTable.AddImageHash( cImageHash );
 	}
+	m_cHashTable.Compact();
+	m_cWordTable.Compact();
 
 #ifdef _DEBUG
 	LogData( "success\n" );
 #endif
 
+#if SCORE_SEARCH
+	return BuildInvertedIndex();
+#else
 	return 0;
+#endif
 }
 
 // save hash table
 int CSearchEngine::SaveHashTable() const
 {
-	const std::string &strFileName = m_strDBPath + "/" + m_strDBName + HASH_FILE + FILE_FORMAT;
-	// open file storage for writing
-	FileStorage fs( strFileName, FileStorage::WRITE );
-	if( !fs.isOpened() )
+	int error = m_cHashTable.SaveTable( m_strDBPath + "/" + m_strDBName + HASH_FILE + FILE_FORMAT );
+	if( 0 != error )
 	{
-		return -1;
+		return error;
 	}
 
-	int error = 0;
-	fs << "hashtable" << "[";
-	// save each image hash
-	for( list<CImageHash*>::const_iterator it = m_vecHashMap.begin(); it != m_vecHashMap.end(); it++ )
+	// binary copy of the table for fast loading
+	error = m_cHashTable.SaveTableBinary( m_strDBPath + "/" + m_strDBName + HASH_FILE + BINARY_FORMAT );
+	if( 0 != error )
 	{
-		error = (*it)->SaveImageHash( fs );
+		return error;
 	}
-	fs << "]";
-	fs.release();
 
-	return error;
+	// words of all keypoints, so the table can be rebuilt without quantizing descriptors
+	return m_cWordTable.SaveTableBinary( m_strDBPath + "/" + m_strDBName + WORD_FILE + BINARY_FORMAT );
 }
 
 // load hash table
@@ -477,37 +810,82 @@ int CSearchEngine::LoadHashTable()
 {
 	ClearHashTable();
 
-	const std::string &strFileName = m_strDBPath + "/" + m_strDBName + HASH_FILE + FILE_FORMAT;
-	// open file storage for reading
-	FileStorage fs( strFileName, FileStorage::READ );
-	if( !fs.isOpened() )
+	// map the binary table if present, otherwise parse the XML/YAML table, the array bounds and row offsets are
+	// validated on load and the full checksum is skipped, so the bins are only paged in when compared
+	int error = m_cHashTable.LoadTableBinary( m_strDBPath + "/" + m_strDBName + HASH_FILE + BINARY_FORMAT, false );
+	if( 0 != error )
 	{
-		return -1;
+		error = m_cHashTable.LoadTable( m_strDBPath + "/" + m_strDBName + HASH_FILE + FILE_FORMAT );
 	}
 
-	int error = 0;
-	FileNode fn = fs["hashtable"];
-	// load each image hash
-	for( FileNodeIterator it = fn.begin(); it != fn.end(); it++ )
+	// stored words are optional, without them verification quantizes candidate descriptors
+	if( 0 != m_cWordTable.LoadTableBinary( m_strDBPath + "/" + m_strDBName + WORD_FILE + BINARY_FORMAT, false )
+		|| m_cWordTable.GetNumImages() != m_cHashTable.GetNumImages()
+		|| m_cWordTable.GetVocabSize() != m_cVocabTree.GetNumLeaves() )
 	{
-		CImageHash* pImageHash = new CImageHash;
-        FileNode fn_entry = *it;
-		error = pImageHash->LoadImageHash( fn_entry );
-		m_vecHashMap.push_back( pImageHash );
+		m_cWordTable.Clear( m_cVocabTree.GetNumLeaves() );
 	}
-	fs.release();
+
+#if SCORE_SEARCH
+	if( 0 == error )
+	{
+		error = BuildInvertedIndex();
+	}
+#endif
 
 	return error;
 }
 
+// recompute IDF weights from the stored words and rebuild the hash table
+int CSearchEngine::ReweightVocabTree()
+{
+	if( (int)m_vecImageData.size() != m_cWordTable.GetNumImages() )
+	{
+		return -1;
+	}
+
+	int error = m_cVocabTree.ComputeNodeWeights( m_cWordTable );
+	if( 0 != error )
+	{
+		return error;
+	}
+
+	// histogram weights follow the node weights, the words themselves are unchanged
+	return BuildHashTable();
+}
+
 // clear hash table
 void CSearchEngine::ClearHashTable()
 {
-	for( list<CImageHash*>::iterator it = m_vecHashMap.begin(); it != m_vecHashMap.end(); it++ )
+	m_cHashTable.Clear();
+#if SCORE_SEARCH
+	m_cInvertedIndex.Clear();
+#endif
+}
+#endif
+
+#if SCORE_SEARCH
+// build posting lists from the hash table
+int CSearchEngine::BuildInvertedIndex()
+{
+	m_cInvertedIndex.Clear();
+	CImageHash cImageHash;
+	for( int i = 0; i < m_cHashTable.GetNumImages(); i++ )
 	{
-		delete *it;
+		m_cHashTable.GetImageHash( i, cImageHash );
+		int error = m_cInvertedIndex.AddImage( i, cImageHash );
+		if( 0 != error )
+		{
+			return error;
+		}
 	}
-	m_vecHashMap.clear();
+	m_cInvertedIndex.Compact();
+#ifdef _DEBUG
+	LogData( "Inverted index: %d images, %lld postings, %lld bytes\n", m_cInvertedIndex.GetNumImages(),
+		(long long)m_cInvertedIndex.GetNumPostings(), (long long)m_cInvertedIndex.GetMemoryUsage() );
+#endif
+
+	return 0;
 }
 #endif
 
@@ -530,91 +908,142 @@ int CSearchEngine::SearchDB( const std::string &strQueryImgFile,
 	// create query image record
 	CImageData	cQueryImage( string(""), string("SearchQuery") );
 	cQueryImage.SetImageFrame( matQueryImage );
-	cQueryImage.ComputeDescriptors();
+	cQueryImage.ComputeDescriptors( m_nMaxKeypoints, m_fAdaptiveThreshold );
 
 #if HIST_SEARCH
 	// compute word histogram for query descriptors
 	CImageHash	cQueryHashMap;
-	cQueryHashMap.Compute( cQueryImage.GetDescriptors(), m_cVocabTree );
+	vector<int> vecQueryWords;
+	cQueryHashMap.Compute( cQueryImage.GetDescriptors(), m_cVocabTree, &vecQueryWords );
+	cQueryImage.SetWordIds( vecQueryWords );
 
-	// map of top matches
-	map< double, const CImageData*, greater<double> > mapBestMatches;
+	// top matches as (score, image index), best first with equal scores in image order
+	vector< pair<double, int> > vecTopMatches;
 
-	// best match index
-	list<CImageData*>::const_iterator it_image = m_vecImageData.begin();
-	// compute best matching hash
-	for( list<CImageHash*>::const_iterator it = m_vecHashMap.begin(); it != m_vecHashMap.end(); it++, it_image++ )
+#if GEOMETRIC_RERANK
+	// more candidates than returned matches are scored, verification decides their final order
+	const int nNumCandidates = MAX( NUM_TOP_MATCHES, NUM_VERIFY_CANDIDATES );
+#else
+	const int nNumCandidates = NUM_TOP_MATCHES;
+#endif
+#endif
+
+#if SCORE_SEARCH
+	// accumulate scores over the posting lists of the query words only, skipping postings that can not change the top matches
+	int64 nNumSkipped = 0;
+	m_cInvertedIndex.SearchPruned( cQueryHashMap, nNumCandidates, vecTopMatches, nNumSkipped );
+	LogData( "Postings skipped: %lld\n", (long long)nNumSkipped );
+#elif HIST_SEARCH
+	// compare query hash map with all hashes in the database, ranges of rows are compared in parallel for large databases
+	const int nNumImages = m_cHashTable.GetNumImages();
+	int nNumShards = ( nNumImages >= MIN_PARALLEL_IMAGES ) ? g_TaskPool.GetNumThreads() : 1;
+	vector<CHashScoreTask> vecTasks( nNumShards );
+	vector<CTask*> vecTaskPtrs( nNumShards );
+	for( int s = 0; s < nNumShards; s++ )
 	{
-		// compare query hash map with all hashes in the database
-		double dMatchScore = (*it)->Compare( cQueryHashMap );
-		mapBestMatches.insert( pair<double, const CImageData*>( dMatchScore, *it_image ) );
+		vecTasks[s].m_pHashTable = &m_cHashTable;
+		vecTasks[s].m_pQueryHash = &cQueryHashMap;
+		vecTasks[s].m_nBegin = int( int64(nNumImages) * s / nNumShards );
+		vecTasks[s].m_nEnd = int( int64(nNumImages) * ( s + 1 ) / nNumShards );
+		vecTasks[s].m_cTopMatches.Reset( nNumCandidates );
+		vecTaskPtrs[s] = &vecTasks[s];
 	}
-#elif SCORE_SEARCH
-	// score map for matching database images
-	map<int, double> mapScore;
-
-	// for all descriptors in query image
-	int nNumDescriptors = matQueryDescriptors.rows;
-	for( int iRow = 0; iRow < nNumDescriptors; iRow++ )
+	if( nNumShards > 1 )
 	{
-		// search for best matching leaf node
-		const CVocabTreeNode* pLeafNode = m_cVocabTree.SearchTree( matQueryDescriptors.row( iRow ) );
-
-		// retrieve leaf node information
-		double dNodeWt = pLeafNode->GetNodeWeight();
-		const vector<int>& vecInvertedList = pLeafNode->GetInvertedList();
-		const vector<int>& vecTermFreqList = pLeafNode->GetTermFreqList();
+		g_TaskPool.Run( vecTaskPtrs );
+	}
+	else
+	{
+		vecTasks[0].Run();
+	}
 
-		// for all entries in the leaf node inverted list
-		for( unsigned int iInvFile = 0; iInvFile < vecInvertedList.size(); iInvFile++ )
+	// the best matches of all images are among the best matches of the ranges
+	CTopKCollector cTopMatches( nNumCandidates );
+	vector< pair<double, int> > vecShardMatches;
+	for( int s = 0; s < nNumShards; s++ )
+	{
+		vecTasks[s].m_cTopMatches.GetSortedMatches( vecShardMatches );
+		for( unsigned int i = 0; i < vecShardMatches.size(); i++ )
 		{
-			// get inverted file index
-			int nFileIndex = vecInvertedList[iInvFile];
-
-			// compute TF-IDF weight
-			double dWeightedWordFrequency = double(vecTermFreqList[iInvFile]) * dNodeWt;
+			cTopMatches.Add( vecShardMatches[i].first, vecShardMatches[i].second );
+		}
+	}
+	cTopMatches.GetSortedMatches( vecTopMatches );
+#endif
 
-			// check for existing entry for file index in the score map
-			map<int, double>::iterator it = mapScore.find( nFileIndex );
+#if GEOMETRIC_RERANK
+	// verify the best candidates in parallel, no verification is started after a confident match or beyond the time budget
+	const int64 nVerifyStart = getTickCount();
+	SVerifyShared sShared;
+	sShared.nStop = 0;
+	sShared.nDeadline = nVerifyStart + int64( VERIFY_TIME_MS * getTickFrequency() / 1000.0 );
+	const int nNumVerify = MIN( (int)vecTopMatches.size(), NUM_VERIFY_CANDIDATES );
+	vector<CVerifyTask> vecVerifyTasks( nNumVerify );
+	vector<CTask*> vecVerifyTaskPtrs( nNumVerify );
+	for( int i = 0; i < nNumVerify; i++ )
+	{
+		vecVerifyTasks[i].m_pEngine = this;
+		vecVerifyTasks[i].m_pVocabTree = &m_cVocabTree;
+		vecVerifyTasks[i].m_pWordTable = &m_cWordTable;
+		vecVerifyTasks[i].m_pMatcherCache = &m_cMatcherCache;
+		vecVerifyTasks[i].m_pQueryImage = &cQueryImage;
+		vecVerifyTasks[i].m_pShared = &sShared;
+		vecVerifyTasks[i].m_nImageIdx = vecTopMatches[i].second;
+		vecVerifyTaskPtrs[i] = &vecVerifyTasks[i];
+	}
+	if( nNumVerify > 0 )
+	{
+		g_TaskPool.Run( vecVerifyTaskPtrs );
+	}
 
-			// add entry to score map
-			if ( mapScore.end() ==  it )
-			{
-				// new entry
-				mapScore.insert( pair<int, double>( nFileIndex, dWeightedWordFrequency ) );
-			}
-			else
-			{
-				// existing entry
-				it->second += dWeightedWordFrequency;
-			}
-		}
+	// verified candidates go first by number of inliers, the others keep their bag of words order
+	vector< pair<int, int> > vecRanks( vecTopMatches.size() );
+	int nNumVerified = 0;
+	for( int i = 0; i < (int)vecTopMatches.size(); i++ )
+	{
+		const int nInliers = ( i < nNumVerify ) ? vecVerifyTasks[i].m_nInliers : -1;
+		nNumVerified += ( nInliers >= 0 ) ? 1 : 0;
+		vecRanks[i] = make_pair( ( nInliers >= MIN_VERIFY_INLIERS ) ? -nInliers : 0, i );
 	}
+	sort( vecRanks.begin(), vecRanks.end() );
 
-	// search for file index with best score
-	int i = 0;
-	double dBestScore = 0.0;
-	for( map<int, double>::const_iterator it = mapScore.begin(); it != mapScore.end(); it++, i++ )
+	vector< pair<double, int> > vecRerankedMatches;
+	vector<int> vecTopInliers;
+	for( int i = 0; i < (int)vecRanks.size() && i < NUM_TOP_MATCHES; i++ )
 	{
-		if( it->second > dBestScore )
-		{
-			dBestScore = it->second;
-			iBestMatch = i;
-		}
+		const int nCandidate = vecRanks[i].second;
+		vecRerankedMatches.push_back( vecTopMatches[nCandidate] );
+		vecTopInliers.push_back( ( nCandidate < nNumVerify ) ? vecVerifyTasks[nCandidate].m_nInliers : -1 );
+	}
+	vecTopMatches.swap( vecRerankedMatches );
+#ifdef _DEBUG
+	LogData( "Verified %d of %d candidates in %.1f ms\n", nNumVerified, nNumVerify,
+		double( getTickCount() - nVerifyStart ) * 1000.0 / getTickFrequency() );
+	if( !VERIFY_BY_WORDS )
+	{
+		m_cMatcherCache.LogStats();
 	}
+#endif
 #endif
 
-	// select top matches for spatial consistency re-ranking
+	// report top matches
     vecBestMatches.clear();
-	map< double, const CImageData*, greater<double> >::const_iterator it_bestmatch = mapBestMatches.begin();
-	for( int iBestMatch = 0; iBestMatch < NUM_TOP_MATCHES && it_bestmatch != mapBestMatches.end(); iBestMatch++, it_bestmatch++ )
+	for( int iBestMatch = 0; iBestMatch < (int)vecTopMatches.size(); iBestMatch++ )
 	{
+		const CImageData *pImageData = m_vecImageData[ vecTopMatches[iBestMatch].second ];
 		cout << iBestMatch + 1 << ". "
-			<< it_bestmatch->second->GetImageName() << " score = "
-			<< it_bestmatch->first << endl;
+			<< pImageData->GetImageName() << " score = "
+			<< vecTopMatches[iBestMatch].first;
+#if GEOMETRIC_RERANK
+		if( vecTopInliers[iBestMatch] >= 0 )
+		{
+			cout << " inliers = " << vecTopInliers[iBestMatch];
+		}
+#endif
+		cout << endl;
         
         //pair<double, const string&> match( it_bestmatch->first, it_bestmatch->second->GetImageName() );
-        vecBestMatches.push_back( it_bestmatch->second->GetImageName() );
+        vecBestMatches.push_back( pImageData->GetImageName() );
         
 		//stringstream strBuffer;
 		//strBuffer << "result" << iBestMatch + 1 << ".jpg";
@@ -628,37 +1057,3 @@ int CSearchEngine::SearchDB( const std::string &strQueryImgFile,
 	//return (mapBestMatches.begin()->second)->GetImageName();
     return 0;
 }
-
-#if 0
-	// build list of all leaf nodes
-	list<const CVocabTreeNode*>	lstLeafList;
-	m_cVocabTree.BuildLeafList( lstLeafList );
-
-	// retrieve inverted files to populate word 
-	unsigned int nBinIdx = 0;
-	// loop over all leaf nodes
-	for( list<const CVocabTreeNode*>::const_iterator it = lstLeafList.begin(); it != lstLeafList.end(); it++, nBinIdx++ )
-	{
-		// retrieve leaf node information
-		double dNodeWt = (*it)->GetNodeWeight();
-		const vector<int>& vecInvertedList = (*it)->GetInvertedList();
-		const vector<int>& vecTermFreqList = (*it)->GetTermFreqList();
-		// for all entries in the leaf node inverted list
-  		for( unsigned int iInvFile = 0; iInvFile < vecInvertedList.size(); iInvFile++ )
-		{
-			// get reference to image record from inverted file index
-			const CImageData* pImageRecord = m_vecImageData[vecInvertedList[iInvFile]];
-			CImageHash* pHashMap = m_vecHashMap[vecInvertedList[iInvFile]];
-			// compute TF-IDF weight
-			double dWeightedWordFrequency = dNodeWt * double(vecTermFreqList[iInvFile]) / double(pImageRecord->GetDescriptors().rows);
-			// Add entry to sparse histogram
-			pHashMap->AddEntry( nBinIdx, dWeightedWordFrequency );
-		}
-	}
-
-	// compute magnitude for each hash vector
-	for( vector<CImageHash*>::iterator it = m_vecHashMap.begin(); it != m_vecHashMap.end(); it++ )
-	{
-		(*it)->ComputeMagnitude();
-	}
-#endif
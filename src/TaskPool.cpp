@@ -0,0 +1,285 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <unistd.h>
+#include "TaskPool.h"
+
+using namespace std;
+
+// shared task pool
+CTaskPool g_TaskPool;
+
+// queue index of the calling thread (-1 for threads outside the pool)
+static __thread int t_nWorkerQueue = -1;
+
+// pool owning the calling worker thread
+static __thread CTaskPool *t_pWorkerPool = NULL;
+
+// arguments passed to a starting worker
+struct SWorkerArg
+{
+	CTaskPool*	pPool;
+	int			nQueue;
+};
+
+// destructor
+CTask::~CTask()
+{
+}
+
+// constructor
+CTaskGroup::CTaskGroup()
+{
+	m_nPending = 0;
+}
+
+// constructor
+CTaskPool::CTaskPool( const int nNumThreads )
+{
+	m_nNumThreads = nNumThreads;
+	m_fStop = false;
+	pthread_mutex_init( &m_mutex, NULL );
+	pthread_cond_init( &m_condition, NULL );
+}
+
+// destructor
+CTaskPool::~CTaskPool()
+{
+	Stop();
+	pthread_cond_destroy( &m_condition );
+	pthread_mutex_destroy( &m_mutex );
+}
+
+// worker thread entry point
+void* CTaskPool::WorkerMain( void *pArg )
+{
+	SWorkerArg *pWorkerArg = (SWorkerArg*)pArg;
+	CTaskPool *pPool = pWorkerArg->pPool;
+	t_nWorkerQueue = pWorkerArg->nQueue;
+	t_pWorkerPool = pPool;
+	delete pWorkerArg;
+
+	pthread_mutex_lock( &pPool->m_mutex );
+	while( !pPool->m_fStop )
+	{
+		SQueuedTask sTask;
+		if( pPool->PopTask( t_nWorkerQueue, sTask ) )
+		{
+			pthread_mutex_unlock( &pPool->m_mutex );
+			pPool->RunTask( sTask );
+			pthread_mutex_lock( &pPool->m_mutex );
+		}
+		else
+		{
+			pthread_cond_wait( &pPool->m_condition, &pPool->m_mutex );
+		}
+	}
+	pthread_mutex_unlock( &pPool->m_mutex );
+
+	return NULL;
+}
+
+// spawn worker threads (requires lock)
+void CTaskPool::Start()
+{
+	int nNumThreads = m_nNumThreads;
+	if( nNumThreads <= 0 )
+	{
+		nNumThreads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+		nNumThreads = ( nNumThreads < 1 ) ? 1 : nNumThreads;
+	}
+
+	// workers wait for the lock before touching the queues, so the queues are set up once the started threads are known
+	m_fStop = false;
+	m_vecThreads.resize( nNumThreads );
+	int nNumStarted = 0;
+	for( ; nNumStarted < nNumThreads; nNumStarted++ )
+	{
+		SWorkerArg *pWorkerArg = new SWorkerArg;
+		pWorkerArg->pPool = this;
+		pWorkerArg->nQueue = nNumStarted;
+		if( 0 != pthread_create( &m_vecThreads[nNumStarted], NULL, WorkerMain, pWorkerArg ) )
+		{
+			// run with the threads that started, without any the waiting threads run the tasks themselves
+			delete pWorkerArg;
+			break;
+		}
+	}
+	m_vecThreads.resize( nNumStarted );
+
+	// keep tasks still queued from a previous set of workers
+	deque<SQueuedTask> dqPending;
+	for( unsigned int i = 0; i < m_vecQueues.size(); i++ )
+	{
+		dqPending.insert( dqPending.end(), m_vecQueues[i].begin(), m_vecQueues[i].end() );
+	}
+	m_vecQueues.clear();
+	m_vecQueues.resize( nNumStarted + 1 );
+	m_vecQueues.back().swap( dqPending );
+}
+
+// join worker threads
+void CTaskPool::Stop()
+{
+	pthread_mutex_lock( &m_mutex );
+	m_fStop = true;
+	pthread_cond_broadcast( &m_condition );
+	pthread_mutex_unlock( &m_mutex );
+
+	for( unsigned int i = 0; i < m_vecThreads.size(); i++ )
+	{
+		pthread_join( m_vecThreads[i], NULL );
+	}
+	m_vecThreads.clear();
+}
+
+// pop own task or steal one (requires lock)
+bool CTaskPool::PopTask( int nQueue, SQueuedTask &sTask )
+{
+	if( m_vecQueues.empty() )
+	{
+		return false;
+	}
+
+	// own queue is used as a stack (depth first, cache friendly)
+	if( nQueue >= 0 && !m_vecQueues[nQueue].empty() )
+	{
+		sTask = m_vecQueues[nQueue].back();
+		m_vecQueues[nQueue].pop_back();
+		return true;
+	}
+
+	// steal the oldest (largest) task from another queue, starting after our own
+	int nNumQueues = m_vecQueues.size();
+	for( int i = 1; i <= nNumQueues; i++ )
+	{
+		int nVictim = ( ( nQueue < 0 ? nNumQueues - 1 : nQueue ) + i ) % nNumQueues;
+		if( !m_vecQueues[nVictim].empty() )
+		{
+			sTask = m_vecQueues[nVictim].front();
+			m_vecQueues[nVictim].pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// run task and update its group (takes lock)
+void CTaskPool::RunTask( const SQueuedTask &sTask )
+{
+	sTask.pTask->Run();
+
+	pthread_mutex_lock( &m_mutex );
+	sTask.pGroup->m_nPending--;
+	if( 0 == sTask.pGroup->m_nPending )
+	{
+		pthread_cond_broadcast( &m_condition );
+	}
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// restart pool with given number of threads
+void CTaskPool::SetNumThreads( const int nNumThreads )
+{
+	Stop();
+
+	pthread_mutex_lock( &m_mutex );
+	m_nNumThreads = nNumThreads;
+	Start();
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// number of worker threads
+int CTaskPool::GetNumThreads() const
+{
+	if( !m_vecThreads.empty() )
+	{
+		return m_vecThreads.size();
+	}
+	if( m_nNumThreads > 0 )
+	{
+		return m_nNumThreads;
+	}
+
+	int nNumThreads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+	return ( nNumThreads < 1 ) ? 1 : nNumThreads;
+}
+
+// queue a task
+void CTaskPool::Submit( CTask *pTask, CTaskGroup &cGroup )
+{
+	pthread_mutex_lock( &m_mutex );
+
+	// workers are started on first use
+	if( m_vecThreads.empty() )
+	{
+		Start();
+	}
+
+	SQueuedTask sTask;
+	sTask.pTask = pTask;
+	sTask.pGroup = &cGroup;
+	cGroup.m_nPending++;
+
+	int nQueue = ( this == t_pWorkerPool ) ? t_nWorkerQueue : (int)m_vecQueues.size() - 1;
+	m_vecQueues[nQueue].push_back( sTask );
+
+	pthread_cond_broadcast( &m_condition );
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// run queued tasks until all tasks of the group completed
+void CTaskPool::Wait( CTaskGroup &cGroup )
+{
+	int nQueue = ( this == t_pWorkerPool ) ? t_nWorkerQueue : -1;
+
+	pthread_mutex_lock( &m_mutex );
+	while( cGroup.m_nPending > 0 )
+	{
+		// help with queued work instead of blocking, this keeps nested waits deadlock free
+		SQueuedTask sTask;
+		if( PopTask( nQueue, sTask ) )
+		{
+			pthread_mutex_unlock( &m_mutex );
+			RunTask( sTask );
+			pthread_mutex_lock( &m_mutex );
+		}
+		else
+		{
+			pthread_cond_wait( &m_condition, &m_mutex );
+		}
+	}
+	pthread_mutex_unlock( &m_mutex );
+}
+
+// submit tasks and wait for all of them
+void CTaskPool::Run( const std::vector<CTask*> &vecTasks )
+{
+	CTaskGroup cGroup;
+	for( unsigned int i = 0; i < vecTasks.size(); i++ )
+	{
+		Submit( vecTasks[i], cGroup );
+	}
+	Wait( cGroup );
+}
@@ -0,0 +1,97 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <algorithm>
+#include "TopKCollector.h"
+
+using namespace std;
+
+// order of matches, higher score first and smaller image index first on equal scores
+static bool IsBetterMatch( const pair<double, int> &prMatchA, const pair<double, int> &prMatchB )
+{
+	return prMatchA.first > prMatchB.first || ( prMatchA.first == prMatchB.first && prMatchA.second < prMatchB.second );
+}
+
+// constructor
+CTopKCollector::CTopKCollector( const int nNumTop )
+{
+	Reset( nNumTop );
+}
+
+// destructor
+CTopKCollector::~CTopKCollector()
+{
+}
+
+// drop kept pairs and set the number of pairs to keep
+void CTopKCollector::Reset( const int nNumTop )
+{
+	m_nNumTop = max( nNumTop, 0 );
+	m_vecHeap.clear();
+	m_vecHeap.reserve( m_nNumTop );
+}
+
+// offer a pair, the heap compares with IsBetterMatch so its front is the worst kept pair
+void CTopKCollector::Add( const double dScore, const int nImageIdx )
+{
+	const pair<double, int> prMatch( dScore, nImageIdx );
+	if( (int)m_vecHeap.size() < m_nNumTop )
+	{
+		m_vecHeap.push_back( prMatch );
+		push_heap( m_vecHeap.begin(), m_vecHeap.end(), IsBetterMatch );
+	}
+	else if( m_nNumTop > 0 && IsBetterMatch( prMatch, m_vecHeap.front() ) )
+	{
+		// the pair replaces the worst kept pair
+		pop_heap( m_vecHeap.begin(), m_vecHeap.end(), IsBetterMatch );
+		m_vecHeap.back() = prMatch;
+		push_heap( m_vecHeap.begin(), m_vecHeap.end(), IsBetterMatch );
+	}
+}
+
+// whether the number of pairs to keep is reached
+bool CTopKCollector::IsFull() const
+{
+	return m_nNumTop > 0 && (int)m_vecHeap.size() == m_nNumTop;
+}
+
+// score of the worst kept pair
+double CTopKCollector::GetMinScore() const
+{
+	return m_vecHeap.empty() ? 0.0 : m_vecHeap.front().first;
+}
+
+// number of kept pairs
+int CTopKCollector::GetNumKept() const
+{
+	return m_vecHeap.size();
+}
+
+// best pairs first, the kept pairs are moved out and the collector keeps the number of pairs to keep
+void CTopKCollector::GetSortedMatches( std::vector< std::pair<double, int> > &vecTopMatches )
+{
+	sort_heap( m_vecHeap.begin(), m_vecHeap.end(), IsBetterMatch );
+	vecTopMatches.swap( m_vecHeap );
+	m_vecHeap.clear();
+	m_vecHeap.reserve( m_nNumTop );
+}
@@ -21,12 +21,49 @@
  * Email:  sumandeep.banerjee@gmail.com
 */
 
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
 #include "Common.h"
+#include "Distance.h"
+#include "TaskPool.h"
 #include "VocabTree.h"
 
 using namespace std;
 using namespace cv;
 
+// minimum number of descriptors at a node for scoring its children as a block (GEMM)
+static const int MIN_GEMM_ROWS = 8;
+
+// bound on the rounding error of a block score per dimension, relative to the squared norms of the descriptor and
+// the center, children scoring within the bound of the best are re-scored with the direct kernel
+static const float GEMM_SCORE_EPSILON = 4e-6f;
+
+// minimum number of descriptors at a node for building its subtrees as parallel tasks
+static const int MIN_PARALLEL_ROWS = 2000;
+
+// task building the subtree of one child node
+class CBuildSubTreeTask : public CTask
+{
+public:
+	CVocabTreeNode*		m_pNode;
+	const Mat*			m_pDescriptors;
+	const vector<int>*	m_pDescImgIdx;
+	int					m_nNumImages;
+	int					m_nNumClusters;
+	int					m_nTreeLevels;
+	const CKMeans*		m_pKMeans;
+	uint64				m_nSeed;
+	int					m_nError;
+
+	void Run()
+	{
+		m_nError = m_pNode->BuildSubTree( *m_pDescriptors, *m_pDescImgIdx,
+			m_nNumImages, m_nNumClusters, m_nTreeLevels, *m_pKMeans, m_nSeed );
+	}
+};
+
 // constructor
 CVocabTreeNode::CVocabTreeNode()
 {
@@ -66,21 +103,13 @@ bool CVocabTreeNode::IsLeaf() const
 	return( 0 == m_vecChileNodes.size() /* || m_nLeafIndex >= 0*/ );
 }
 
-// recursively build the subtree from this node
+// recursively build the subtree from this node (siblings in parallel)
 int CVocabTreeNode::BuildSubTree( const cv::Mat &matDescriptors,
 	const std::vector<int> &vecDescImgIdx,
 	const int nNumImages, const int nNumClusters,
-	const int nTreeLevels, const int nMAXITER )
+	const int nTreeLevels, const CKMeans &cKMeans,
+	const uint64 nSeed )
 {
-	// static leaf counter
-	static int nLeafCounter = -1;
-
-	// reinit leaf counter when beginning to build a tree
-	if( IsRoot() )
-	{
-		nLeafCounter = 0;
-	}
-
 	// compute node descriptor (mean of all vectors)
 	reduce( matDescriptors, m_matNodeDescriptor, 0, CV_REDUCE_AVG );
 
@@ -98,42 +127,17 @@ int CVocabTreeNode::BuildSubTree( const cv::Mat &matDescriptors,
 	// return if node level has reached max levels or less points than clusters
 	if( matDescriptors.rows < nNumClusters || m_nLevelId >= nTreeLevels )
 	{
-		// set leaf index
-		m_nLeafIndex = nLeafCounter;
-
-		// increment leaf counter
-		nLeafCounter++;
-
-#if 0
-		// compute term frequency and set inverted list
-		int cTerms = 0;
-		int iTermFreq = 1;
-		m_vecTermFrequency.resize( nNumUniqueImageIdx );
-		m_vecInvIdxList.resize( nNumUniqueImageIdx );
-		m_vecInvIdxList[0] = vecDescImgIdx[0];
-		for( unsigned int i = 1; i < vecDescImgIdx.size(); i++ )
-		{
-			if( vecDescImgIdx[i] != vecDescImgIdx[i - 1] )
-			{
-				m_vecTermFrequency[cTerms] = iTermFreq;
-				cTerms++;
-				m_vecInvIdxList[cTerms] = vecDescImgIdx[i];
-				iTermFreq = 1;
-			}
-			else
-			{
-				iTermFreq++;
-			}
-		}
-		m_vecTermFrequency[cTerms] = iTermFreq;
-#endif
+		// leaf index is assigned once the whole tree is built
+		m_nLeafIndex = -1;
 
 		return 0;
 	}
 
-	// arrange the descriptors into further K clusters
-	Mat matLabels;
-	kmeans( matDescriptors, nNumClusters, matLabels, TermCriteria( CV_TERMCRIT_ITER, nMAXITER, 1.0 ), 5, KMEANS_PP_CENTERS );
+	// arrange the descriptors into further K clusters,
+	// seeding per node keeps the tree identical regardless of thread scheduling
+	RNG rng( nSeed );
+	Mat matLabels, matCenters;
+	cKMeans.Cluster( matDescriptors, nNumClusters, matLabels, matCenters, rng );
 
 	// divide descriptors into K sub-lists
 	vector<Mat> vecClusterDescr( nNumClusters );
@@ -151,23 +155,254 @@ int CVocabTreeNode::BuildSubTree( const cv::Mat &matDescriptors,
 		vecvecDescImgIdx[ matLabels.at<int>(i) ].push_back( vecDescImgIdx[i] );
 	}
 
-	int error = 0;
-	m_vecChileNodes.resize( nNumClusters );
-	// for each of K clusters
+	// drop clusters that ended up empty
+	int nNumChildren = 0;
 	for( int k = 0; k < nNumClusters; k++ )
+	{
+		if( vecClusterDescr[k].rows > 0 )
+		{
+			vecClusterDescr[nNumChildren] = vecClusterDescr[k];
+			vecvecDescImgIdx[nNumChildren].swap( vecvecDescImgIdx[k] );
+			nNumChildren++;
+		}
+	}
+
+	m_vecChileNodes.resize( nNumChildren );
+	vector<CBuildSubTreeTask> vecTasks( nNumChildren );
+	// for each of K clusters
+	for( int k = 0; k < nNumChildren; k++ )
 	{ 
 		m_vecChileNodes[k] = new CVocabTreeNode;
 		m_vecChileNodes[k]->m_pParentNode = this;
 		m_vecChileNodes[k]->m_nLevelId = this->m_nLevelId + 1;
 
-		// build sub-tree
-		error = m_vecChileNodes[k]->BuildSubTree( vecClusterDescr[k], vecvecDescImgIdx[k],
-			nNumImages, nNumClusters, nTreeLevels, nMAXITER );
+		// sub-tree build task with a seed derived from the parent seed
+		vecTasks[k].m_pNode = m_vecChileNodes[k];
+		vecTasks[k].m_pDescriptors = &vecClusterDescr[k];
+		vecTasks[k].m_pDescImgIdx = &vecvecDescImgIdx[k];
+		vecTasks[k].m_nNumImages = nNumImages;
+		vecTasks[k].m_nNumClusters = nNumClusters;
+		vecTasks[k].m_nTreeLevels = nTreeLevels;
+		vecTasks[k].m_pKMeans = &cKMeans;
+		vecTasks[k].m_nSeed = nSeed * 6364136223846793005ULL + 1442695040888963407ULL * ( k + 1 );
+		vecTasks[k].m_nError = 0;
+	}
+
+	// build sub-trees, independent siblings run on the task pool when large enough
+	if( matDescriptors.rows >= MIN_PARALLEL_ROWS )
+	{
+		vector<CTask*> vecTaskPtrs( nNumChildren );
+		for( int k = 0; k < nNumChildren; k++ )
+		{
+			vecTaskPtrs[k] = &vecTasks[k];
+		}
+		g_TaskPool.Run( vecTaskPtrs );
+	}
+	else
+	{
+		for( int k = 0; k < nNumChildren; k++ )
+		{
+			vecTasks[k].Run();
+		}
+	}
+
+	int error = 0;
+	for( int k = 0; k < nNumChildren; k++ )
+	{
+		if( 0 != vecTasks[k].m_nError )
+		{
+			error = vecTasks[k].m_nError;
+		}
 	}
 
 	return error;
 }
 
+// build the subtree from a descriptor stream, spilling child partitions to disk
+int CVocabTreeNode::BuildSubTreeStreamed( CDescriptorSource &cSource,
+	const std::string &strPartitionPrefix,
+	const int64 nMemoryBudget, const int nNumImages,
+	const int nNumClusters, const int nTreeLevels,
+	const CKMeans &cSampleKMeans, const CKMeans &cKMeans,
+	const uint64 nSeed )
+{
+	// first pass: count rows and images, accumulate the mean and keep a reservoir sample
+	RNG rng( nSeed );
+	Mat matChunk, matSample;
+	vector<int> vecChunkImgIdx;
+	vector<double> vecSum;
+	int64 nNumRows = 0, nMaxSampleRows = 0;
+	int nNumUniqueImageIdx = 0, nLastImgIdx = -1, nDims = 0, nRows;
+	if( 0 != cSource.Rewind() )
+	{
+		return -1;
+	}
+	while( ( nRows = cSource.ReadChunk( matChunk, vecChunkImgIdx ) ) > 0 )
+	{
+		if( 0 == nDims )
+		{
+			// the sample takes at most half of the budget
+			nDims = matChunk.cols;
+			vecSum.assign( nDims, 0.0 );
+			nMaxSampleRows = MAX( (int64)nNumClusters, nMemoryBudget / ( 2 * nDims * (int64)sizeof(float) ) );
+		}
+
+		for( int i = 0; i < nRows; i++, nNumRows++ )
+		{
+			const float *pRow = matChunk.ptr<float>( i );
+			for( int d = 0; d < nDims; d++ )
+			{
+				vecSum[d] += pRow[d];
+			}
+			if( vecChunkImgIdx[i] != nLastImgIdx )
+			{
+				nLastImgIdx = vecChunkImgIdx[i];
+				nNumUniqueImageIdx++;
+			}
+
+			// reservoir sampling, every row has the same chance to be kept
+			int64 nSlot = nNumRows;
+			if( nNumRows >= nMaxSampleRows )
+			{
+				nSlot = int64( rng.uniform( 0.0, 1.0 ) * double( nNumRows + 1 ) );
+				if( nSlot >= nMaxSampleRows )
+				{
+					continue;
+				}
+			}
+			else if( matSample.empty() )
+			{
+				matSample.create( (int)nMaxSampleRows, nDims, CV_32F );
+			}
+			Mat matSlot = matSample.row( (int)nSlot );
+			matChunk.row( i ).copyTo( matSlot );
+		}
+	}
+	if( nRows < 0 || 0 == nNumRows )
+	{
+		return -1;
+	}
+
+	// partition fits in memory (with room for splitting it), build the rest of the subtree in memory
+	if( 2 * nNumRows * int64( nDims * sizeof(float) + sizeof(int) ) <= nMemoryBudget )
+	{
+		matSample = Mat();
+		Mat matDescriptors( (int)nNumRows, nDims, CV_32F );
+		vector<int> vecDescImgIdx;
+		vecDescImgIdx.reserve( nNumRows );
+		cSource.Rewind();
+		while( ( nRows = cSource.ReadChunk( matChunk, vecChunkImgIdx ) ) > 0 )
+		{
+			const int nFirstRow = vecDescImgIdx.size();
+			Mat matRows = matDescriptors.rowRange( nFirstRow, nFirstRow + nRows );
+			matChunk.copyTo( matRows );
+			vecDescImgIdx.insert( vecDescImgIdx.end(), vecChunkImgIdx.begin(), vecChunkImgIdx.end() );
+		}
+		if( nRows < 0 || (int64)vecDescImgIdx.size() != nNumRows )
+		{
+			return -1;
+		}
+
+		return BuildSubTree( matDescriptors, vecDescImgIdx, nNumImages,
+			nNumClusters, nTreeLevels, cKMeans, nSeed );
+	}
+
+	// node descriptor (mean of all vectors) and weight from the streamed counts
+	m_matNodeDescriptor.create( 1, nDims, CV_32F );
+	for( int d = 0; d < nDims; d++ )
+	{
+		m_matNodeDescriptor.at<float>( d ) = float( vecSum[d] / double(nNumRows) );
+	}
+	m_dNodeWeight = log( double(nNumImages) / double(nNumUniqueImageIdx) );
+
+	// return if node level has reached max levels
+	if( m_nLevelId >= nTreeLevels )
+	{
+		m_nLeafIndex = -1;
+		return 0;
+	}
+
+	// cluster centers are estimated from the sample
+	Mat matLabels, matCenters;
+	cSampleKMeans.Cluster( matSample.rowRange( 0, (int)MIN( nNumRows, nMaxSampleRows ) ),
+		nNumClusters, matLabels, matCenters, rng );
+	matSample = Mat();
+
+	// second pass: spill every row to the partition file of its closest center
+	vector<CPartitionFileWriter> vecWriters( nNumClusters );
+	for( int k = 0; k < nNumClusters; k++ )
+	{
+		stringstream strBuffer;
+		strBuffer << strPartitionPrefix << "_" << k << ".bin";
+		if( 0 != vecWriters[k].Open( strBuffer.str(), nDims ) )
+		{
+			return -1;
+		}
+	}
+	cSource.Rewind();
+	while( ( nRows = cSource.ReadChunk( matChunk, vecChunkImgIdx ) ) > 0 )
+	{
+		for( int i = 0; i < nRows; i++ )
+		{
+			int k = FindClosestCenter( matChunk.ptr<float>( i ), matCenters.ptr<float>(), nNumClusters, nDims );
+			if( 0 != vecWriters[k].Append( matChunk.ptr<float>( i ), vecChunkImgIdx[i] ) )
+			{
+				return -1;
+			}
+		}
+	}
+	if( nRows < 0 )
+	{
+		return -1;
+	}
+
+	// build child subtrees one after the other from their partition files, dropping empty clusters
+	int error = 0;
+	for( int k = 0; k < nNumClusters; k++ )
+	{
+		stringstream strBuffer;
+		strBuffer << strPartitionPrefix << "_" << k;
+		const string strChildPrefix = strBuffer.str();
+		const string strFileName = strChildPrefix + ".bin";
+		if( 0 != vecWriters[k].Close() )
+		{
+			error = -1;
+		}
+		if( 0 == error && vecWriters[k].GetNumRows() > 0 )
+		{
+			CVocabTreeNode *pChildNode = new CVocabTreeNode;
+			pChildNode->m_pParentNode = this;
+			pChildNode->m_nLevelId = this->m_nLevelId + 1;
+			m_vecChileNodes.push_back( pChildNode );
+
+			CPartitionFileSource cChildSource( strFileName, nNumImages );
+			error = pChildNode->BuildSubTreeStreamed( cChildSource, strChildPrefix, nMemoryBudget,
+				nNumImages, nNumClusters, nTreeLevels, cSampleKMeans, cKMeans,
+				nSeed * 6364136223846793005ULL + 1442695040888963407ULL * ( k + 1 ) );
+		}
+		remove( strFileName.c_str() );
+	}
+
+	return error;
+}
+
+// number leaves depth first, returns next free leaf index
+int CVocabTreeNode::AssignLeafIndices( int nLeafCounter )
+{
+	if( IsLeaf() )
+	{
+		m_nLeafIndex = nLeafCounter;
+		return nLeafCounter + 1;
+	}
+
+	for( vector<CVocabTreeNode*>::iterator it = m_vecChileNodes.begin(); it != m_vecChileNodes.end(); it++ )
+	{
+		nLeafCounter = (*it)->AssignLeafIndices( nLeafCounter );
+	}
+
+	return nLeafCounter;
+}
+
 // recursively save sub tree to XML/YAML file
 int CVocabTreeNode::SaveSubTree( cv::FileStorage &fs ) const
 {
@@ -277,8 +512,10 @@ const CVocabTreeNode* CVocabTreeNode::SearchSubTree( const cv::Mat &matQueryDesc
 		const CVocabTreeNode* pBestMatch = NULL;
 		for( vector<CVocabTreeNode*>::const_iterator it = m_vecChileNodes.begin(); it != m_vecChileNodes.end(); it++ )
 		{
-			Mat matError = matQueryDescr - (*it)->m_matNodeDescriptor;	// difference of feature vector
-			double dMatchScore = matError.dot( matError );				// inner product
+			float fMatchScore;
+			ComputeSquaredL2( matQueryDescr.ptr<float>(), (*it)->m_matNodeDescriptor.ptr<float>(), 1,
+				matQueryDescr.cols, &fMatchScore );
+			double dMatchScore = fMatchScore;
 			if( dMatchScore < dBestScore )
 			{
 				dBestScore = dMatchScore;
@@ -297,6 +534,10 @@ CVocabTree::CVocabTree()
 	m_pRootNode = NULL;
 	m_nNumClusters = 10;
 	m_nTreeLevels = 6;
+	m_nNumNodes = 0;
+	m_pChildOffset = NULL;
+	m_pLeafIndex = NULL;
+	m_pNodeWeight = NULL;
 }
 
 // destructor
@@ -308,12 +549,13 @@ CVocabTree::~CVocabTree()
 // check whether tree is emptry or not
 bool CVocabTree::IsEmpty() const
 {
-	return ( NULL == m_pRootNode );
+	return ( 0 == m_nNumNodes );
 }
 
-// build vocabulary tree from linked list of image data
-int CVocabTree::BuildTree( const std::list<CImageData*> &vecImageData, 
-	const int nNumClusters, const int nTreeLevels, const int nMAXITER )
+// build vocabulary tree from array of image data
+int CVocabTree::BuildTree( const std::vector<CImageData*> &vecImageData, 
+	const int nNumClusters, const int nTreeLevels, const int nMAXITER,
+	const int nAttempts, const int nSeeding )
 {
 	Clear();
 
@@ -334,7 +576,7 @@ int CVocabTree::BuildTree( const std::list<CImageData*> &vecImageData,
 
 	// initialize set of descriptors and index of the first image
 	prevRow = matDescriptors.rows;
-	list<CImageData*>::const_iterator it = vecImageData.begin();
+	vector<CImageData*>::const_iterator it = vecImageData.begin();
 	matDescriptors = (*it)->GetDescriptors().clone();
 	currRow = matDescriptors.rows;
 	for( int i = prevRow; i < currRow; i++ )
@@ -355,9 +597,358 @@ int CVocabTree::BuildTree( const std::list<CImageData*> &vecImageData,
 	}
 
 	// build tree recursively from the root node
+	CKMeans cKMeans( nMAXITER, nAttempts, nSeeding );
 	m_pRootNode = new CVocabTreeNode;
-	return m_pRootNode->BuildSubTree( matDescriptors, vecDescImgIdx,
-		vecImageData.size(), m_nNumClusters, m_nTreeLevels, nMAXITER );
+	int error = m_pRootNode->BuildSubTree( matDescriptors, vecDescImgIdx,
+		vecImageData.size(), m_nNumClusters, m_nTreeLevels, cKMeans, 0 );
+
+	// number leaves in depth first order, independent of build order
+	m_pRootNode->AssignLeafIndices( 0 );
+
+	// compile the search layout
+	Freeze();
+
+	return error;
+}
+
+// build vocabulary tree from a descriptor stream within a memory budget (bytes)
+int CVocabTree::BuildTree( CDescriptorSource &cSource,
+	const std::string &strTempPath, const int64 nMemoryBudget,
+	const int nNumClusters, const int nTreeLevels,
+	const int nBatchSize, const int nMAXITER, const int nAttempts )
+{
+	Clear();
+
+	// return error if source is empty
+	if( cSource.GetNumImages() < 1 || nMemoryBudget < 1 )
+	{
+		return -1;
+	}
+
+	// set k-means parameters
+	m_nNumClusters = nNumClusters;
+	m_nTreeLevels = nTreeLevels;
+
+	// large nodes are split by mini-batch k-means on a sample, partitions that fit are built in memory
+	CKMeans cSampleKMeans( nMAXITER, nAttempts, KMEANS_PP_CENTERS, nBatchSize );
+	CKMeans cKMeans( nMAXITER, nAttempts, KMEANS_PP_CENTERS );
+	m_pRootNode = new CVocabTreeNode;
+	int error = m_pRootNode->BuildSubTreeStreamed( cSource, strTempPath + "/vocab_part", nMemoryBudget,
+		cSource.GetNumImages(), m_nNumClusters, m_nTreeLevels, cSampleKMeans, cKMeans, 0 );
+	if( 0 != error )
+	{
+		Clear();
+		return error;
+	}
+
+	m_pRootNode->AssignLeafIndices( 0 );
+	Freeze();
+
+	return 0;
+}
+
+// offer up to nMaxPerImage random descriptors of an image to the reservoir of nMaxSamples slots,
+// every descriptor offered has the same chance to stay
+static void OfferImageSample( const Mat &matImageDescr, const int nImageIdx,
+	const int nMaxSamples, const int nMaxPerImage, RNG &rng,
+	Mat &matSample, vector<int> &vecSampleImgIdx, int64 &nNumOffered )
+{
+	if( matImageDescr.rows < 1 )
+	{
+		return;
+	}
+	if( matSample.empty() )
+	{
+		matSample.create( nMaxSamples, matImageDescr.cols, CV_32F );
+		vecSampleImgIdx.reserve( nMaxSamples );
+	}
+
+	// random subset of the image descriptors (partial shuffle)
+	vector<int> vecRows( matImageDescr.rows );
+	for( int i = 0; i < matImageDescr.rows; i++ )
+	{
+		vecRows[i] = i;
+	}
+	int nNumPicked = ( nMaxPerImage > 0 ) ? MIN( nMaxPerImage, matImageDescr.rows ) : matImageDescr.rows;
+	for( int i = 0; i < nNumPicked; i++ )
+	{
+		swap( vecRows[i], vecRows[ rng.uniform( i, matImageDescr.rows ) ] );
+	}
+
+	// offer picked descriptors to the reservoir
+	for( int i = 0; i < nNumPicked; i++, nNumOffered++ )
+	{
+		int nSlot;
+		if( nNumOffered < nMaxSamples )
+		{
+			nSlot = int( nNumOffered );
+			vecSampleImgIdx.push_back( nImageIdx );
+		}
+		else
+		{
+			int64 nDraw = int64( rng.uniform( 0.0, 1.0 ) * double( nNumOffered + 1 ) );
+			if( nDraw >= nMaxSamples )
+			{
+				continue;
+			}
+			nSlot = int( nDraw );
+			vecSampleImgIdx[nSlot] = nImageIdx;
+		}
+		Mat matSlot = matSample.row( nSlot );
+		matImageDescr.row( vecRows[i] ).convertTo( matSlot, CV_32F );
+	}
+}
+
+// build vocabulary tree from a bounded descriptor sample
+int CVocabTree::BuildTreeSampled( CDescriptorSource &cSource,
+	const int nMaxSamples, const int nMaxPerImage,
+	const int nNumClusters, const int nTreeLevels,
+	const int nBatchSize, const int nMAXITER, const int nAttempts )
+{
+	Clear();
+
+	// return error if source is empty
+	if( cSource.GetNumImages() < 1 || nMaxSamples < 1 || 0 != cSource.Rewind() )
+	{
+		return -1;
+	}
+
+	// set k-means parameters
+	m_nNumClusters = nNumClusters;
+	m_nTreeLevels = nTreeLevels;
+
+	// stratified reservoir sample over the stream, only the sample and the descriptors of one image are held
+	RNG rng( 0 );
+	Mat matSample;
+	vector<int> vecSampleImgIdx;
+	int64 nNumOffered = 0;
+	Mat matChunk, matImageDescr;
+	vector<int> vecChunkImgIdx;
+	int nImageIdx = -1;
+	int nNumRows;
+	while( ( nNumRows = cSource.ReadChunk( matChunk, vecChunkImgIdx ) ) > 0 )
+	{
+		for( int iBegin = 0, iEnd = 0; iBegin < nNumRows; iBegin = iEnd )
+		{
+			iEnd = iBegin + 1;
+			while( iEnd < nNumRows && vecChunkImgIdx[iEnd] == vecChunkImgIdx[iBegin] )
+			{
+				iEnd++;
+			}
+
+			// rows of an image may continue from the previous chunk
+			if( vecChunkImgIdx[iBegin] != nImageIdx )
+			{
+				OfferImageSample( matImageDescr, nImageIdx, nMaxSamples, nMaxPerImage, rng,
+					matSample, vecSampleImgIdx, nNumOffered );
+				matImageDescr = Mat();
+				nImageIdx = vecChunkImgIdx[iBegin];
+			}
+			matImageDescr.push_back( matChunk.rowRange( iBegin, iEnd ) );
+		}
+	}
+	if( nNumRows < 0 )
+	{
+		return -1;
+	}
+	OfferImageSample( matImageDescr, nImageIdx, nMaxSamples, nMaxPerImage, rng,
+		matSample, vecSampleImgIdx, nNumOffered );
+	matImageDescr = Mat();
+
+	if( vecSampleImgIdx.empty() )
+	{
+		return -1;
+	}
+
+	// order the sample by image index, as node weights count consecutive image indices
+	vector< pair<int, int> > vecOrder( vecSampleImgIdx.size() );
+	for( unsigned int i = 0; i < vecOrder.size(); i++ )
+	{
+		vecOrder[i] = pair<int, int>( vecSampleImgIdx[i], i );
+	}
+	sort( vecOrder.begin(), vecOrder.end() );
+	Mat matDescriptors( vecOrder.size(), matSample.cols, CV_32F );
+	vector<int> vecDescImgIdx( vecOrder.size() );
+	for( unsigned int i = 0; i < vecOrder.size(); i++ )
+	{
+		Mat matRow = matDescriptors.row( i );
+		matSample.row( vecOrder[i].second ).copyTo( matRow );
+		vecDescImgIdx[i] = vecOrder[i].first;
+	}
+	matSample = Mat();
+
+	// build tree from the sample with mini-batch k-means at each node
+	CKMeans cKMeans( nMAXITER, nAttempts, KMEANS_PP_CENTERS, nBatchSize );
+	m_pRootNode = new CVocabTreeNode;
+	int error = m_pRootNode->BuildSubTree( matDescriptors, vecDescImgIdx,
+		cSource.GetNumImages(), m_nNumClusters, m_nTreeLevels, cKMeans, 0 );
+	if( 0 != error )
+	{
+		Clear();
+		return error;
+	}
+
+	m_pRootNode->AssignLeafIndices( 0 );
+	Freeze();
+
+	// sample based weights are replaced by weights over the full corpus (a second pass over the stream)
+	error = ComputeNodeWeights( cSource );
+	if( 0 != error )
+	{
+		Clear();
+	}
+
+	return error;
+}
+
+// task quantizing a range of descriptor rows to frozen leaf nodes
+class CQuantizeTask : public CTask
+{
+public:
+	const CVocabTree*				m_pTree;
+	const Mat*						m_pDescriptors;
+	int								m_nBegin;
+	int								m_nEnd;
+	vector<int>						m_vecLeafNodes;		// frozen leaf node of each row in the range
+	int								m_nError;
+
+	void Run()
+	{
+		m_nError = m_pTree->QuantizeBatch( m_pDescriptors->rowRange( m_nBegin, m_nEnd ), m_vecLeafNodes );
+	}
+};
+
+// parent of every frozen node (-1 for the root)
+void CVocabTree::ComputeParents( std::vector<int> &vecParent ) const
+{
+	vecParent.assign( m_nNumNodes, -1 );
+	for( int i = 0; i < m_nNumNodes; i++ )
+	{
+		for( int iChild = m_pChildOffset[i]; iChild < m_pChildOffset[i + 1]; iChild++ )
+		{
+			vecParent[iChild] = i;
+		}
+	}
+}
+
+// IDF weights from the number of images reaching each node
+int CVocabTree::SetNodeWeights( const std::vector<int> &vecFrequency, const int nNumImages )
+{
+	// a mapped tree gets own weights, its centers stay mapped
+	m_vecNodeWeight.resize( m_nNumNodes );
+	for( int i = 0; i < m_nNumNodes; i++ )
+	{
+		m_vecNodeWeight[i] = log( double(nNumImages) / double( MAX( vecFrequency[i], 1 ) ) );
+	}
+	m_pNodeWeight = &m_vecNodeWeight[0];
+
+	// keep the pointer tree in sync for saving
+	if( NULL != m_pRootNode )
+	{
+		vector<CVocabTreeNode*> vecNodes;
+		CollectNodes( vecNodes );
+		for( int i = 0; i < m_nNumNodes; i++ )
+		{
+			vecNodes[i]->m_dNodeWeight = m_vecNodeWeight[i];
+		}
+	}
+
+	return 0;
+}
+
+// recompute IDF weights by quantizing all descriptors of a stream
+int CVocabTree::ComputeNodeWeights( CDescriptorSource &cSource )
+{
+	if( 0 == m_nNumNodes || cSource.GetNumImages() < 1 || 0 != cSource.Rewind() )
+	{
+		return -1;
+	}
+
+	vector<int> vecParent;
+	ComputeParents( vecParent );
+
+	vector<int> vecFrequency( m_nNumNodes, 0 );
+	vector<int> vecLastImage( m_nNumNodes, -1 );
+	Mat matChunk;
+	vector<int> vecChunkImgIdx;
+	int nNumRows;
+	while( ( nNumRows = cSource.ReadChunk( matChunk, vecChunkImgIdx ) ) > 0 )
+	{
+		// quantize the chunk in parallel row ranges
+		int nNumShards = MIN( nNumRows, g_TaskPool.GetNumThreads() );
+		vector<CQuantizeTask> vecTasks( nNumShards );
+		vector<CTask*> vecTaskPtrs( nNumShards );
+		for( int s = 0; s < nNumShards; s++ )
+		{
+			vecTasks[s].m_pTree = this;
+			vecTasks[s].m_pDescriptors = &matChunk;
+			vecTasks[s].m_nBegin = int( int64(nNumRows) * s / nNumShards );
+			vecTasks[s].m_nEnd = int( int64(nNumRows) * ( s + 1 ) / nNumShards );
+			vecTaskPtrs[s] = &vecTasks[s];
+		}
+		g_TaskPool.Run( vecTaskPtrs );
+
+		// count each node on the path to the root once per image, image indices never decrease
+		for( int s = 0; s < nNumShards; s++ )
+		{
+			if( 0 != vecTasks[s].m_nError )
+			{
+				return vecTasks[s].m_nError;
+			}
+			for( unsigned int j = 0; j < vecTasks[s].m_vecLeafNodes.size(); j++ )
+			{
+				const int nImageIdx = vecChunkImgIdx[ vecTasks[s].m_nBegin + j ];
+				for( int nNode = vecTasks[s].m_vecLeafNodes[j]; nNode >= 0 && vecLastImage[nNode] != nImageIdx; nNode = vecParent[nNode] )
+				{
+					vecLastImage[nNode] = nImageIdx;
+					vecFrequency[nNode]++;
+				}
+			}
+		}
+	}
+	if( nNumRows < 0 )
+	{
+		return -1;
+	}
+
+	return SetNodeWeights( vecFrequency, cSource.GetNumImages() );
+}
+
+// recompute IDF weights from the stored words of all images
+int CVocabTree::ComputeNodeWeights( const CWordTable &cWordTable )
+{
+	const int nNumImages = cWordTable.GetNumImages();
+	if( 0 == m_nNumNodes || 0 == nNumImages || cWordTable.GetVocabSize() != GetNumLeaves() )
+	{
+		return -1;
+	}
+
+	vector<int> vecParent;
+	ComputeParents( vecParent );
+
+	// count each node on the path to the root once per image
+	vector<int> vecFrequency( m_nNumNodes, 0 );
+	vector<int> vecLastImage( m_nNumNodes, -1 );
+	for( int i = 0; i < nNumImages; i++ )
+	{
+		const int *pWordIds;
+		const int nNumWords = cWordTable.GetImageWords( i, pWordIds );
+		for( int j = 0; j < nNumWords; j++ )
+		{
+			const int nLeafNode = GetLeafNode( pWordIds[j] );
+			if( nLeafNode < 0 )
+			{
+				return -1;
+			}
+			for( int nNode = nLeafNode; nNode >= 0 && vecLastImage[nNode] != i; nNode = vecParent[nNode] )
+			{
+				vecLastImage[nNode] = i;
+				vecFrequency[nNode]++;
+			}
+		}
+	}
+
+	return SetNodeWeights( vecFrequency, nNumImages );
 }
 
 // save vocab tree to file
@@ -373,9 +964,10 @@ int CVocabTree::SaveTree( const std::string &strFileName ) const
 	fs << "clusters" << m_nNumClusters;
 	fs << "maxlevel" << m_nTreeLevels;
 	fs << "treenode" << "[";
-	if( NULL != m_pRootNode)
+	if( m_nNumNodes > 0 )
 	{
-		error = m_pRootNode->SaveSubTree( fs );
+		// written from the frozen layout, which is also available for mapped trees
+		error = SaveFrozenSubTree( fs, 0, 0 );
 	}
 	fs << "]";
 	fs.release();
@@ -383,6 +975,29 @@ int CVocabTree::SaveTree( const std::string &strFileName ) const
 	return error;
 }
 
+// recursively save frozen sub tree to XML/YAML file (same layout as CVocabTreeNode::SaveSubTree)
+int CVocabTree::SaveFrozenSubTree( cv::FileStorage &fs, const int nNode, const int nLevel ) const
+{
+	int error = 0;
+
+	fs << "{";
+	fs << "level" << nLevel;
+	fs << "descriptor" << m_matNodeCenters.row( nNode );
+	fs << "leafindex" << m_pLeafIndex[nNode];
+	fs << "nodeweight" << m_pNodeWeight[nNode];
+	fs << "invlist" << vector<int>();
+	fs << "termfreq" << vector<int>();
+	fs << "treenode" << "[";
+	for( int iChild = m_pChildOffset[nNode]; iChild < m_pChildOffset[nNode + 1]; iChild++ )
+	{
+		error = SaveFrozenSubTree( fs, iChild, nLevel + 1 );
+	}
+	fs << "]";
+	fs << "}";
+
+	return error;
+}
+
 // load vocab tree from file
 int CVocabTree::LoadTree( const std::string &strFileName )
 {
@@ -405,9 +1020,165 @@ int CVocabTree::LoadTree( const std::string &strFileName )
 
 	fs.release();
 
+	// compile the search layout
+	Freeze();
+
 	return error;
 }
 
+// header of the binary vocab tree file, followed by the node arrays
+struct SVocabFileHeader
+{
+	char				szMagic[8];			// VOCAB_MAGIC
+	int					nVersion;			// VOCAB_VERSION
+	int					nNumClusters;		// number of clusters per node
+	int					nTreeLevels;		// number of levels
+	int					nNumNodes;			// number of nodes
+	int					nDims;				// descriptor dimensions
+	int					nReserved;			// zero
+	int64				nChildOffsetPos;	// file offset of child offsets (int, nodes + 1)
+	int64				nLeafIndexPos;		// file offset of leaf indices (int, nodes)
+	int64				nNodeWeightPos;		// file offset of node weights (double, nodes)
+	int64				nCentersPos;		// file offset of node centers (float, nodes x dims, 64 byte aligned)
+	int64				nFileSize;			// size of the whole file
+	uint64				nChecksum;			// checksum of everything following the header
+};
+
+static const char VOCAB_MAGIC[8] = { 'V', 'O', 'C', 'A', 'B', 'T', 'R', 'E' };
+static const int VOCAB_VERSION = 1;
+
+// save vocab tree to binary file
+int CVocabTree::SaveTreeBinary( const std::string &strFileName ) const
+{
+	if( 0 == m_nNumNodes )
+	{
+		return -1;
+	}
+
+	// array positions, centers are aligned for vector loads
+	SVocabFileHeader sHeader;
+	memset( &sHeader, 0, sizeof(sHeader) );
+	memcpy( sHeader.szMagic, VOCAB_MAGIC, sizeof(VOCAB_MAGIC) );
+	sHeader.nVersion = VOCAB_VERSION;
+	sHeader.nNumClusters = m_nNumClusters;
+	sHeader.nTreeLevels = m_nTreeLevels;
+	sHeader.nNumNodes = m_nNumNodes;
+	sHeader.nDims = m_matNodeCenters.cols;
+	sHeader.nChildOffsetPos = sizeof(SVocabFileHeader);
+	sHeader.nLeafIndexPos = sHeader.nChildOffsetPos + int64( m_nNumNodes + 1 ) * sizeof(int);
+	sHeader.nNodeWeightPos = alignSize( sHeader.nLeafIndexPos + int64( m_nNumNodes ) * sizeof(int), sizeof(double) );
+	sHeader.nCentersPos = alignSize( sHeader.nNodeWeightPos + int64( m_nNumNodes ) * sizeof(double), 64 );
+	sHeader.nFileSize = sHeader.nCentersPos + int64( m_nNumNodes ) * sHeader.nDims * sizeof(float);
+
+	FILE *pFile = CreateReplacementFile( strFileName );
+	if( NULL == pFile )
+	{
+		return -1;
+	}
+
+	// header is rewritten with the checksum once the arrays are written
+	int64 nPos = 0;
+	uint64 nChecksum = ComputeChecksum( NULL, 0 );
+	int error = 0;
+	if( 1 != fwrite( &sHeader, sizeof(sHeader), 1, pFile ) )
+	{
+		error = -1;
+	}
+	nPos += sizeof(sHeader);
+	if( 0 == error )
+	{
+		error = WriteBlock( pFile, m_pChildOffset, ( m_nNumNodes + 1 ) * sizeof(int), nPos, nChecksum )
+			|| WriteBlock( pFile, m_pLeafIndex, m_nNumNodes * sizeof(int), nPos, nChecksum )
+			|| WritePadding( pFile, sHeader.nNodeWeightPos, nPos, nChecksum )
+			|| WriteBlock( pFile, m_pNodeWeight, m_nNumNodes * sizeof(double), nPos, nChecksum )
+			|| WritePadding( pFile, sHeader.nCentersPos, nPos, nChecksum ) ? -1 : 0;
+	}
+	for( int i = 0; 0 == error && i < m_nNumNodes; i++ )
+	{
+		error = WriteBlock( pFile, m_matNodeCenters.ptr<float>( i ), sHeader.nDims * sizeof(float), nPos, nChecksum );
+	}
+	if( 0 == error )
+	{
+		sHeader.nChecksum = nChecksum;
+		if( 0 != fseek( pFile, 0, SEEK_SET ) || 1 != fwrite( &sHeader, sizeof(sHeader), 1, pFile ) )
+		{
+			error = -1;
+		}
+	}
+
+	return CommitReplacementFile( pFile, strFileName, error );
+}
+
+// map binary vocab tree file and search it in place
+int CVocabTree::LoadTreeBinary( const std::string &strFileName, const bool fVerifyChecksum )
+{
+	Clear();
+
+	if( 0 != m_cMappedFile.Open( strFileName ) || m_cMappedFile.GetSize() < sizeof(SVocabFileHeader) )
+	{
+		Clear();
+		return -1;
+	}
+
+	// validate header before pointing into the mapping
+	const unsigned char *pData = m_cMappedFile.GetData();
+	SVocabFileHeader sHeader;
+	memcpy( &sHeader, pData, sizeof(sHeader) );
+	const int64 nNumNodes = sHeader.nNumNodes;
+	if( 0 != memcmp( sHeader.szMagic, VOCAB_MAGIC, sizeof(VOCAB_MAGIC) )
+		|| VOCAB_VERSION != sHeader.nVersion
+		|| nNumNodes < 1 || sHeader.nDims < 1
+		|| sHeader.nFileSize != (int64)m_cMappedFile.GetSize()
+		|| sHeader.nChildOffsetPos < (int64)sizeof(sHeader)
+		|| sHeader.nLeafIndexPos < sHeader.nChildOffsetPos + ( nNumNodes + 1 ) * (int64)sizeof(int)
+		|| sHeader.nNodeWeightPos < sHeader.nLeafIndexPos + nNumNodes * (int64)sizeof(int)
+		|| sHeader.nCentersPos < sHeader.nNodeWeightPos + nNumNodes * (int64)sizeof(double)
+		|| sHeader.nFileSize < sHeader.nCentersPos + nNumNodes * sHeader.nDims * (int64)sizeof(float)
+		|| 0 != sHeader.nChildOffsetPos % sizeof(int) || 0 != sHeader.nLeafIndexPos % sizeof(int)
+		|| 0 != sHeader.nNodeWeightPos % sizeof(double) || 0 != sHeader.nCentersPos % sizeof(float) )
+	{
+		Clear();
+		return -1;
+	}
+	if( fVerifyChecksum && sHeader.nChecksum != ComputeChecksum( pData + sizeof(sHeader), sHeader.nFileSize - sizeof(sHeader) ) )
+	{
+		Clear();
+		return -1;
+	}
+
+	// children follow their parent in breadth first order and stay inside the node arrays,
+	// so every descent ends at a leaf, and leaf indices stay inside the leaf table
+	const int *pChildOffset = (const int*)( pData + sHeader.nChildOffsetPos );
+	const int *pLeafIndex = (const int*)( pData + sHeader.nLeafIndexPos );
+	if( nNumNodes != pChildOffset[nNumNodes] )
+	{
+		Clear();
+		return -1;
+	}
+	for( int64 i = 0; i < nNumNodes; i++ )
+	{
+		const bool fLeaf = ( pChildOffset[i] == pChildOffset[i + 1] );
+		if( pChildOffset[i] <= i || pChildOffset[i] > pChildOffset[i + 1]
+			|| pLeafIndex[i] >= nNumNodes || ( fLeaf && pLeafIndex[i] < 0 ) )
+		{
+			Clear();
+			return -1;
+		}
+	}
+
+	// arrays are used directly from the mapping, pages are loaded on demand
+	m_nNumClusters = sHeader.nNumClusters;
+	m_nTreeLevels = sHeader.nTreeLevels;
+	m_nNumNodes = sHeader.nNumNodes;
+	m_pChildOffset = pChildOffset;
+	m_pLeafIndex = pLeafIndex;
+	m_pNodeWeight = (const double*)( pData + sHeader.nNodeWeightPos );
+	m_matNodeCenters = Mat( m_nNumNodes, sHeader.nDims, CV_32F, (void*)( pData + sHeader.nCentersPos ) );
+	IndexLeaves();
+
+	return 0;
+}
+
 // clear vocabulary tree
 void CVocabTree::Clear()
 {
@@ -419,6 +1190,85 @@ void CVocabTree::Clear()
 
 	m_nNumClusters = 10;
 	m_nTreeLevels = 6;
+
+	m_nNumNodes = 0;
+	m_matNodeCenters = Mat();
+	m_pChildOffset = NULL;
+	m_pLeafIndex = NULL;
+	m_pNodeWeight = NULL;
+	m_vecChildOffset.clear();
+	m_vecLeafIndex.clear();
+	m_vecNodeWeight.clear();
+	m_vecLeafNode.clear();
+	m_cMappedFile.Close();
+}
+
+// list nodes in breadth first (frozen) order
+void CVocabTree::CollectNodes( std::vector<CVocabTreeNode*> &vecNodes ) const
+{
+	// children of a node end up adjacent
+	vecNodes.assign( 1, m_pRootNode );
+	for( unsigned int i = 0; i < vecNodes.size(); i++ )
+	{
+		const vector<CVocabTreeNode*> &vecChildNodes = vecNodes[i]->m_vecChileNodes;
+		vecNodes.insert( vecNodes.end(), vecChildNodes.begin(), vecChildNodes.end() );
+	}
+}
+
+// compile pointer tree into the frozen layout
+void CVocabTree::Freeze()
+{
+	if( NULL == m_pRootNode )
+	{
+		return;
+	}
+
+	vector<CVocabTreeNode*> vecNodes;
+	CollectNodes( vecNodes );
+
+	// allocate one contiguous (aligned) center array and the parallel node arrays
+	m_nNumNodes = vecNodes.size();
+	m_matNodeCenters.create( m_nNumNodes, m_pRootNode->m_matNodeDescriptor.cols, CV_32F );
+	m_vecChildOffset.resize( m_nNumNodes + 1 );
+	m_vecLeafIndex.resize( m_nNumNodes );
+	m_vecNodeWeight.resize( m_nNumNodes );
+
+	// fill node data, children of each node follow the children of the previous node
+	int nNextChild = 1;
+	for( int i = 0; i < m_nNumNodes; i++ )
+	{
+		Mat matCenter = m_matNodeCenters.row( i );
+		vecNodes[i]->m_matNodeDescriptor.convertTo( matCenter, CV_32F );
+		m_vecChildOffset[i] = nNextChild;
+		m_vecLeafIndex[i] = vecNodes[i]->m_nLeafIndex;
+		m_vecNodeWeight[i] = vecNodes[i]->m_dNodeWeight;
+		nNextChild += vecNodes[i]->m_vecChileNodes.size();
+	}
+	m_vecChildOffset[m_nNumNodes] = nNextChild;
+
+	m_pChildOffset = &m_vecChildOffset[0];
+	m_pLeafIndex = &m_vecLeafIndex[0];
+	m_pNodeWeight = &m_vecNodeWeight[0];
+	IndexLeaves();
+}
+
+// map leaf indices to frozen nodes
+void CVocabTree::IndexLeaves()
+{
+	m_vecLeafNode.clear();
+	for( int i = 0; i < m_nNumNodes; i++ )
+	{
+		const int nLeafIdx = m_pLeafIndex[i];
+		if( nLeafIdx < 0 )
+		{
+			continue;
+		}
+		if( nLeafIdx >= (int)m_vecLeafNode.size() )
+		{
+			m_vecLeafNode.resize( nLeafIdx + 1, -1 );
+		}
+		m_vecLeafNode[nLeafIdx] = i;
+	}
 }
 
 // build a list of leaf node pointers
@@ -432,13 +1282,216 @@ int CVocabTree::BuildLeafList( std::list<const CVocabTreeNode*> &lstLeafList ) c
 	return m_pRootNode->BuildLeafList( lstLeafList );
 }
 
-// returns the closest leaf node to the query descriptor
-const CVocabTreeNode* CVocabTree::SearchTree( const cv::Mat &matQueryDescr ) const
+// returns frozen node index of the closest leaf to the query descriptor
+int CVocabTree::SearchTree( const cv::Mat &matQueryDescr ) const
 {
-	if( 1 != matQueryDescr.rows && 128 != matQueryDescr.cols )
+	if( 0 == m_nNumNodes || 1 != matQueryDescr.rows || m_matNodeCenters.cols != matQueryDescr.cols
+		|| CV_32F != matQueryDescr.type() )
+	{
+		return -1;
+	}
+
+	const int nDims = m_matNodeCenters.cols;
+	const float *pQuery = matQueryDescr.ptr<float>();
+
+	// descend from the root, stop when the node has no children
+	int nNode = 0;
+	while( m_pChildOffset[nNode] < m_pChildOffset[nNode + 1] )
 	{
-		return NULL;
+		// score all adjacent children in one call and descend into the closest
+		int nFirstChild = m_pChildOffset[nNode];
+		nNode = nFirstChild + FindClosestCenter( pQuery, m_matNodeCenters.ptr<float>( nFirstChild ),
+			m_pChildOffset[nNode + 1] - nFirstChild, nDims );
 	}
 
-	return m_pRootNode->SearchSubTree( matQueryDescr );
+	return nNode;
+}
+
+// frozen leaf node index for every descriptor row (level by level)
+int CVocabTree::QuantizeBatch( const cv::Mat &matDescriptors, std::vector<int> &vecLeafIds ) const
+{
+	vecLeafIds.clear();
+	if( 0 == m_nNumNodes || m_matNodeCenters.cols != matDescriptors.cols || CV_32F != matDescriptors.type() )
+	{
+		return -1;
+	}
+
+	const int nDims = m_matNodeCenters.cols;
+	const int nNumDescriptors = matDescriptors.rows;
+
+	// all descriptors start at the root, (node, row) pairs of descriptors still descending
+	vecLeafIds.assign( nNumDescriptors, 0 );
+	vector< pair<int, int> > vecActive( nNumDescriptors );
+	for( int i = 0; i < nNumDescriptors; i++ )
+	{
+		vecActive[i] = pair<int, int>( 0, i );
+	}
+
+	// workspace reused by all node blocks
+	Mat matBlockBuffer( nNumDescriptors, nDims, CV_32F );
+	Mat matDotBuffer;
+	vector<float> vecCenterNorm;
+
+	// descend one level per pass
+	while( !vecActive.empty() )
+	{
+		// group descriptors by their current node
+		sort( vecActive.begin(), vecActive.end() );
+
+		vector< pair<int, int> > vecNextActive;
+		vecNextActive.reserve( vecActive.size() );
+		for( unsigned int iBegin = 0, iEnd = 0; iBegin < vecActive.size(); iBegin = iEnd )
+		{
+			const int nNode = vecActive[iBegin].first;
+			iEnd = iBegin + 1;
+			while( iEnd < vecActive.size() && vecActive[iEnd].first == nNode )
+			{
+				iEnd++;
+			}
+
+			// descriptors that reached a leaf are done
+			const int nFirstChild = m_pChildOffset[nNode];
+			const int nNumChildren = m_pChildOffset[nNode + 1] - nFirstChild;
+			if( 0 == nNumChildren )
+			{
+				for( unsigned int i = iBegin; i < iEnd; i++ )
+				{
+					vecLeafIds[ vecActive[i].second ] = nNode;
+				}
+				continue;
+			}
+
+			const Mat matChildren = m_matNodeCenters.rowRange( nFirstChild, nFirstChild + nNumChildren );
+			const int nBlockRows = iEnd - iBegin;
+			if( nBlockRows < MIN_GEMM_ROWS )
+			{
+				// few descriptors, score them one by one
+				for( unsigned int i = iBegin; i < iEnd; i++ )
+				{
+					int nChild = nFirstChild + FindClosestCenter( matDescriptors.ptr<float>( vecActive[i].second ),
+						matChildren.ptr<float>(), nNumChildren, nDims );
+					vecNextActive.push_back( pair<int, int>( nChild, vecActive[i].second ) );
+				}
+				continue;
+			}
+
+			// gather the block of descriptors at this node
+			Mat matBlock = matBlockBuffer.rowRange( 0, nBlockRows );
+			for( int i = 0; i < nBlockRows; i++ )
+			{
+				Mat matRow = matBlock.row( i );
+				matDescriptors.row( vecActive[iBegin + i].second ).copyTo( matRow );
+			}
+
+			// |x - c|^2 = |x|^2 - 2 x.c + |c|^2, where |x|^2 does not affect the closest child
+			vecCenterNorm.resize( nNumChildren );
+			float fMaxCenterNorm = 0.0f;
+			for( int k = 0; k < nNumChildren; k++ )
+			{
+				const float *pCenter = matChildren.ptr<float>( k );
+				float fNorm = 0.0f;
+				for( int d = 0; d < nDims; d++ )
+				{
+					fNorm += pCenter[d] * pCenter[d];
+				}
+				vecCenterNorm[k] = fNorm;
+				fMaxCenterNorm = MAX( fMaxCenterNorm, fNorm );
+			}
+			gemm( matBlock, matChildren, 1.0, Mat(), 0.0, matDotBuffer, GEMM_2_T );
+
+			// pick the closest child for every descriptor in the block
+			for( int i = 0; i < nBlockRows; i++ )
+			{
+				const float *pDot = matDotBuffer.ptr<float>( i );
+				float fBestScore = vecCenterNorm[0] - 2.0f * pDot[0];
+				int nBestMatch = 0;
+				for( int k = 1; k < nNumChildren; k++ )
+				{
+					float fMatchScore = vecCenterNorm[k] - 2.0f * pDot[k];
+					if( fMatchScore < fBestScore )
+					{
+						fBestScore = fMatchScore;
+						nBestMatch = k;
+					}
+				}
+
+				// near ties are decided by the direct kernel in child order, so the block picks the same child as
+				// FindClosestCenter (SearchTree and the one by one path)
+				const float *pRow = matBlock.ptr<float>( i );
+				float fRowNorm = 0.0f;
+				for( int d = 0; d < nDims; d++ )
+				{
+					fRowNorm += pRow[d] * pRow[d];
+				}
+				const float fTieScore = fBestScore + GEMM_SCORE_EPSILON * nDims * ( fRowNorm + fMaxCenterNorm );
+				bool fTied = false;
+				for( int k = 0; k < nNumChildren && !fTied; k++ )
+				{
+					fTied = ( k != nBestMatch && vecCenterNorm[k] - 2.0f * pDot[k] <= fTieScore );
+				}
+				if( fTied )
+				{
+					float fBestDistance = FLT_MAX;
+					for( int k = 0; k < nNumChildren; k++ )
+					{
+						if( vecCenterNorm[k] - 2.0f * pDot[k] > fTieScore )
+						{
+							continue;
+						}
+						float fDistance;
+						ComputeSquaredL2( pRow, matChildren.ptr<float>( k ), 1, nDims, &fDistance );
+						if( fDistance < fBestDistance )
+						{
+							fBestDistance = fDistance;
+							nBestMatch = k;
+						}
+					}
+				}
+				vecNextActive.push_back( pair<int, int>( nFirstChild + nBestMatch, vecActive[iBegin + i].second ) );
+			}
+		}
+
+		vecActive.swap( vecNextActive );
+	}
+
+	return 0;
+}
+
+// visual word (leaf index) for every descriptor row
+int CVocabTree::QuantizeWords( const cv::Mat &matDescriptors, std::vector<int> &vecWordIds ) const
+{
+	if( 0 != QuantizeBatch( matDescriptors, vecWordIds ) )
+	{
+		return -1;
+	}
+	for( unsigned int i = 0; i < vecWordIds.size(); i++ )
+	{
+		vecWordIds[i] = m_pLeafIndex[vecWordIds[i]];
+	}
+
+	return 0;
+}
+
+// number of visual words
+int CVocabTree::GetNumLeaves() const
+{
+	return m_vecLeafNode.size();
+}
+
+// frozen node of a leaf index (-1 if out of range)
+int CVocabTree::GetLeafNode( const int nLeafIdx ) const
+{
+	return ( nLeafIdx >= 0 && nLeafIdx < (int)m_vecLeafNode.size() ) ? m_vecLeafNode[nLeafIdx] : -1;
+}
+
+// get leaf index of frozen node
+int CVocabTree::GetLeafIndex( const int nNode ) const
+{
+	return m_pLeafIndex[nNode];
+}
+
+// get IDF weight of frozen node
+double CVocabTree::GetNodeWeight( const int nNode ) const
+{
+	return m_pNodeWeight[nNode];
 }
@@ -0,0 +1,212 @@
+/*
+ *     Copyright (C) 2014-2018 Sumandeep Banerjee
+ * 
+ *     This program is free software: you can redistribute it and/or modify
+ *     it under the terms of the GNU Lesser General Public License as published by
+ *     the Free Software Foundation, either version 3 of the License, or
+ *     (at your option) any later version.
+ * 
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ * 
+ *     You should have received a copy of the GNU Lesser General Public License
+ *     along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 
+ * File:   
+ * Author: sumandeep
+ * Email:  sumandeep.banerjee@gmail.com
+*/
+
+#include <string.h>
+#include "Common.h"
+#include "WordTable.h"
+
+using namespace std;
+using namespace cv;
+
+// header of the binary word table file, followed by the table arrays
+struct SWordFileHeader
+{
+	char				szMagic[8];			// WORD_MAGIC
+	int					nVersion;			// WORD_VERSION
+	int					nNumImages;			// number of rows
+	int					nVocabSize;			// number of leaves of the vocabulary
+	int					nReserved;			// zero
+	int64				nNumWordIds;		// total number of words
+	int64				nRowOffsetPos;		// file offset of row offsets (int64, images + 1)
+	int64				nWordIdPos;			// file offset of words (int32, words)
+	int64				nFileSize;			// size of the whole file
+	uint64				nChecksum;			// checksum of everything following the header
+};
+
+static const char WORD_MAGIC[8] = { 'W', 'O', 'R', 'D', 'T', 'A', 'B', 'L' };
+static const int WORD_VERSION = 1;
+
+// arrays of the binary word table file in file order, positions refer to the header fields
+static void GetFileArrays( SWordFileHeader &sHeader, vector<STableArray> &vecArrays )
+{
+	STableArray sRowOffsets = { NULL, sizeof(int64), int64( sHeader.nNumImages ) + 1, &sHeader.nRowOffsetPos };
+	STableArray sWordIds = { NULL, sizeof(int), sHeader.nNumWordIds, &sHeader.nWordIdPos };
+	vecArrays.clear();
+	vecArrays.push_back( sRowOffsets );
+	vecArrays.push_back( sWordIds );
+}
+
+// constructor
+CWordTable::CWordTable()
+{
+	Clear();
+}
+
+// destructor
+CWordTable::~CWordTable()
+{
+	Clear();
+}
+
+// remove all rows, words of new rows refer to a vocabulary of the given size
+void CWordTable::Clear( const int nVocabSize )
+{
+	m_cMappedFile.Close();
+	m_vecRowOffsets.assign( 1, 0 );
+	vector<int>().swap( m_vecWordIds );
+	m_nNumImages = 0;
+	m_nVocabSize = nVocabSize;
+	BindArrays();
+}
+
+// point the table at the owned arrays
+void CWordTable::BindArrays()
+{
+	m_pRowOffsets = &m_vecRowOffsets[0];
+	m_pWordIds = m_vecWordIds.empty() ? NULL : &m_vecWordIds[0];
+}
+
+// copy a mapped table to owned arrays before appending
+void CWordTable::Thaw()
+{
+	if( !m_cMappedFile.IsOpen() )
+	{
+		return;
+	}
+
+	const int64 nNumWordIds = m_pRowOffsets[m_nNumImages];
+	m_vecRowOffsets.assign( m_pRowOffsets, m_pRowOffsets + m_nNumImages + 1 );
+	m_vecWordIds.assign( m_pWordIds, m_pWordIds + nNumWordIds );
+	m_cMappedFile.Close();
+	BindArrays();
+}
+
+// append words of the next image
+int CWordTable::AddImageWords( const std::vector<int> &vecWordIds )
+{
+	Thaw();
+
+	for( unsigned int i = 0; i < vecWordIds.size(); i++ )
+	{
+		if( vecWordIds[i] < 0 || vecWordIds[i] >= m_nVocabSize )
+		{
+			return -1;
+		}
+	}
+	m_vecWordIds.insert( m_vecWordIds.end(), vecWordIds.begin(), vecWordIds.end() );
+	m_vecRowOffsets.push_back( m_vecWordIds.size() );
+	m_nNumImages++;
+	BindArrays();
+
+	return 0;
+}
+
+// release unused capacity after bulk adding
+void CWordTable::Compact()
+{
+	if( m_cMappedFile.IsOpen() )
+	{
+		return;
+	}
+
+	vector<int64>( m_vecRowOffsets ).swap( m_vecRowOffsets );
+	vector<int>( m_vecWordIds ).swap( m_vecWordIds );
+	BindArrays();
+}
+
+// number of rows
+int CWordTable::GetNumImages() const
+{
+	return m_nNumImages;
+}
+
+// number of leaves of the vocabulary the words refer to
+int CWordTable::GetVocabSize() const
+{
+	return m_nVocabSize;
+}
+
+// words of an image (valid while the table is unchanged), returns their number
+int CWordTable::GetImageWords( const int nImageIdx, const int *&pWordIds ) const
+{
+	pWordIds = m_pWordIds + m_pRowOffsets[nImageIdx];
+	return int( m_pRowOffsets[nImageIdx + 1] - m_pRowOffsets[nImageIdx] );
+}
+
+// bytes used by the owned arrays
+size_t CWordTable::GetMemoryUsage() const
+{
+	return m_vecRowOffsets.capacity() * sizeof(int64)
+		+ m_vecWordIds.capacity() * sizeof(int);
+}
+
+// save word table to binary file
+int CWordTable::SaveTableBinary( const std::string &strFileName ) const
+{
+	SWordFileHeader sHeader;
+	memset( &sHeader, 0, sizeof(sHeader) );
+	memcpy( sHeader.szMagic, WORD_MAGIC, sizeof(WORD_MAGIC) );
+	sHeader.nVersion = WORD_VERSION;
+	sHeader.nNumImages = m_nNumImages;
+	sHeader.nVocabSize = m_nVocabSize;
+	sHeader.nNumWordIds = m_pRowOffsets[m_nNumImages];
+
+	vector<STableArray> vecArrays;
+	GetFileArrays( sHeader, vecArrays );
+	vecArrays[0].pData = m_pRowOffsets;
+	vecArrays[1].pData = m_pWordIds;
+
+	return SaveTableFile( strFileName, &sHeader, sizeof(sHeader), vecArrays, sHeader.nFileSize, sHeader.nChecksum );
+}
+
+// map binary word table file and use it in place
+int CWordTable::LoadTableBinary( const std::string &strFileName, const bool fVerifyChecksum )
+{
+	Clear();
+
+	// validate header and arrays before pointing into the mapping
+	SWordFileHeader sHeader;
+	if( 0 != MapTableFile( m_cMappedFile, strFileName, &sHeader, sizeof(sHeader), WORD_MAGIC, WORD_VERSION ) )
+	{
+		Clear();
+		return -1;
+	}
+	vector<STableArray> vecArrays;
+	GetFileArrays( sHeader, vecArrays );
+	if( sHeader.nNumImages < 0 || sHeader.nVocabSize < 0
+		|| 0 != BindTableArrays( m_cMappedFile, sizeof(sHeader), sHeader.nFileSize, sHeader.nChecksum, vecArrays, fVerifyChecksum )
+		|| 0 != CheckRowOffsets( (const int64*)vecArrays[0].pData, sHeader.nNumImages, sHeader.nNumWordIds ) )
+	{
+		Clear();
+		return -1;
+	}
+
+	// arrays are used directly from the mapping, pages are loaded on demand
+	vector<int64>().swap( m_vecRowOffsets );
+	m_nNumImages = sHeader.nNumImages;
+	m_nVocabSize = sHeader.nVocabSize;
+	m_pRowOffsets = (const int64*)vecArrays[0].pData;
+	m_pWordIds = (const int*)vecArrays[1].pData;
+
+	return 0;
+}
@@ -24,6 +24,9 @@
 #include <stdio.h>
 #include <iomanip>
 #include "Common.h"
+#include "Distance.h"
+#include "KMeans.h"
+#include "PostingList.h"
 #include "SearchEngine.h"
 
 using namespace std;
@@ -44,10 +47,402 @@ void printHelp( const string& strAppName )
 	cout << String( 15, '-' ) << endl;
 	cout << strAppName << " s dbpath dbname querypath" << endl << endl;
 
+	cout << "Benchmark: " << endl;
+	cout << String( 15, '-' ) << endl;
+	cout << strAppName << " b kernel|kmeans|postings" << endl << endl;
+
+	cout << "Binary Conversion (vocabulary tree, hash table and descriptor records): " << endl;
+	cout << String( 15, '-' ) << endl;
+	cout << strAppName << " c dbpath dbname" << endl << endl;
+
+	cout << "IDF Reweighting (from the stored visual words, without quantizing descriptors): " << endl;
+	cout << String( 15, '-' ) << endl;
+	cout << strAppName << " r dbpath dbname" << endl << endl;
+
 	cout << "dbpath         - path to database folder location" << endl;
 	cout << "dbname         - name of the database file" << endl;
 	cout << "trainingpath   - path location of training files" << endl;
-	cout << "querypath      - path location of validation files" << endl << endl;
+	cout << "querypath      - path location of validation files" << endl;
+	cout << "kernel         - distance kernel for child selection (K=10, 128-d)" << endl;
+	cout << "kmeans         - bounded k-means against cv::kmeans (K=10, 128-d)" << endl;
+	cout << "postings       - compressed posting lists against raw (image, weight) pairs" << endl;
+	cout << "c              - convert XML vocabulary tree, hash table and descriptor records to the binary format (packed store when enabled)" << endl;
+	cout << "r              - recompute node weights of the vocabulary tree from the word table and rebuild the hash table" << endl << endl;
+}
+
+// convert XML vocabulary tree, hash table and image records of a database to the binary format
+int convertDB( const string &strDBPath, const string &strDBName )
+{
+	const string strFileName = strDBPath + "/" + strDBName + VOCAB_FILE;
+	CVocabTree cVocabTree;
+
+	cout << "Loading vocabulary tree...";
+	int64 nStart = getTickCount();
+	if( cVocabTree.LoadTree( strFileName + FILE_FORMAT ) )
+	{
+		cerr << "Failed to load vocabulary tree." << endl;
+		return -1;
+	}
+	cout << "success (" << double( getTickCount() - nStart ) / getTickFrequency() << " s)\n";
+
+	cout << "Saving binary vocabulary tree...";
+	if( cVocabTree.SaveTreeBinary( strFileName + BINARY_FORMAT ) )
+	{
+		cerr << "Failed to save binary vocabulary tree." << endl;
+		return -1;
+	}
+	cout << "success\n";
+
+	cout << "Mapping binary vocabulary tree...";
+	nStart = getTickCount();
+	if( cVocabTree.LoadTreeBinary( strFileName + BINARY_FORMAT ) )
+	{
+		cerr << "Failed to map binary vocabulary tree." << endl;
+		return -1;
+	}
+	cout << "success (" << double( getTickCount() - nStart ) / getTickFrequency() << " s)\n";
+
+	const string strHashFileName = strDBPath + "/" + strDBName + HASH_FILE;
+	CHashTable cHashTable;
+
+	cout << "Loading hash table...";
+	nStart = getTickCount();
+	if( cHashTable.LoadTable( strHashFileName + FILE_FORMAT ) )
+	{
+		cerr << "Failed to load hash table." << endl;
+		return -1;
+	}
+	cout << "success (" << double( getTickCount() - nStart ) / getTickFrequency() << " s)\n";
+
+	cout << "Saving binary hash table...";
+	if( cHashTable.SaveTableBinary( strHashFileName + BINARY_FORMAT ) )
+	{
+		cerr << "Failed to save binary hash table." << endl;
+		return -1;
+	}
+	cout << "success\n";
+
+	cout << "Mapping binary hash table...";
+	nStart = getTickCount();
+	if( cHashTable.LoadTableBinary( strHashFileName + BINARY_FORMAT ) )
+	{
+		cerr << "Failed to map binary hash table." << endl;
+		return -1;
+	}
+	cout << "success (" << double( getTickCount() - nStart ) / getTickFrequency() << " s, "
+		<< cHashTable.GetNumImages() << " images, " << cHashTable.GetNumBins() << " bins)\n";
+
+	// names of the image records from the main file
+	vector<String> vecImageNames;
+	FileStorage fs( strDBPath + "/" + strDBName + MAIN_FILE + FILE_FORMAT, FileStorage::READ );
+	if( !fs.isOpened() )
+	{
+		cerr << "Failed to load image database file." << endl;
+		return -1;
+	}
+	FileNode fs_imgnode = fs["images"];
+	read( fs_imgnode, vecImageNames );
+	fs.release();
+
+	// records are either packed into a single store or converted file by file
+	CRecordStore cRecordStore;
+	if( PACK_RECORDS && cRecordStore.Create( strDBPath + "/" + strDBName + RECORD_FILE ) )
+	{
+		cerr << "Failed to create record store." << endl;
+		return -1;
+	}
+
+	cout << ( PACK_RECORDS ? "Packing image records..." : "Converting descriptor records..." );
+	nStart = getTickCount();
+	for( unsigned int i = 0; i < vecImageNames.size(); i++ )
+	{
+		CImageData cImageData( strDBPath, vecImageNames[i] );
+		if( PACK_RECORDS ? cImageData.PackRecord( &cRecordStore, i ) : cImageData.MigrateRecord( QUANTIZE_RECORDS ) )
+		{
+			cerr << "Failed to convert image record " << vecImageNames[i] << "." << endl;
+			return -1;
+		}
+	}
+	if( PACK_RECORDS && cRecordStore.Flush() )
+	{
+		cerr << "Failed to save record store index." << endl;
+		return -1;
+	}
+	cout << "success (" << double( getTickCount() - nStart ) / getTickFrequency() << " s, "
+		<< vecImageNames.size() << " records)\n";
+
+	return 0;
+}
+
+// benchmark child selection: Mat based path vs vectorized distance kernel
+int benchDistanceKernel()
+{
+	const int nNumClusters = 10;
+	const int nDims = 128;
+	const int nNumQueries = 1000;
+	const int nRepeat = 200;
+
+	// random SURF-like descriptors and cluster centers
+	Mat matCenters( nNumClusters, nDims, CV_32F );
+	Mat matQueries( nNumQueries, nDims, CV_32F );
+	RNG rng( 0x1234 );
+	rng.fill( matCenters, RNG::UNIFORM, Scalar( -0.5 ), Scalar( 0.5 ) );
+	rng.fill( matQueries, RNG::UNIFORM, Scalar( -0.5 ), Scalar( 0.5 ) );
+
+	// Mat based path (temporary Mat per child)
+	vector<int> vecMatLabels( nNumQueries );
+	int64 nStart = getTickCount();
+	for( int r = 0; r < nRepeat; r++ )
+	{
+		for( int i = 0; i < nNumQueries; i++ )
+		{
+			double dBestScore = INF;
+			for( int k = 0; k < nNumClusters; k++ )
+			{
+				Mat matError = matQueries.row( i ) - matCenters.row( k );
+				double dMatchScore = matError.dot( matError );
+				if( dMatchScore < dBestScore )
+				{
+					dBestScore = dMatchScore;
+					vecMatLabels[i] = k;
+				}
+			}
+		}
+	}
+	double dMatTime = double( getTickCount() - nStart ) / getTickFrequency();
+
+	// vectorized kernel path (all children in one call)
+	vector<int> vecKernelLabels( nNumQueries );
+	nStart = getTickCount();
+	for( int r = 0; r < nRepeat; r++ )
+	{
+		for( int i = 0; i < nNumQueries; i++ )
+		{
+			vecKernelLabels[i] = FindClosestCenter( matQueries.ptr<float>( i ), matCenters.ptr<float>(),
+				nNumClusters, nDims );
+		}
+	}
+	double dKernelTime = double( getTickCount() - nStart ) / getTickFrequency();
+
+	int nMismatch = 0;
+	for( int i = 0; i < nNumQueries; i++ )
+	{
+		nMismatch += ( vecMatLabels[i] != vecKernelLabels[i] );
+	}
+
+	double dNumCalls = double( nRepeat ) * nNumQueries;
+	cout << "Distance kernel benchmark (K = " << nNumClusters << ", " << nDims << "-d)" << endl;
+	cout << "Mat path:      " << 1.0E9 * dMatTime / dNumCalls << " ns/node" << endl;
+	cout << "Kernel (" << GetDistanceKernelName() << "): " << 1.0E9 * dKernelTime / dNumCalls << " ns/node" << endl;
+	cout << "Speedup:       " << dMatTime / dKernelTime << "x" << endl;
+	cout << "Mismatches:    " << nMismatch << endl;
+
+	return 0;
+}
+
+// benchmark node clustering: cv::kmeans vs bounded k-means
+int benchKMeans()
+{
+	const int nNumClusters = 10;
+	const int nDims = 128;
+	const int nNumPoints = 50000;
+	const int nMAXITER = 100;
+
+	// points scattered around random cluster centers
+	RNG rng( 0x1234 );
+	Mat matSeeds( 4 * nNumClusters, nDims, CV_32F );
+	rng.fill( matSeeds, RNG::UNIFORM, Scalar( -0.5 ), Scalar( 0.5 ) );
+	Mat matPoints( nNumPoints, nDims, CV_32F );
+	rng.fill( matPoints, RNG::NORMAL, Scalar( 0.0 ), Scalar( 0.15 ) );
+	for( int i = 0; i < nNumPoints; i++ )
+	{
+		Mat matPoint = matPoints.row( i );
+		matPoint += matSeeds.row( rng.uniform( 0, matSeeds.rows ) );
+	}
+
+	// OpenCV k-means, as used by the original tree builder
+	Mat matLabels, matCenters;
+	theRNG() = RNG( 0x5678 );
+	int64 nStart = getTickCount();
+	double dCVCompactness = kmeans( matPoints, nNumClusters, matLabels, TermCriteria( CV_TERMCRIT_ITER, nMAXITER, 1.0 ),
+		1, KMEANS_PP_CENTERS, matCenters );
+	double dCVTime = double( getTickCount() - nStart ) / getTickFrequency();
+
+	// bounded k-means
+	CKMeans cKMeans( nMAXITER, 1, KMEANS_PP_CENTERS );
+	SKMeansStats sStats;
+	RNG rngSeed( 0x5678 );
+	nStart = getTickCount();
+	double dCompactness = cKMeans.Cluster( matPoints, nNumClusters, matLabels, matCenters, rngSeed, &sStats );
+	double dTime = double( getTickCount() - nStart ) / getTickFrequency();
+
+	cout << "k-means benchmark (N = " << nNumPoints << ", K = " << nNumClusters << ", " << nDims << "-d)" << endl;
+	cout << "cv::kmeans:     " << dCVTime << " s, compactness = " << dCVCompactness << endl;
+	cout << "CKMeans:        " << dTime << " s, compactness = " << dCompactness
+		<< ", iterations = " << sStats.nIterations << endl;
+	cout << "Distances:      " << sStats.nDistanceEvals << " of " << sStats.nNaiveEvals << " ("
+		<< 100.0 * ( 1.0 - double( sStats.nDistanceEvals ) / double( sStats.nNaiveEvals ) ) << "% saved)" << endl;
+
+	return 0;
+}
+
+// recompute IDF weights of a database from its stored visual words and save tree and hash table
+int reweightDB( const string &strDBPath, const string &strDBName )
+{
+	CSearchEngine cCoverSearch;
+
+	cout << "Loading database...";
+	int64 nStart = getTickCount();
+	if( cCoverSearch.LoadDB( strDBPath, strDBName, false ) )
+	{
+		cerr << "Failed to load database." << endl;
+		return -1;
+	}
+	cout << "success (" << double( getTickCount() - nStart ) / getTickFrequency() << " s)\n";
+
+	cout << "Reweighting vocabulary tree...";
+	nStart = getTickCount();
+	if( cCoverSearch.ReweightVocabTree() )
+	{
+		cerr << "Failed to reweight vocabulary tree (the word table must cover all images)." << endl;
+		return -1;
+	}
+	cout << "success (" << double( getTickCount() - nStart ) / getTickFrequency() << " s)\n";
+
+	cout << "Saving vocabulary tree and hash table...";
+	if( cCoverSearch.SaveVocabTree() || cCoverSearch.SaveHashTable() )
+	{
+		cerr << "Failed to save vocabulary tree and hash table." << endl;
+		return -1;
+	}
+	cout << "success\n";
+
+	return 0;
+}
+
+// benchmark inverted index scoring: raw postings vs compressed posting lists
+int benchPostingLists()
+{
+	const int nNumImages = 50000;
+	const int nNumWords = 100000;
+	const int nWordsPerImage = 200;
+	const int nNumQueries = 200;
+	const int nNumAppended = 1000;
+
+	// words of every image drawn from a skewed distribution, common words get long lists
+	RNG rng( 0x1234 );
+	vector< vector< pair<int, float> > > vecRawLists( nNumWords );
+	vector<CPostingList> vecPostingLists( nNumWords );
+	vector<int> vecImageWords;
+	for( int i = 0; i < nNumImages; i++ )
+	{
+		// the last images are appended to compacted lists, as images added after the index is built
+		if( nNumImages - nNumAppended == i )
+		{
+			for( int w = 0; w < nNumWords; w++ )
+			{
+				vecPostingLists[w].Compact();
+			}
+		}
+
+		vecImageWords.clear();
+		for( int j = 0; j < nWordsPerImage; j++ )
+		{
+			double dDraw = rng.uniform( 0.0, 1.0 );
+			vecImageWords.push_back( int( nNumWords * dDraw * dDraw * dDraw ) );
+		}
+		sort( vecImageWords.begin(), vecImageWords.end() );
+		vecImageWords.erase( unique( vecImageWords.begin(), vecImageWords.end() ), vecImageWords.end() );
+		for( unsigned int j = 0; j < vecImageWords.size(); j++ )
+		{
+			float fWeight = (float)rng.uniform( 0.001, 0.2 );
+			vecRawLists[ vecImageWords[j] ].push_back( pair<int, float>( i, fWeight ) );
+			vecPostingLists[ vecImageWords[j] ].Append( i, fWeight );
+		}
+	}
+
+	size_t nRawBytes = 0, nCompressedBytes = 0;
+	int64 nNumPostings = 0;
+	int nNumMismatched = 0;
+	for( int w = 0; w < nNumWords; w++ )
+	{
+		vecPostingLists[w].Compact();
+		nNumMismatched += ( vecPostingLists[w].GetNumPostings() != (int)vecRawLists[w].size() ) ? 1 : 0;
+		nNumPostings += vecRawLists[w].size();
+		nRawBytes += sizeof(vecRawLists[w]) + vecRawLists[w].size() * sizeof(pair<int, float>);
+		nCompressedBytes += vecPostingLists[w].GetMemoryUsage();
+	}
+
+	// queries use words from the same distribution
+	vector< vector<int> > vecQueries( nNumQueries );
+	int64 nScoredPostings = 0;
+	for( int q = 0; q < nNumQueries; q++ )
+	{
+		for( int j = 0; j < nWordsPerImage; j++ )
+		{
+			double dDraw = rng.uniform( 0.0, 1.0 );
+			vecQueries[q].push_back( int( nNumWords * dDraw * dDraw * dDraw ) );
+			nScoredPostings += vecRawLists[ vecQueries[q].back() ].size();
+		}
+	}
+
+	// term-at-a-time scoring over raw lists
+	vector<float> vecRawScores( nNumImages ), vecScores( nNumImages );
+	int64 nStart = getTickCount();
+	for( int q = 0; q < nNumQueries; q++ )
+	{
+		fill( vecRawScores.begin(), vecRawScores.end(), 0.0f );
+		for( unsigned int j = 0; j < vecQueries[q].size(); j++ )
+		{
+			const vector< pair<int, float> > &vecList = vecRawLists[ vecQueries[q][j] ];
+			for( unsigned int p = 0; p < vecList.size(); p++ )
+			{
+				vecRawScores[ vecList[p].first ] += vecList[p].second;
+			}
+		}
+	}
+	double dRawTime = double( getTickCount() - nStart ) / getTickFrequency();
+
+	// term-at-a-time scoring decoding compressed blocks on the fly
+	vector<int> vecBlockImageIdx( POSTING_BLOCK_SIZE );
+	vector<float> vecBlockWeights( POSTING_BLOCK_SIZE );
+	nStart = getTickCount();
+	for( int q = 0; q < nNumQueries; q++ )
+	{
+		fill( vecScores.begin(), vecScores.end(), 0.0f );
+		for( unsigned int j = 0; j < vecQueries[q].size(); j++ )
+		{
+			const CPostingList &cList = vecPostingLists[ vecQueries[q][j] ];
+			for( int b = 0; b < cList.GetNumBlocks(); b++ )
+			{
+				int nCount = cList.DecodeBlock( b, &vecBlockImageIdx[0], &vecBlockWeights[0] );
+				for( int p = 0; p < nCount; p++ )
+				{
+					vecScores[ vecBlockImageIdx[p] ] += vecBlockWeights[p];
+				}
+			}
+		}
+	}
+	double dTime = double( getTickCount() - nStart ) / getTickFrequency();
+
+	// weight quantization error on the scores of the last query
+	double dMaxError = 0.0;
+	for( int i = 0; i < nNumImages; i++ )
+	{
+		dMaxError = MAX( dMaxError, fabs( double( vecScores[i] ) - double( vecRawScores[i] ) ) );
+	}
+
+	cout << "Posting list benchmark (" << nNumImages << " images, " << nNumPostings << " postings)" << endl;
+	cout << "Raw:            " << double( nRawBytes ) / nNumPostings << " bytes/posting, "
+		<< 1.0E3 * dRawTime / nNumQueries << " ms/query" << endl;
+	cout << "Compressed:     " << double( nCompressedBytes ) / nNumPostings << " bytes/posting, "
+		<< 1.0E3 * dTime / nNumQueries << " ms/query" << endl;
+	cout << "Memory saved:   " << double( nRawBytes ) / double( nCompressedBytes ) << "x" << endl;
+	cout << "Decode rate:    " << 1.0E-6 * nScoredPostings / dTime << " M postings/s" << endl;
+	cout << "Max score diff: " << dMaxError << endl;
+	cout << "Bad list sizes: " << nNumMismatched << endl;
+
+	return ( 0 == nNumMismatched ) ? 0 : -1;
 }
 
 // sample test application for search engine training and searching
@@ -56,6 +451,35 @@ int main( int argc, char* argv[] )
 	unsigned int posSplit = string( argv[0] ).find_last_of( "/\\" );
 	string strAppName = string( argv[0] ).substr( posSplit + 1 );
 	
+	if( 3 == argc && 0 == strcmp( "b", argv[1] ) ) // benchmark routines
+	{
+		if( 0 == strcmp( "kernel", argv[2] ) )
+		{
+			return benchDistanceKernel();
+		}
+		if( 0 == strcmp( "kmeans", argv[2] ) )
+		{
+			return benchKMeans();
+		}
+		if( 0 == strcmp( "postings", argv[2] ) )
+		{
+			return benchPostingLists();
+		}
+
+		printHelp( strAppName );
+		return -1;
+	}
+
+	if( 4 == argc && 0 == strcmp( "c", argv[1] ) ) // binary conversion routine
+	{
+		return convertDB( argv[2], argv[3] );
+	}
+
+	if( 4 == argc && 0 == strcmp( "r", argv[1] ) ) // IDF reweighting routine
+	{
+		return reweightDB( argv[2], argv[3] );
+	}
+
 	if( 5 != argc )
 	{
 		printHelp( strAppName );
@@ -120,7 +544,7 @@ int main( int argc, char* argv[] )
 
 		// test tree building
 		cout << "Building vocabulary tree...";
-		if ( cCoverSearch.BuildVocabTree( 10, 5 ) )
+		if ( cCoverSearch.BuildVocabTree( 10, 5, VOCAB_SAMPLE_SIZE, VOCAB_SAMPLES_PER_IMAGE ) )
 		{
 			cerr << "Failed to build vocabulary tree." << endl;
 			return -1;